@@ -0,0 +1,94 @@
+#include "AesCtrExIFile.h"
+#include "MemoryMappedFile.h"
+
+AesCtrExIFile::AesCtrExIFile(const fnd::SharedPtr<fnd::IFile>& file, const fnd::aes::sAes128Key& key, const fnd::aes::sAesIvCtr& ctr, size_t offset, size_t size, const fnd::SharedPtr<BucketTree>& subsection_tree) :
+	mFile(file),
+	mEngine(key),
+	mBaseCtr(ctr),
+	mPartitionOffset(offset),
+	mPartitionSize(size),
+	mOffset(0),
+	mSubsectionTree(subsection_tree)
+{
+}
+
+size_t AesCtrExIFile::size()
+{
+	return mPartitionSize;
+}
+
+void AesCtrExIFile::seek(size_t offset)
+{
+	mOffset = offset;
+}
+
+void AesCtrExIFile::read(byte_t* out, size_t len)
+{
+	readAt(out, mOffset, len);
+	mOffset += len;
+}
+
+void AesCtrExIFile::read(byte_t* out, size_t offset, size_t len)
+{
+	seek(offset);
+	read(out, len);
+}
+
+void AesCtrExIFile::readAt(byte_t* out, size_t offset, size_t len)
+{
+	// the subsection is looked up once per call and kept for the rest of it, so there is no state shared between calls
+	sEntry entry;
+	uint64_t entry_begin = 0;
+	uint64_t entry_end = 0;
+
+	while (len > 0)
+	{
+		fnd::aes::sAesIvCtr ctr = mBaseCtr;
+		bool encrypted = true;
+		size_t chunk_len = len;
+
+		// the bucket tree tables at the end of the partition are not part of a subsection
+		if (offset < (*mSubsectionTree)->getEndOffset())
+		{
+			if (offset < entry_begin || offset >= entry_end)
+				(*mSubsectionTree)->find(offset, (byte_t*)&entry, entry_begin, entry_end);
+
+			// the generation replaces the lower half of the upper counter
+			uint32_t generation = entry.generation.get();
+			for (size_t i = 0; i < sizeof(uint32_t); i++)
+				ctr.iv[7 - i] = (byte_t)(generation >> (i * 8));
+
+			encrypted = entry.encryption != ENCRYPTION_NOT_ENCRYPTED;
+			chunk_len = _MIN(len, entry_end - offset);
+		}
+
+		// decrypt straight out of the mapping if possible, otherwise read the ciphertext into out and decrypt it in place
+		size_t file_offset = mPartitionOffset + offset;
+		const byte_t* in = MemoryMappedFile::getMappedData(mFile, file_offset, chunk_len);
+		if (in == nullptr)
+		{
+			readFileAt(**mFile, out, file_offset, chunk_len);
+			in = out;
+		}
+
+		// the counter is relative to the start of the NCA
+		if (encrypted)
+			mEngine.ctrTransform(ctr, file_offset, in, out, chunk_len);
+		else if (in != out)
+			memcpy(out, in, chunk_len);
+
+		out += chunk_len;
+		len -= chunk_len;
+		offset += chunk_len;
+	}
+}
+
+void AesCtrExIFile::write(const byte_t* out, size_t len)
+{
+	throw fnd::Exception(kModuleName, "write() not supported");
+}
+
+void AesCtrExIFile::write(const byte_t* out, size_t offset, size_t len)
+{
+	throw fnd::Exception(kModuleName, "write() not supported");
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <string>
+#include <fnd/IFile.h>
+#include <fnd/SharedPtr.h>
+#include <fnd/aes.h>
+#include "AesEngine.h"
+#include "BucketTree.h"
+#include "IReadAtFile.h"
+
+// AES-CTR-Ex decrypting reader for the partition of a patch NCA, each subsection of the partition is encrypted with its own counter generation
+class AesCtrExIFile : public IReadAtFile
+{
+public:
+#pragma pack(push,1)
+	struct sEntry
+	{
+		le_uint64_t offset;
+		byte_t encryption; // EncryptionValue
+		byte_t reserved[3];
+		le_uint32_t generation;
+	};
+#pragma pack(pop)
+
+	enum EncryptionValue
+	{
+		ENCRYPTION_ENCRYPTED,
+		ENCRYPTION_NOT_ENCRYPTED
+	};
+
+	// file is the whole NCA and the partition is [offset, offset+size) of it, ctr is the partition's counter,
+	// subsection_tree indexes the subsections by offset in the partition, the rest of the partition is decrypted with ctr as is
+	AesCtrExIFile(const fnd::SharedPtr<fnd::IFile>& file, const fnd::aes::sAes128Key& key, const fnd::aes::sAesIvCtr& ctr, size_t offset, size_t size, const fnd::SharedPtr<BucketTree>& subsection_tree);
+
+	size_t size();
+	void seek(size_t offset);
+	void read(byte_t* out, size_t len);
+	void read(byte_t* out, size_t offset, size_t len);
+	void readAt(byte_t* out, size_t offset, size_t len);
+	void write(const byte_t* out, size_t len);
+	void write(const byte_t* out, size_t offset, size_t len);
+private:
+	const std::string kModuleName = "AesCtrExIFile";
+
+	fnd::SharedPtr<fnd::IFile> mFile;
+	AesEngine mEngine;
+	fnd::aes::sAesIvCtr mBaseCtr;
+	size_t mPartitionOffset;
+	size_t mPartitionSize;
+	size_t mOffset;
+	fnd::SharedPtr<BucketTree> mSubsectionTree;
+};
@@ -0,0 +1,55 @@
+#include "AesCtrIFile.h"
+#include "MemoryMappedFile.h"
+
+AesCtrIFile::AesCtrIFile(const fnd::SharedPtr<fnd::IFile>& file, const fnd::aes::sAes128Key& key, const fnd::aes::sAesIvCtr& ctr) :
+	mFile(file),
+	mEngine(key),
+	mBaseCtr(ctr),
+	mOffset(0)
+{
+}
+
+size_t AesCtrIFile::size()
+{
+	return (*mFile)->size();
+}
+
+void AesCtrIFile::seek(size_t offset)
+{
+	mOffset = offset;
+}
+
+void AesCtrIFile::read(byte_t* out, size_t len)
+{
+	readAt(out, mOffset, len);
+	mOffset += len;
+}
+
+void AesCtrIFile::read(byte_t* out, size_t offset, size_t len)
+{
+	seek(offset);
+	read(out, len);
+}
+
+void AesCtrIFile::readAt(byte_t* out, size_t offset, size_t len)
+{
+	// decrypt straight out of the mapping if possible, otherwise read the ciphertext into out and decrypt it in place
+	const byte_t* in = MemoryMappedFile::getMappedData(mFile, offset, len);
+	if (in == nullptr)
+	{
+		readFileAt(**mFile, out, offset, len);
+		in = out;
+	}
+
+	mEngine.ctrTransform(mBaseCtr, offset, in, out, len);
+}
+
+void AesCtrIFile::write(const byte_t* out, size_t len)
+{
+	throw fnd::Exception(kModuleName, "write() not supported");
+}
+
+void AesCtrIFile::write(const byte_t* out, size_t offset, size_t len)
+{
+	throw fnd::Exception(kModuleName, "write() not supported");
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include <fnd/IFile.h>
+#include <fnd/SharedPtr.h>
+#include <fnd/aes.h>
+#include "AesEngine.h"
+#include "IReadAtFile.h"
+
+// AES-CTR decrypting reader, drop in replacement for fnd::AesCtrWrappedIFile that decrypts in bulk using AesEngine
+class AesCtrIFile : public IReadAtFile
+{
+public:
+	AesCtrIFile(const fnd::SharedPtr<fnd::IFile>& file, const fnd::aes::sAes128Key& key, const fnd::aes::sAesIvCtr& ctr);
+
+	size_t size();
+	void seek(size_t offset);
+	void read(byte_t* out, size_t len);
+	void read(byte_t* out, size_t offset, size_t len);
+	void readAt(byte_t* out, size_t offset, size_t len);
+	void write(const byte_t* out, size_t len);
+	void write(const byte_t* out, size_t offset, size_t len);
+private:
+	const std::string kModuleName = "AesCtrIFile";
+
+	fnd::SharedPtr<fnd::IFile> mFile;
+	AesEngine mEngine;
+	fnd::aes::sAesIvCtr mBaseCtr;
+	size_t mOffset;
+};
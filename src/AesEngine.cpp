@@ -0,0 +1,478 @@
+#include "AesEngine.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define AES_ENGINE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AES_ENGINE_TARGET_AESNI
+#define AES_ENGINE_TARGET_VAES
+#else
+#include <cpuid.h>
+#define AES_ENGINE_TARGET_AESNI __attribute__((target("aes,ssse3")))
+#define AES_ENGINE_TARGET_VAES __attribute__((target("aes,ssse3,vaes,avx2")))
+#endif
+#endif
+
+static inline uint64_t getBe64(const byte_t* data)
+{
+	uint64_t value = 0;
+	for (size_t i = 0; i < sizeof(uint64_t); i++)
+		value = (value << 8) | data[i];
+	return value;
+}
+
+static inline void setBe64(byte_t* data, uint64_t value)
+{
+	for (size_t i = 0; i < sizeof(uint64_t); i++)
+		data[i] = (byte_t)(value >> (56 - (i * 8)));
+}
+
+static inline void incrementCounter(uint64_t& ctr_hi, uint64_t& ctr_lo)
+{
+	ctr_lo++;
+	if (ctr_lo == 0)
+		ctr_hi++;
+}
+
+#ifdef AES_ENGINE_X86
+static void getCpuId(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+#ifdef _MSC_VER
+	__cpuidex((int*)regs, (int)leaf, (int)subleaf);
+#else
+	regs[0] = regs[1] = regs[2] = regs[3] = 0;
+	if (leaf <= __get_cpuid_max(0, nullptr))
+		__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t getXcr0()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t eax, edx;
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+static AesEngine::Implementation detectImplementation()
+{
+	uint32_t leaf1[4], leaf7[4];
+	getCpuId(1, 0, leaf1);
+	getCpuId(7, 0, leaf7);
+
+	bool has_aesni = (leaf1[2] & (1 << 25)) != 0;
+	bool has_osxsave = (leaf1[2] & (1 << 27)) != 0;
+	bool has_avx = (leaf1[2] & (1 << 28)) != 0;
+	bool has_avx2 = (leaf7[1] & (1 << 5)) != 0;
+	bool has_vaes = (leaf7[2] & (1 << 9)) != 0;
+
+	// the OS must also save the YMM registers for AVX instructions to be usable
+	bool has_ymm_state = has_osxsave && has_avx && (getXcr0() & 0x6) == 0x6;
+
+	if (has_aesni && has_vaes && has_avx2 && has_ymm_state)
+		return AesEngine::IMPL_VAES;
+	if (has_aesni)
+		return AesEngine::IMPL_AESNI;
+	return AesEngine::IMPL_PORTABLE;
+}
+
+AES_ENGINE_TARGET_AESNI
+static __m128i expandAes128KeyStep(__m128i key, __m128i keygened)
+{
+	keygened = _mm_shuffle_epi32(keygened, _MM_SHUFFLE(3, 3, 3, 3));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, keygened);
+}
+
+AES_ENGINE_TARGET_AESNI
+static void expandAes128Key(const byte_t key[fnd::aes::kAes128KeySize], byte_t round_key[11][fnd::aes::kAesBlockSize])
+{
+	__m128i rk[11];
+	rk[0] = _mm_loadu_si128((const __m128i*)key);
+	// aeskeygenassist requires the round constant to be an immediate
+	rk[1] = expandAes128KeyStep(rk[0], _mm_aeskeygenassist_si128(rk[0], 0x01));
+	rk[2] = expandAes128KeyStep(rk[1], _mm_aeskeygenassist_si128(rk[1], 0x02));
+	rk[3] = expandAes128KeyStep(rk[2], _mm_aeskeygenassist_si128(rk[2], 0x04));
+	rk[4] = expandAes128KeyStep(rk[3], _mm_aeskeygenassist_si128(rk[3], 0x08));
+	rk[5] = expandAes128KeyStep(rk[4], _mm_aeskeygenassist_si128(rk[4], 0x10));
+	rk[6] = expandAes128KeyStep(rk[5], _mm_aeskeygenassist_si128(rk[5], 0x20));
+	rk[7] = expandAes128KeyStep(rk[6], _mm_aeskeygenassist_si128(rk[6], 0x40));
+	rk[8] = expandAes128KeyStep(rk[7], _mm_aeskeygenassist_si128(rk[7], 0x80));
+	rk[9] = expandAes128KeyStep(rk[8], _mm_aeskeygenassist_si128(rk[8], 0x1b));
+	rk[10] = expandAes128KeyStep(rk[9], _mm_aeskeygenassist_si128(rk[9], 0x36));
+
+	for (size_t i = 0; i < 11; i++)
+		_mm_store_si128((__m128i*)round_key[i], rk[i]);
+}
+
+AES_ENGINE_TARGET_AESNI
+static void invertAes128Key(const byte_t round_key[11][fnd::aes::kAesBlockSize], byte_t dec_round_key[11][fnd::aes::kAesBlockSize])
+{
+	// the equivalent inverse cipher used by aesdec takes the round keys in reverse order, with InvMixColumns applied to the middle rounds
+	_mm_store_si128((__m128i*)dec_round_key[0], _mm_load_si128((const __m128i*)round_key[10]));
+	for (size_t i = 1; i < 10; i++)
+		_mm_store_si128((__m128i*)dec_round_key[i], _mm_aesimc_si128(_mm_load_si128((const __m128i*)round_key[10 - i])));
+	_mm_store_si128((__m128i*)dec_round_key[10], _mm_load_si128((const __m128i*)round_key[0]));
+}
+
+AES_ENGINE_TARGET_AESNI
+static inline __m128i makeCounterBlock(uint64_t ctr_hi, uint64_t ctr_lo)
+{
+	// counter is big endian, so byte swap each half
+	const __m128i swap_mask = _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+	return _mm_shuffle_epi8(_mm_set_epi64x((int64_t)ctr_lo, (int64_t)ctr_hi), swap_mask);
+}
+
+AES_ENGINE_TARGET_AESNI
+static void ctrTransformAesni(const byte_t round_key[11][fnd::aes::kAesBlockSize], uint64_t ctr_hi, uint64_t ctr_lo, const byte_t* in, byte_t* out, size_t block_num)
+{
+	static const size_t kInterleave = 8;
+
+	__m128i rk[11];
+	for (size_t i = 0; i < 11; i++)
+		rk[i] = _mm_load_si128((const __m128i*)round_key[i]);
+
+	// 8 independent blocks are in flight at once to hide the latency of aesenc (unrolled by hand, as compilers keep an indexed array in memory)
+	for (; block_num >= kInterleave; block_num -= kInterleave, in += kInterleave * 16, out += kInterleave * 16)
+	{
+		__m128i b0 = _mm_xor_si128(makeCounterBlock(ctr_hi, ctr_lo), rk[0]); incrementCounter(ctr_hi, ctr_lo);
+		__m128i b1 = _mm_xor_si128(makeCounterBlock(ctr_hi, ctr_lo), rk[0]); incrementCounter(ctr_hi, ctr_lo);
+		__m128i b2 = _mm_xor_si128(makeCounterBlock(ctr_hi, ctr_lo), rk[0]); incrementCounter(ctr_hi, ctr_lo);
+		__m128i b3 = _mm_xor_si128(makeCounterBlock(ctr_hi, ctr_lo), rk[0]); incrementCounter(ctr_hi, ctr_lo);
+		__m128i b4 = _mm_xor_si128(makeCounterBlock(ctr_hi, ctr_lo), rk[0]); incrementCounter(ctr_hi, ctr_lo);
+		__m128i b5 = _mm_xor_si128(makeCounterBlock(ctr_hi, ctr_lo), rk[0]); incrementCounter(ctr_hi, ctr_lo);
+		__m128i b6 = _mm_xor_si128(makeCounterBlock(ctr_hi, ctr_lo), rk[0]); incrementCounter(ctr_hi, ctr_lo);
+		__m128i b7 = _mm_xor_si128(makeCounterBlock(ctr_hi, ctr_lo), rk[0]); incrementCounter(ctr_hi, ctr_lo);
+
+		for (size_t round = 1; round < 10; round++)
+		{
+			b0 = _mm_aesenc_si128(b0, rk[round]);
+			b1 = _mm_aesenc_si128(b1, rk[round]);
+			b2 = _mm_aesenc_si128(b2, rk[round]);
+			b3 = _mm_aesenc_si128(b3, rk[round]);
+			b4 = _mm_aesenc_si128(b4, rk[round]);
+			b5 = _mm_aesenc_si128(b5, rk[round]);
+			b6 = _mm_aesenc_si128(b6, rk[round]);
+			b7 = _mm_aesenc_si128(b7, rk[round]);
+		}
+
+		_mm_storeu_si128((__m128i*)(out + 0x00), _mm_xor_si128(_mm_aesenclast_si128(b0, rk[10]), _mm_loadu_si128((const __m128i*)(in + 0x00))));
+		_mm_storeu_si128((__m128i*)(out + 0x10), _mm_xor_si128(_mm_aesenclast_si128(b1, rk[10]), _mm_loadu_si128((const __m128i*)(in + 0x10))));
+		_mm_storeu_si128((__m128i*)(out + 0x20), _mm_xor_si128(_mm_aesenclast_si128(b2, rk[10]), _mm_loadu_si128((const __m128i*)(in + 0x20))));
+		_mm_storeu_si128((__m128i*)(out + 0x30), _mm_xor_si128(_mm_aesenclast_si128(b3, rk[10]), _mm_loadu_si128((const __m128i*)(in + 0x30))));
+		_mm_storeu_si128((__m128i*)(out + 0x40), _mm_xor_si128(_mm_aesenclast_si128(b4, rk[10]), _mm_loadu_si128((const __m128i*)(in + 0x40))));
+		_mm_storeu_si128((__m128i*)(out + 0x50), _mm_xor_si128(_mm_aesenclast_si128(b5, rk[10]), _mm_loadu_si128((const __m128i*)(in + 0x50))));
+		_mm_storeu_si128((__m128i*)(out + 0x60), _mm_xor_si128(_mm_aesenclast_si128(b6, rk[10]), _mm_loadu_si128((const __m128i*)(in + 0x60))));
+		_mm_storeu_si128((__m128i*)(out + 0x70), _mm_xor_si128(_mm_aesenclast_si128(b7, rk[10]), _mm_loadu_si128((const __m128i*)(in + 0x70))));
+	}
+
+	for (; block_num > 0; block_num--, in += 16, out += 16)
+	{
+		__m128i block = _mm_xor_si128(makeCounterBlock(ctr_hi, ctr_lo), rk[0]);
+		incrementCounter(ctr_hi, ctr_lo);
+		for (size_t round = 1; round < 10; round++)
+			block = _mm_aesenc_si128(block, rk[round]);
+		block = _mm_aesenclast_si128(block, rk[10]);
+		_mm_storeu_si128((__m128i*)out, _mm_xor_si128(block, _mm_loadu_si128((const __m128i*)in)));
+	}
+}
+
+AES_ENGINE_TARGET_VAES
+static inline __m256i makeCounterBlockPair(uint64_t& ctr_hi, uint64_t& ctr_lo)
+{
+	__m128i lo_block = makeCounterBlock(ctr_hi, ctr_lo);
+	incrementCounter(ctr_hi, ctr_lo);
+	__m128i hi_block = makeCounterBlock(ctr_hi, ctr_lo);
+	incrementCounter(ctr_hi, ctr_lo);
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(lo_block), hi_block, 1);
+}
+
+AES_ENGINE_TARGET_VAES
+static void ctrTransformVaes(const byte_t round_key[11][fnd::aes::kAesBlockSize], uint64_t ctr_hi, uint64_t ctr_lo, const byte_t* in, byte_t* out, size_t block_num)
+{
+	// 8 registers of 2 blocks each
+	static const size_t kBlocksPerIteration = 16;
+
+	__m256i rk[11];
+	for (size_t i = 0; i < 11; i++)
+		rk[i] = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)round_key[i]));
+
+	for (; block_num >= kBlocksPerIteration; block_num -= kBlocksPerIteration, in += kBlocksPerIteration * 16, out += kBlocksPerIteration * 16)
+	{
+		__m256i b0 = _mm256_xor_si256(makeCounterBlockPair(ctr_hi, ctr_lo), rk[0]);
+		__m256i b1 = _mm256_xor_si256(makeCounterBlockPair(ctr_hi, ctr_lo), rk[0]);
+		__m256i b2 = _mm256_xor_si256(makeCounterBlockPair(ctr_hi, ctr_lo), rk[0]);
+		__m256i b3 = _mm256_xor_si256(makeCounterBlockPair(ctr_hi, ctr_lo), rk[0]);
+		__m256i b4 = _mm256_xor_si256(makeCounterBlockPair(ctr_hi, ctr_lo), rk[0]);
+		__m256i b5 = _mm256_xor_si256(makeCounterBlockPair(ctr_hi, ctr_lo), rk[0]);
+		__m256i b6 = _mm256_xor_si256(makeCounterBlockPair(ctr_hi, ctr_lo), rk[0]);
+		__m256i b7 = _mm256_xor_si256(makeCounterBlockPair(ctr_hi, ctr_lo), rk[0]);
+
+		for (size_t round = 1; round < 10; round++)
+		{
+			b0 = _mm256_aesenc_epi128(b0, rk[round]);
+			b1 = _mm256_aesenc_epi128(b1, rk[round]);
+			b2 = _mm256_aesenc_epi128(b2, rk[round]);
+			b3 = _mm256_aesenc_epi128(b3, rk[round]);
+			b4 = _mm256_aesenc_epi128(b4, rk[round]);
+			b5 = _mm256_aesenc_epi128(b5, rk[round]);
+			b6 = _mm256_aesenc_epi128(b6, rk[round]);
+			b7 = _mm256_aesenc_epi128(b7, rk[round]);
+		}
+
+		_mm256_storeu_si256((__m256i*)(out + 0x00), _mm256_xor_si256(_mm256_aesenclast_epi128(b0, rk[10]), _mm256_loadu_si256((const __m256i*)(in + 0x00))));
+		_mm256_storeu_si256((__m256i*)(out + 0x20), _mm256_xor_si256(_mm256_aesenclast_epi128(b1, rk[10]), _mm256_loadu_si256((const __m256i*)(in + 0x20))));
+		_mm256_storeu_si256((__m256i*)(out + 0x40), _mm256_xor_si256(_mm256_aesenclast_epi128(b2, rk[10]), _mm256_loadu_si256((const __m256i*)(in + 0x40))));
+		_mm256_storeu_si256((__m256i*)(out + 0x60), _mm256_xor_si256(_mm256_aesenclast_epi128(b3, rk[10]), _mm256_loadu_si256((const __m256i*)(in + 0x60))));
+		_mm256_storeu_si256((__m256i*)(out + 0x80), _mm256_xor_si256(_mm256_aesenclast_epi128(b4, rk[10]), _mm256_loadu_si256((const __m256i*)(in + 0x80))));
+		_mm256_storeu_si256((__m256i*)(out + 0xa0), _mm256_xor_si256(_mm256_aesenclast_epi128(b5, rk[10]), _mm256_loadu_si256((const __m256i*)(in + 0xa0))));
+		_mm256_storeu_si256((__m256i*)(out + 0xc0), _mm256_xor_si256(_mm256_aesenclast_epi128(b6, rk[10]), _mm256_loadu_si256((const __m256i*)(in + 0xc0))));
+		_mm256_storeu_si256((__m256i*)(out + 0xe0), _mm256_xor_si256(_mm256_aesenclast_epi128(b7, rk[10]), _mm256_loadu_si256((const __m256i*)(in + 0xe0))));
+	}
+
+	// finish the remainder with the 128bit implementation
+	ctrTransformAesni(round_key, ctr_hi, ctr_lo, in, out, block_num);
+}
+
+AES_ENGINE_TARGET_AESNI
+static inline __m128i multiplyXtsTweak(__m128i tweak)
+{
+	// multiply by x in GF(2^128): shift each 32bit lane left, carrying into the next lane, with the carry out of the top lane reduced by 0x87
+	const __m128i carry_mask = _mm_set_epi32(1, 1, 1, 0x87);
+	__m128i carry = _mm_and_si128(_mm_shuffle_epi32(_mm_srai_epi32(tweak, 31), _MM_SHUFFLE(2, 1, 0, 3)), carry_mask);
+	return _mm_xor_si128(_mm_slli_epi32(tweak, 1), carry);
+}
+
+AES_ENGINE_TARGET_AESNI
+static void xtsDecryptAesni(const byte_t dec_round_key[11][fnd::aes::kAesBlockSize], const byte_t tweak_round_key[11][fnd::aes::kAesBlockSize], uint64_t sector_index, size_t sector_block_num, const byte_t* in, byte_t* out, size_t sector_num)
+{
+	static const size_t kInterleave = 8;
+
+	__m128i rk[11], tk[11];
+	for (size_t i = 0; i < 11; i++)
+	{
+		rk[i] = _mm_load_si128((const __m128i*)dec_round_key[i]);
+		tk[i] = _mm_load_si128((const __m128i*)tweak_round_key[i]);
+	}
+
+	for (; sector_num > 0; sector_num--, sector_index++)
+	{
+		// the initial tweak is the encrypted sector index
+		__m128i tweak = _mm_xor_si128(makeCounterBlock(0, sector_index), tk[0]);
+		for (size_t round = 1; round < 10; round++)
+			tweak = _mm_aesenc_si128(tweak, tk[round]);
+		tweak = _mm_aesenclast_si128(tweak, tk[10]);
+
+		size_t block_num = sector_block_num;
+
+		// 8 independent blocks are in flight at once to hide the latency of aesdec
+		for (; block_num >= kInterleave; block_num -= kInterleave, in += kInterleave * 16, out += kInterleave * 16)
+		{
+			__m128i t0 = tweak;
+			__m128i t1 = multiplyXtsTweak(t0);
+			__m128i t2 = multiplyXtsTweak(t1);
+			__m128i t3 = multiplyXtsTweak(t2);
+			__m128i t4 = multiplyXtsTweak(t3);
+			__m128i t5 = multiplyXtsTweak(t4);
+			__m128i t6 = multiplyXtsTweak(t5);
+			__m128i t7 = multiplyXtsTweak(t6);
+			tweak = multiplyXtsTweak(t7);
+
+			__m128i b0 = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i*)(in + 0x00)), t0), rk[0]);
+			__m128i b1 = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i*)(in + 0x10)), t1), rk[0]);
+			__m128i b2 = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i*)(in + 0x20)), t2), rk[0]);
+			__m128i b3 = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i*)(in + 0x30)), t3), rk[0]);
+			__m128i b4 = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i*)(in + 0x40)), t4), rk[0]);
+			__m128i b5 = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i*)(in + 0x50)), t5), rk[0]);
+			__m128i b6 = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i*)(in + 0x60)), t6), rk[0]);
+			__m128i b7 = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i*)(in + 0x70)), t7), rk[0]);
+
+			for (size_t round = 1; round < 10; round++)
+			{
+				b0 = _mm_aesdec_si128(b0, rk[round]);
+				b1 = _mm_aesdec_si128(b1, rk[round]);
+				b2 = _mm_aesdec_si128(b2, rk[round]);
+				b3 = _mm_aesdec_si128(b3, rk[round]);
+				b4 = _mm_aesdec_si128(b4, rk[round]);
+				b5 = _mm_aesdec_si128(b5, rk[round]);
+				b6 = _mm_aesdec_si128(b6, rk[round]);
+				b7 = _mm_aesdec_si128(b7, rk[round]);
+			}
+
+			_mm_storeu_si128((__m128i*)(out + 0x00), _mm_xor_si128(_mm_aesdeclast_si128(b0, rk[10]), t0));
+			_mm_storeu_si128((__m128i*)(out + 0x10), _mm_xor_si128(_mm_aesdeclast_si128(b1, rk[10]), t1));
+			_mm_storeu_si128((__m128i*)(out + 0x20), _mm_xor_si128(_mm_aesdeclast_si128(b2, rk[10]), t2));
+			_mm_storeu_si128((__m128i*)(out + 0x30), _mm_xor_si128(_mm_aesdeclast_si128(b3, rk[10]), t3));
+			_mm_storeu_si128((__m128i*)(out + 0x40), _mm_xor_si128(_mm_aesdeclast_si128(b4, rk[10]), t4));
+			_mm_storeu_si128((__m128i*)(out + 0x50), _mm_xor_si128(_mm_aesdeclast_si128(b5, rk[10]), t5));
+			_mm_storeu_si128((__m128i*)(out + 0x60), _mm_xor_si128(_mm_aesdeclast_si128(b6, rk[10]), t6));
+			_mm_storeu_si128((__m128i*)(out + 0x70), _mm_xor_si128(_mm_aesdeclast_si128(b7, rk[10]), t7));
+		}
+
+		for (; block_num > 0; block_num--, in += 16, out += 16)
+		{
+			__m128i block = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i*)in), tweak), rk[0]);
+			for (size_t round = 1; round < 10; round++)
+				block = _mm_aesdec_si128(block, rk[round]);
+			_mm_storeu_si128((__m128i*)out, _mm_xor_si128(_mm_aesdeclast_si128(block, rk[10]), tweak));
+			tweak = multiplyXtsTweak(tweak);
+		}
+	}
+}
+#endif
+
+AesEngine::AesEngine(const fnd::aes::sAes128Key& key) :
+	mKey(key),
+	mImpl(getImplementation())
+{
+	memset(mRoundKey, 0, sizeof(mRoundKey));
+	memset(mDecRoundKey, 0, sizeof(mDecRoundKey));
+#ifdef AES_ENGINE_X86
+	if (mImpl != IMPL_PORTABLE)
+	{
+		expandAes128Key(mKey.key, mRoundKey);
+		invertAes128Key(mRoundKey, mDecRoundKey);
+	}
+#endif
+}
+
+void AesEngine::ctrTransform(const fnd::aes::sAesIvCtr& ctr, uint64_t offset, const byte_t* in, byte_t* out, size_t len) const
+{
+	static const size_t kBlockSize = fnd::aes::kAesBlockSize;
+
+	// determine the counter for the block containing offset
+	uint64_t ctr_hi = getBe64(ctr.iv);
+	uint64_t ctr_lo = getBe64(ctr.iv + sizeof(uint64_t));
+	uint64_t block_index = offset / kBlockSize;
+	ctr_lo += block_index;
+	if (ctr_lo < block_index)
+		ctr_hi++;
+
+	// leading partial block
+	size_t block_offset = offset % kBlockSize;
+	if (block_offset != 0 && len > 0)
+	{
+		byte_t keystream[kBlockSize] = {0};
+		ctrTransformBlocks(ctr_hi, ctr_lo, keystream, keystream, 1);
+		size_t partial_len = _MIN(len, kBlockSize - block_offset);
+		for (size_t i = 0; i < partial_len; i++)
+			out[i] = in[i] ^ keystream[block_offset + i];
+
+		incrementCounter(ctr_hi, ctr_lo);
+		in += partial_len;
+		out += partial_len;
+		len -= partial_len;
+	}
+
+	// whole blocks
+	size_t block_num = len / kBlockSize;
+	if (block_num > 0)
+	{
+		ctrTransformBlocks(ctr_hi, ctr_lo, in, out, block_num);
+
+		ctr_lo += block_num;
+		if (ctr_lo < block_num)
+			ctr_hi++;
+		in += block_num * kBlockSize;
+		out += block_num * kBlockSize;
+		len -= block_num * kBlockSize;
+	}
+
+	// trailing partial block
+	if (len > 0)
+	{
+		byte_t keystream[kBlockSize] = {0};
+		ctrTransformBlocks(ctr_hi, ctr_lo, keystream, keystream, 1);
+		for (size_t i = 0; i < len; i++)
+			out[i] = in[i] ^ keystream[i];
+	}
+}
+
+void AesEngine::xtsDecrypt(const AesEngine& tweak_engine, uint64_t sector_index, size_t sector_size, const byte_t* in, byte_t* out, size_t sector_num) const
+{
+#ifdef AES_ENGINE_X86
+	// the VAES implementation also uses AES-NI here, the tweaks within a sector depend on each other so wider registers gain little
+	if (mImpl != IMPL_PORTABLE)
+		xtsDecryptAesni(mDecRoundKey, tweak_engine.mRoundKey, sector_index, sector_size / fnd::aes::kAesBlockSize, in, out, sector_num);
+	else
+#endif
+		xtsDecryptPortable(tweak_engine, sector_index, sector_size, in, out, sector_num);
+}
+
+AesEngine::Implementation AesEngine::getImplementation()
+{
+#ifdef AES_ENGINE_X86
+	static const Implementation impl = detectImplementation();
+	return impl;
+#else
+	return IMPL_PORTABLE;
+#endif
+}
+
+const char* AesEngine::getImplementationName()
+{
+	switch (getImplementation())
+	{
+	case (IMPL_VAES):
+		return "VAES";
+	case (IMPL_AESNI):
+		return "AES-NI";
+	default:
+		return "Portable";
+	}
+}
+
+void AesEngine::ctrTransformBlocks(uint64_t ctr_hi, uint64_t ctr_lo, const byte_t* in, byte_t* out, size_t block_num) const
+{
+#ifdef AES_ENGINE_X86
+	if (mImpl == IMPL_VAES)
+		ctrTransformVaes(mRoundKey, ctr_hi, ctr_lo, in, out, block_num);
+	else if (mImpl == IMPL_AESNI)
+		ctrTransformAesni(mRoundKey, ctr_hi, ctr_lo, in, out, block_num);
+	else
+#endif
+		ctrTransformPortable(ctr_hi, ctr_lo, in, out, block_num);
+}
+
+void AesEngine::ctrTransformPortable(uint64_t ctr_hi, uint64_t ctr_lo, const byte_t* in, byte_t* out, size_t block_num) const
+{
+	static const size_t kBlockSize = fnd::aes::kAesBlockSize;
+
+	// counter blocks are encrypted in batches, rather than calling into fnd::aes once per block
+	byte_t keystream[kPortableBatchSize];
+	while (block_num > 0)
+	{
+		size_t batch_block_num = _MIN(block_num, kPortableBatchSize / kBlockSize);
+		for (size_t i = 0; i < batch_block_num; i++)
+		{
+			setBe64(keystream + i * kBlockSize, ctr_hi);
+			setBe64(keystream + i * kBlockSize + sizeof(uint64_t), ctr_lo);
+			incrementCounter(ctr_hi, ctr_lo);
+		}
+
+		fnd::aes::AesEcbEncrypt(keystream, batch_block_num * kBlockSize, mKey.key, keystream);
+
+		for (size_t i = 0; i < batch_block_num * kBlockSize; i++)
+			out[i] = in[i] ^ keystream[i];
+
+		in += batch_block_num * kBlockSize;
+		out += batch_block_num * kBlockSize;
+		block_num -= batch_block_num;
+	}
+}
+
+void AesEngine::xtsDecryptPortable(const AesEngine& tweak_engine, uint64_t sector_index, size_t sector_size, const byte_t* in, byte_t* out, size_t sector_num) const
+{
+	byte_t tweak[fnd::aes::kAesBlockSize];
+	for (size_t i = 0; i < sector_num; i++)
+	{
+		fnd::aes::AesXtsMakeTweak(tweak, sector_index + i);
+		fnd::aes::AesXtsDecryptSector(in + i * sector_size, sector_size, mKey.key, tweak_engine.mKey.key, tweak, out + i * sector_size);
+	}
+}
\ No newline at end of file
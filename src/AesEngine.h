@@ -0,0 +1,40 @@
+#pragma once
+#include <string>
+#include <fnd/types.h>
+#include <fnd/aes.h>
+
+// AES-128 engine for bulk data, uses AES-NI/VAES when the CPU supports it (determined at runtime), otherwise fnd::aes
+class AesEngine
+{
+public:
+	enum Implementation
+	{
+		IMPL_PORTABLE,
+		IMPL_AESNI,
+		IMPL_VAES
+	};
+
+	AesEngine(const fnd::aes::sAes128Key& key);
+
+	// AES-CTR encrypt/decrypt (in may equal out), ctr is the counter at stream offset 0, offset is the stream offset of in
+	void ctrTransform(const fnd::aes::sAesIvCtr& ctr, uint64_t offset, const byte_t* in, byte_t* out, size_t len) const;
+
+	// AES-XTS decrypt whole sectors (in may equal out), this engine holds the data key and tweak_engine the tweak key,
+	// sector_index is the index of the first sector (stored big endian in the tweak, as Nintendo does), sector_size must be a multiple of the block size
+	void xtsDecrypt(const AesEngine& tweak_engine, uint64_t sector_index, size_t sector_size, const byte_t* in, byte_t* out, size_t sector_num) const;
+
+	static Implementation getImplementation();
+	static const char* getImplementationName();
+private:
+	static const size_t kRoundKeyNum = 11;
+	static const size_t kPortableBatchSize = 0x1000;
+
+	fnd::aes::sAes128Key mKey;
+	Implementation mImpl;
+	alignas(16) byte_t mRoundKey[kRoundKeyNum][fnd::aes::kAesBlockSize];
+	alignas(16) byte_t mDecRoundKey[kRoundKeyNum][fnd::aes::kAesBlockSize];
+
+	void ctrTransformBlocks(uint64_t ctr_hi, uint64_t ctr_lo, const byte_t* in, byte_t* out, size_t block_num) const;
+	void ctrTransformPortable(uint64_t ctr_hi, uint64_t ctr_lo, const byte_t* in, byte_t* out, size_t block_num) const;
+	void xtsDecryptPortable(const AesEngine& tweak_engine, uint64_t sector_index, size_t sector_size, const byte_t* in, byte_t* out, size_t sector_num) const;
+};
@@ -0,0 +1,110 @@
+#include "AesXtsIFile.h"
+#include "MemoryMappedFile.h"
+
+static fnd::aes::sAes128Key getXtsSubKey(const fnd::aes::sAesXts128Key& key, size_t index)
+{
+	fnd::aes::sAes128Key sub_key;
+	sub_key.set(key.key[index]);
+	return sub_key;
+}
+
+AesXtsIFile::AesXtsIFile(const fnd::SharedPtr<fnd::IFile>& file, const fnd::aes::sAesXts128Key& key, size_t sector_size) :
+	mFile(file),
+	mDataEngine(getXtsSubKey(key, 0)),
+	mTweakEngine(getXtsSubKey(key, 1)),
+	mSectorSize(sector_size),
+	mOffset(0)
+{
+	if (mSectorSize == 0 || (mSectorSize % fnd::aes::kAesBlockSize) != 0)
+	{
+		throw fnd::Exception(kModuleName, "Sector size must be a multiple of the AES block size");
+	}
+}
+
+size_t AesXtsIFile::size()
+{
+	return (*mFile)->size();
+}
+
+void AesXtsIFile::seek(size_t offset)
+{
+	mOffset = offset;
+}
+
+void AesXtsIFile::read(byte_t* out, size_t len)
+{
+	readAt(out, mOffset, len);
+	mOffset += len;
+}
+
+void AesXtsIFile::read(byte_t* out, size_t offset, size_t len)
+{
+	seek(offset);
+	read(out, len);
+}
+
+void AesXtsIFile::readAt(byte_t* out, size_t offset, size_t len)
+{
+	// partial sectors are decrypted in a buffer of this call's own
+	fnd::Vec<byte_t> sector_buffer;
+
+	// leading partial sector
+	size_t sector_offset = offset % mSectorSize;
+	if (sector_offset != 0 && len > 0)
+	{
+		size_t partial_len = _MIN(len, mSectorSize - sector_offset);
+		sector_buffer.alloc(mSectorSize);
+		readSectors(sector_buffer.data(), offset / mSectorSize, 1);
+		memcpy(out, sector_buffer.data() + sector_offset, partial_len);
+
+		out += partial_len;
+		len -= partial_len;
+		offset += partial_len;
+	}
+
+	// whole sectors are decrypted in one call
+	size_t sector_num = len / mSectorSize;
+	if (sector_num > 0)
+	{
+		readSectors(out, offset / mSectorSize, sector_num);
+
+		out += sector_num * mSectorSize;
+		len -= sector_num * mSectorSize;
+		offset += sector_num * mSectorSize;
+	}
+
+	// trailing partial sector
+	if (len > 0)
+	{
+		if (sector_buffer.size() == 0)
+			sector_buffer.alloc(mSectorSize);
+		readSectors(sector_buffer.data(), offset / mSectorSize, 1);
+		memcpy(out, sector_buffer.data(), len);
+	}
+}
+
+void AesXtsIFile::write(const byte_t* out, size_t len)
+{
+	throw fnd::Exception(kModuleName, "write() not supported");
+}
+
+void AesXtsIFile::write(const byte_t* out, size_t offset, size_t len)
+{
+	throw fnd::Exception(kModuleName, "write() not supported");
+}
+
+void AesXtsIFile::readSectors(byte_t* out, size_t sector_index, size_t sector_num)
+{
+	size_t offset = sector_index * mSectorSize;
+	size_t len = sector_num * mSectorSize;
+
+	// decrypt straight out of the mapping if possible, otherwise read the ciphertext into out and decrypt it in place
+	const byte_t* in = MemoryMappedFile::getMappedData(mFile, offset, len);
+	if (in == nullptr)
+	{
+		readFileAt(**mFile, out, offset, len);
+		in = out;
+	}
+
+	mDataEngine.xtsDecrypt(mTweakEngine, sector_index, mSectorSize, in, out, sector_num);
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <string>
+#include <fnd/IFile.h>
+#include <fnd/SharedPtr.h>
+#include <fnd/Vec.h>
+#include <fnd/aes.h>
+#include "AesEngine.h"
+#include "IReadAtFile.h"
+
+// AES-XTS decrypting reader, sectors are numbered from the start of file, reads need not be sector aligned
+class AesXtsIFile : public IReadAtFile
+{
+public:
+	static const size_t kDefaultSectorSize = 0x200;
+
+	AesXtsIFile(const fnd::SharedPtr<fnd::IFile>& file, const fnd::aes::sAesXts128Key& key, size_t sector_size = kDefaultSectorSize);
+
+	size_t size();
+	void seek(size_t offset);
+	void read(byte_t* out, size_t len);
+	void read(byte_t* out, size_t offset, size_t len);
+	void readAt(byte_t* out, size_t offset, size_t len);
+	void write(const byte_t* out, size_t len);
+	void write(const byte_t* out, size_t offset, size_t len);
+private:
+	const std::string kModuleName = "AesXtsIFile";
+
+	fnd::SharedPtr<fnd::IFile> mFile;
+	AesEngine mDataEngine;
+	AesEngine mTweakEngine;
+	size_t mSectorSize;
+	size_t mOffset;
+
+	void readSectors(byte_t* out, size_t sector_index, size_t sector_num);
+};
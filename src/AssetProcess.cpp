@@ -1,9 +1,9 @@
 #include <iostream>
 #include <iomanip>
 #include <fnd/SimpleFile.h>
-#include <fnd/OffsetAdjustedIFile.h>
 #include <fnd/Vec.h>
 #include "AssetProcess.h"
+#include "MemoryMappedFile.h"
 
 
 AssetProcess::AssetProcess() :
@@ -56,6 +56,11 @@ void AssetProcess::setRomfsExtractPath(const std::string& path)
 	mRomfs.setExtractPath(path);
 }
 
+void AssetProcess::setRomfsExtractFilter(const std::shared_ptr<const PathFilter>& filter)
+{
+	mRomfs.setExtractFilter(filter);
+}
+
 
 void AssetProcess::importHeader()
 {
@@ -109,7 +114,7 @@ void AssetProcess::processSections()
 			outfile.close();
 		}
 		
-		mNacp.setInputFile(new fnd::OffsetAdjustedIFile(mFile, mHdr.getNacpInfo().offset, mHdr.getNacpInfo().size));
+		mNacp.setInputFile(MemoryMappedFile::createOffsetAdjustedIFile(mFile, mHdr.getNacpInfo().offset, mHdr.getNacpInfo().size));
 		mNacp.setCliOutputMode(mCliOutputMode);
 		mNacp.setVerifyMode(mVerify);
 
@@ -121,7 +126,7 @@ void AssetProcess::processSections()
 		if ((mHdr.getRomfsInfo().size + mHdr.getRomfsInfo().offset) > (*mFile)->size()) 
 			throw fnd::Exception(kModuleName, "ASET geometry for romfs beyond file size");
 
-		mRomfs.setInputFile(new fnd::OffsetAdjustedIFile(mFile, mHdr.getRomfsInfo().offset, mHdr.getRomfsInfo().size));
+		mRomfs.setInputFile(MemoryMappedFile::createOffsetAdjustedIFile(mFile, mHdr.getRomfsInfo().offset, mHdr.getRomfsInfo().size));
 		mRomfs.setCliOutputMode(mCliOutputMode);
 		mRomfs.setVerifyMode(mVerify);
 
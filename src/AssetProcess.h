@@ -25,6 +25,7 @@ public:
 	void setIconExtractPath(const std::string& path);
 	void setNacpExtractPath(const std::string& path);
 	void setRomfsExtractPath(const std::string& path);
+	void setRomfsExtractFilter(const std::shared_ptr<const PathFilter>& filter);
 
 
 private:
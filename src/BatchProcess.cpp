@@ -0,0 +1,267 @@
+#include "BatchProcess.h"
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+#include <fnd/SimpleFile.h>
+#include <fnd/Vec.h>
+
+#include "DirectoryUtil.h"
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+BatchProcess::BatchProcess() :
+	mInputPath(),
+	mFileProcessor(),
+	mCliOutputMode(_BIT(OUTPUT_BASIC)),
+	mThreadNum(1),
+	mFileList()
+{
+}
+
+void BatchProcess::process()
+{
+	if (mFileProcessor == nullptr)
+	{
+		throw fnd::Exception(kModuleName, "No file processor set.");
+	}
+
+	importFileList();
+
+	std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+	size_t failed_num = mThreadNum > 1 ? processFileListParallel() : processFileListSerial();
+
+	if (_HAS_BIT(mCliOutputMode, OUTPUT_BASIC))
+		displaySummary(failed_num, std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count());
+}
+
+void BatchProcess::setCliOutputMode(CliOutputMode type)
+{
+	mCliOutputMode = type;
+}
+
+void BatchProcess::setInputPath(const std::string& path)
+{
+	mInputPath = path;
+}
+
+void BatchProcess::setFileProcessor(const FileProcessor& processor)
+{
+	mFileProcessor = processor;
+}
+
+void BatchProcess::setThreadNum(size_t thread_num)
+{
+	mThreadNum = thread_num;
+}
+
+bool BatchProcess::isBatchInput(const std::string& path)
+{
+	return (path.empty() == false && path[0] == '@') || DirectoryUtil::isDirectory(path);
+}
+
+void BatchProcess::importFileList()
+{
+	mFileList.clear();
+
+	if (mInputPath.empty() == false && mInputPath[0] == '@')
+	{
+		importFileListFromListFile(mInputPath.substr(1));
+	}
+	else
+	{
+		DirectoryUtil::getFileList(mInputPath, mFileList);
+
+		// directory entries are not returned in any particular order
+		std::sort(mFileList.begin(), mFileList.end());
+	}
+
+	if (mFileList.empty())
+	{
+		throw fnd::Exception(kModuleName, "No files to process.");
+	}
+}
+
+void BatchProcess::importFileListFromListFile(const std::string& list_path)
+{
+	fnd::SimpleFile list_file(list_path, fnd::SimpleFile::Read);
+	fnd::Vec<byte_t> list_data;
+
+	list_data.alloc(list_file.size());
+	list_file.read(list_data.data(), list_data.size());
+
+	// one path per line, blank lines and lines starting with '#' are skipped
+	std::string list_str((const char*)list_data.data(), list_data.size());
+	size_t line_start = 0;
+	while (line_start < list_str.length())
+	{
+		size_t line_end = list_str.find('\n', line_start);
+		if (line_end == std::string::npos)
+			line_end = list_str.length();
+
+		std::string line = list_str.substr(line_start, line_end - line_start);
+		if (line.empty() == false && line[line.length()-1] == '\r')
+			line.erase(line.length()-1);
+
+		if (line.empty() == false && line[0] != '#')
+			mFileList.push_back(line);
+
+		line_start = line_end + 1;
+	}
+}
+
+bool BatchProcess::processFile(const std::string& path)
+{
+	bool success = true;
+
+	if (_HAS_BIT(mCliOutputMode, OUTPUT_BASIC))
+		std::cout << "file=[" << path << "]" << std::endl;
+
+	try
+	{
+		mFileProcessor(path);
+	}
+	catch (const fnd::Exception& e)
+	{
+		std::cout << e.what() << std::endl;
+		success = false;
+	}
+
+	if (_HAS_BIT(mCliOutputMode, OUTPUT_BASIC))
+		std::cout << std::endl;
+
+	return success;
+}
+
+size_t BatchProcess::processFileListSerial()
+{
+	size_t failed_num = 0;
+	for (size_t i = 0; i < mFileList.size(); i++)
+	{
+		if (processFile(mFileList[i]) == false)
+			failed_num++;
+	}
+	return failed_num;
+}
+
+size_t BatchProcess::processFileListParallel()
+{
+#ifdef _WIN32
+	return processFileListSerial();
+#else
+	// the processors write to std::cout (whose formatting state is process wide) so each file is processed by a forked worker,
+	// the worker inherits the parsed settings & keys and writes to a temporary file that is printed once all files before it are printed
+	struct sWorker
+	{
+		pid_t pid;
+		FILE* output;
+		bool done;
+		bool success;
+		int signal;
+	};
+
+	std::vector<sWorker> worker(mFileList.size(), {-1, nullptr, false, false, 0});
+	size_t failed_num = 0;
+	size_t start_index = 0;
+	size_t print_index = 0;
+	size_t running_num = 0;
+
+	// output written before forking would otherwise be written again by each worker
+	std::cout.flush();
+	fflush(stdout);
+
+	while (print_index < worker.size())
+	{
+		// start workers, limiting how much output can be waiting to be printed
+		while (running_num < mThreadNum && start_index < worker.size() && start_index - print_index < kMaxPendingOutputNum)
+		{
+			sWorker& w = worker[start_index];
+
+			w.output = tmpfile();
+			if (w.output == nullptr)
+			{
+				throw fnd::Exception(kModuleName, "Failed to create temporary output file");
+			}
+
+			w.pid = fork();
+			if (w.pid < 0)
+			{
+				throw fnd::Exception(kModuleName, "Failed to start worker process");
+			}
+			else if (w.pid == 0)
+			{
+				dup2(fileno(w.output), STDOUT_FILENO);
+				bool success = processFile(mFileList[start_index]);
+				std::cout.flush();
+				fflush(stdout);
+				_exit(success ? 0 : 1);
+			}
+
+			start_index++;
+			running_num++;
+		}
+
+		// wait for any worker to finish
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			throw fnd::Exception(kModuleName, "Failed to wait for worker process");
+		}
+
+		for (size_t i = print_index; i < start_index; i++)
+		{
+			if (worker[i].pid == pid)
+			{
+				worker[i].done = true;
+				worker[i].success = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+				worker[i].signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+				running_num--;
+				break;
+			}
+		}
+
+		// print the output of finished workers in order
+		for (; print_index < start_index && worker[print_index].done; print_index++)
+		{
+			sWorker& w = worker[print_index];
+			byte_t buffer[0x1000];
+
+			rewind(w.output);
+			for (size_t read_size = fread(buffer, 1, sizeof(buffer), w.output); read_size > 0; read_size = fread(buffer, 1, sizeof(buffer), w.output))
+				fwrite(buffer, 1, read_size, stdout);
+			fclose(w.output);
+			w.output = nullptr;
+
+			if (w.signal != 0)
+				std::cout << "[WARNING] Worker processing " << mFileList[print_index] << " terminated by signal " << std::dec << w.signal << std::endl << std::endl;
+			std::cout.flush();
+			fflush(stdout);
+
+			if (w.success == false)
+				failed_num++;
+		}
+	}
+
+	return failed_num;
+#endif
+}
+
+void BatchProcess::displaySummary(size_t failed_num, double elapsed_sec)
+{
+	std::cout << "processed " << std::dec << mFileList.size() << " file(s) in " << std::fixed << std::setprecision(2) << elapsed_sec << " sec";
+	if (failed_num > 0)
+		std::cout << " (" << failed_num << " failed)";
+	std::cout << std::defaultfloat << std::endl;
+}
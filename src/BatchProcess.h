@@ -0,0 +1,46 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include <fnd/types.h>
+
+#include "common.h"
+
+class BatchProcess
+{
+public:
+	// processes one file of the batch, writing its output to std::cout
+	typedef std::function<void(const std::string& path)> FileProcessor;
+
+	BatchProcess();
+
+	void process();
+
+	// generic
+	void setCliOutputMode(CliOutputMode type);
+
+	// batch specific
+	void setInputPath(const std::string& path);
+	void setFileProcessor(const FileProcessor& processor);
+	void setThreadNum(size_t thread_num);
+
+	// returns true if path is a directory, or a list file (prefixed with '@')
+	static bool isBatchInput(const std::string& path);
+private:
+	const std::string kModuleName = "BatchProcess";
+	static const size_t kMaxPendingOutputNum = 0x100;
+
+	std::string mInputPath;
+	FileProcessor mFileProcessor;
+	CliOutputMode mCliOutputMode;
+	size_t mThreadNum;
+
+	std::vector<std::string> mFileList;
+
+	void importFileList();
+	void importFileListFromListFile(const std::string& list_path);
+	bool processFile(const std::string& path);
+	size_t processFileListSerial();
+	size_t processFileListParallel();
+	void displaySummary(size_t failed_num, double elapsed_sec);
+};
@@ -0,0 +1,94 @@
+#include "BlockCache.h"
+#include <cstring>
+#include <algorithm>
+
+bool BlockCache::sKey::operator==(const sKey& other) const
+{
+	return block_index == other.block_index && layer_id == other.layer_id;
+}
+
+size_t BlockCache::sKeyHash::operator()(const sKey& key) const
+{
+	// the layer id is a hash already, so some of it is mixed with the block index
+	uint64_t layer_hash;
+	memcpy(&layer_hash, key.layer_id.bytes, sizeof(uint64_t));
+	return (size_t)(layer_hash ^ (key.block_index * 0x9e3779b97f4a7c15ULL));
+}
+
+BlockCache::BlockCache(size_t capacity) :
+	mLock(),
+	mCapacity(capacity),
+	mSize(0),
+	mEntryList(),
+	mEntryMap()
+{
+}
+
+size_t BlockCache::copy(const fnd::sha::sSha256Hash& layer_id, size_t block_size, uint64_t offset, byte_t* out, size_t len)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+
+	size_t copied = 0;
+	while (copied < len)
+	{
+		auto itr = mEntryMap.find({layer_id, (offset + copied) / block_size});
+		if (itr == mEntryMap.end())
+			break;
+
+		const std::vector<byte_t>& data = itr->second->data;
+		size_t block_pos = (size_t)((offset + copied) % block_size);
+		size_t copy_len = std::min<size_t>(len - copied, block_size - block_pos);
+		if (block_pos + copy_len > data.size())
+		{
+			throw fnd::Exception(kModuleName, "Read exceeds the size of the cached block");
+		}
+
+		mEntryList.splice(mEntryList.begin(), mEntryList, itr->second);
+		memcpy(out + copied, data.data() + block_pos, copy_len);
+		copied += copy_len;
+	}
+
+	return copied;
+}
+
+size_t BlockCache::getUncachedBlockNum(const fnd::sha::sSha256Hash& layer_id, uint64_t first_block_index, size_t block_num)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+
+	size_t uncached_num = 0;
+	while (uncached_num < block_num && mEntryMap.find({layer_id, first_block_index + uncached_num}) == mEntryMap.end())
+		uncached_num++;
+
+	return uncached_num;
+}
+
+void BlockCache::add(const fnd::sha::sSha256Hash& layer_id, uint64_t first_block_index, const byte_t* data, size_t block_size, size_t block_num)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+
+	if (block_size > mCapacity)
+		return;
+
+	for (size_t i = 0; i < block_num; i++)
+	{
+		sKey key = {layer_id, first_block_index + i};
+		if (mEntryMap.find(key) != mEntryMap.end())
+			continue;
+
+		// the buffer of an evicted block is reused for the new one
+		std::vector<byte_t> buffer;
+		while (mSize + block_size > mCapacity)
+		{
+			sEntry& lru = mEntryList.back();
+			mSize -= lru.data.size();
+			buffer.swap(lru.data);
+			mEntryMap.erase(lru.key);
+			mEntryList.pop_back();
+		}
+		buffer.assign(data + i * block_size, data + (i + 1) * block_size);
+
+		mEntryList.push_front({key, std::move(buffer)});
+		mEntryMap[key] = mEntryList.begin();
+		mSize += block_size;
+	}
+}
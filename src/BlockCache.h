@@ -0,0 +1,58 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <fnd/types.h>
+#include <fnd/sha.h>
+
+// size bounded LRU cache of blocks that have already been decrypted and verified, shared by the readers of the PartitionFs partitions of a run (and safe to use from any thread),
+// so reading the same partition again (e.g. the ExeFS for the signature check, then to list it, then to extract it) costs a copy instead of AES and SHA-256
+class BlockCache
+{
+public:
+	BlockCache(size_t capacity);
+
+	// blocks are identified by the layer they belong to and their index in it, each call takes the lock once for all the blocks it covers
+
+	// copies up to len bytes from offset in a layer of block_size byte blocks to out, stopping at the first block that is not cached,
+	// returns the number of bytes copied
+	size_t copy(const fnd::sha::sSha256Hash& layer_id, size_t block_size, uint64_t offset, byte_t* out, size_t len);
+
+	// returns how many of the block_num blocks from first_block_index are not cached, before the first that is
+	size_t getUncachedBlockNum(const fnd::sha::sSha256Hash& layer_id, uint64_t first_block_index, size_t block_num);
+
+	// adds block_num blocks of block_size bytes from data as the blocks from first_block_index, evicting the least recently used blocks to make room
+	// (blocks already cached are not replaced, and blocks larger than the cache are not added)
+	void add(const fnd::sha::sSha256Hash& layer_id, uint64_t first_block_index, const byte_t* data, size_t block_size, size_t block_num);
+private:
+	const std::string kModuleName = "BlockCache";
+
+	struct sKey
+	{
+		fnd::sha::sSha256Hash layer_id;
+		uint64_t block_index;
+
+		bool operator==(const sKey& other) const;
+	};
+
+	struct sKeyHash
+	{
+		size_t operator()(const sKey& key) const;
+	};
+
+	struct sEntry
+	{
+		sKey key;
+		std::vector<byte_t> data;
+	};
+
+	std::mutex mLock;
+	size_t mCapacity;
+	size_t mSize;
+
+	// most recently used at the front
+	std::list<sEntry> mEntryList;
+	std::unordered_map<sKey, std::list<sEntry>::iterator, sKeyHash> mEntryMap;
+};
@@ -0,0 +1,162 @@
+#include "BucketTree.h"
+#include "IReadAtFile.h"
+#include <sstream>
+#include <algorithm>
+#include <iterator>
+
+BucketTree::BucketTree(const fnd::SharedPtr<fnd::IFile>& file, const sHeader& header, size_t entry_size, size_t cache_node_num) :
+	mFile(file),
+	mEntrySize(entry_size),
+	mEntryNum(header.entry_num.get()),
+	mEntryPerSetNum((kNodeSize - sizeof(sNodeHeader)) / entry_size),
+	mEntrySetNum(0),
+	mEndOffset(0),
+	mCacheNodeNumMax(_MAX(cache_node_num, (size_t)1))
+{
+	if (header.st_magic.get() != kStructMagic)
+	{
+		throw fnd::Exception(kModuleName, "Bucket tree header is corrupt (Bad magic)");
+	}
+
+	if (header.version.get() != kSupportedVersion)
+	{
+		std::stringstream error;
+		error << "Bucket tree version (" << std::dec << header.version.get() << ") is not supported";
+		throw fnd::Exception(kModuleName, error.str());
+	}
+
+	if (mEntryNum > 0)
+	{
+		mEntrySetNum = (mEntryNum + mEntryPerSetNum - 1) / mEntryPerSetNum;
+		importIndexNode();
+	}
+}
+
+size_t BucketTree::getEntryNum() const
+{
+	return mEntryNum;
+}
+
+uint64_t BucketTree::getEndOffset() const
+{
+	return mEndOffset;
+}
+
+void BucketTree::find(uint64_t offset, byte_t* entry, uint64_t& entry_begin, uint64_t& entry_end)
+{
+	if (mEntryNum == 0 || offset < mEntrySetOffset[0] || offset >= mEndOffset)
+	{
+		std::stringstream error;
+		error << "Offset 0x" << std::hex << offset << " is not covered by the bucket tree";
+		throw fnd::Exception(kModuleName, error.str());
+	}
+
+	// the entry set is the last one starting at or before offset
+	size_t entry_set_index = std::upper_bound(mEntrySetOffset.data(), mEntrySetOffset.data() + mEntrySetNum, offset) - mEntrySetOffset.data() - 1;
+	std::lock_guard<std::mutex> lock(mCacheLock);
+	const fnd::Vec<byte_t>& node = getEntrySetNode(entry_set_index);
+	const sNodeHeader* node_header = (const sNodeHeader*)node.data();
+	const byte_t* entries = node.data() + sizeof(sNodeHeader);
+	size_t entry_num = node_header->count.get();
+
+	// likewise for the entry in the set
+	size_t low = 0, high = entry_num;
+	while (high - low > 1)
+	{
+		size_t mid = low + (high - low) / 2;
+		if (getEntryOffset(entries + mid * mEntrySize) <= offset)
+			low = mid;
+		else
+			high = mid;
+	}
+
+	memcpy(entry, entries + low * mEntrySize, mEntrySize);
+	entry_begin = getEntryOffset(entries + low * mEntrySize);
+	entry_end = (low + 1 < entry_num) ? getEntryOffset(entries + (low + 1) * mEntrySize) : node_header->offset.get();
+}
+
+void BucketTree::importIndexNode()
+{
+	// only a single index node is supported, which indexes up to 2046 entry sets
+	size_t offset_per_node_num = (kNodeSize - sizeof(sNodeHeader)) / sizeof(uint64_t);
+	if (mEntrySetNum > offset_per_node_num)
+	{
+		throw fnd::Exception(kModuleName, "Bucket trees with more than one level of index nodes are not supported");
+	}
+
+	fnd::Vec<byte_t> node;
+	node.alloc(kNodeSize);
+	IReadAtFile::readFileAt(**mFile, node.data(), 0, kNodeSize);
+
+	const sNodeHeader* node_header = (const sNodeHeader*)node.data();
+	if (node_header->count.get() != mEntrySetNum)
+	{
+		throw fnd::Exception(kModuleName, "Bucket tree index node is corrupt (entry set count mismatch)");
+	}
+	mEndOffset = node_header->offset.get();
+
+	const le_uint64_t* entry_set_offset = (const le_uint64_t*)(node.data() + sizeof(sNodeHeader));
+	mEntrySetOffset.alloc(mEntrySetNum);
+	for (size_t i = 0; i < mEntrySetNum; i++)
+	{
+		mEntrySetOffset[i] = entry_set_offset[i].get();
+		if (i > 0 && mEntrySetOffset[i] < mEntrySetOffset[i-1])
+		{
+			throw fnd::Exception(kModuleName, "Bucket tree index node is corrupt (entry set offsets are not sorted)");
+		}
+	}
+}
+
+const fnd::Vec<byte_t>& BucketTree::getEntrySetNode(size_t entry_set_index)
+{
+	auto cache_itr = mCacheMap.find(entry_set_index);
+	if (cache_itr != mCacheMap.end())
+	{
+		mCacheList.splice(mCacheList.begin(), mCacheList, cache_itr->second);
+		return mCacheList.front().node;
+	}
+
+	// reuse the least recently used node once the cache is full
+	if (mCacheList.size() >= mCacheNodeNumMax)
+	{
+		mCacheMap.erase(mCacheList.back().entry_set_index);
+		mCacheList.splice(mCacheList.begin(), mCacheList, std::prev(mCacheList.end()));
+	}
+	else
+	{
+		mCacheList.push_front(CacheEntry());
+		mCacheList.front().node.alloc(kNodeSize);
+	}
+
+	CacheEntry& cache = mCacheList.front();
+	cache.entry_set_index = entry_set_index;
+
+	// the entry sets follow the index node, the node is only added to the cache map once it has been read and validated
+	try
+	{
+		IReadAtFile::readFileAt(**mFile, cache.node.data(), kNodeSize + entry_set_index * kNodeSize, kNodeSize);
+	}
+	catch (...)
+	{
+		mCacheList.pop_front();
+		throw;
+	}
+
+	const sNodeHeader* node_header = (const sNodeHeader*)cache.node.data();
+	if (node_header->index.get() != entry_set_index || node_header->count.get() == 0 || node_header->count.get() > mEntryPerSetNum)
+	{
+		mCacheList.pop_front();
+
+		std::stringstream error;
+		error << "Bucket tree entry set " << std::dec << entry_set_index << " is corrupt";
+		throw fnd::Exception(kModuleName, error.str());
+	}
+
+	mCacheMap[entry_set_index] = mCacheList.begin();
+	return cache.node;
+}
+
+uint64_t BucketTree::getEntryOffset(const byte_t* entry) const
+{
+	return ((const le_uint64_t*)entry)->get();
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <fnd/types.h>
+#include <fnd/IFile.h>
+#include <fnd/SharedPtr.h>
+#include <fnd/Vec.h>
+
+// reader for the bucket trees (BKTR) that index patch partitions, entries are found by binary search,
+// the index node is kept in memory and the most recently used entry set nodes are cached (find() may be called from several threads at once)
+class BucketTree
+{
+public:
+	static const size_t kNodeSize = 0x4000;
+	static const size_t kDefaultCacheNodeNum = 0x10;
+	static const uint32_t kStructMagic = 0x52544b42; // "BKTR"
+	static const uint32_t kSupportedVersion = 1;
+
+#pragma pack(push,1)
+	struct sHeader
+	{
+		le_uint32_t st_magic;
+		le_uint32_t version;
+		le_uint32_t entry_num;
+		le_uint32_t reserved;
+	};
+#pragma pack(pop)
+
+	// file holds the node storage followed by the entry storage,
+	// each entry begins with the (little endian) 64bit virtual offset it covers the data from
+	BucketTree(const fnd::SharedPtr<fnd::IFile>& file, const sHeader& header, size_t entry_size, size_t cache_node_num = kDefaultCacheNodeNum);
+
+	size_t getEntryNum() const;
+	uint64_t getEndOffset() const;
+
+	// copies the entry containing offset to entry, and sets the virtual range [entry_begin, entry_end) it covers
+	void find(uint64_t offset, byte_t* entry, uint64_t& entry_begin, uint64_t& entry_end);
+private:
+	const std::string kModuleName = "BucketTree";
+
+#pragma pack(push,1)
+	struct sNodeHeader
+	{
+		le_uint32_t index;
+		le_uint32_t count;
+		le_uint64_t offset; // end offset of the node
+	};
+#pragma pack(pop)
+
+	fnd::SharedPtr<fnd::IFile> mFile;
+	size_t mEntrySize;
+	size_t mEntryNum;
+	size_t mEntryPerSetNum;
+	size_t mEntrySetNum;
+	uint64_t mEndOffset;
+
+	// virtual offset of the first entry of each entry set, from the index node
+	fnd::Vec<uint64_t> mEntrySetOffset;
+
+	// cached entry set nodes, most recently used at the front
+	struct CacheEntry
+	{
+		size_t entry_set_index;
+		fnd::Vec<byte_t> node;
+	};
+	size_t mCacheNodeNumMax;
+	std::mutex mCacheLock;
+	std::list<CacheEntry> mCacheList;
+	std::unordered_map<size_t, std::list<CacheEntry>::iterator> mCacheMap;
+
+	void importIndexNode();
+	const fnd::Vec<byte_t>& getEntrySetNode(size_t entry_set_index);
+	uint64_t getEntryOffset(const byte_t* entry) const;
+};
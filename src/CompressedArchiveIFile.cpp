@@ -2,15 +2,23 @@
 #include <fnd/lz4.h>
 
 #include <iostream>
+#include <algorithm>
 
-CompressedArchiveIFile::CompressedArchiveIFile(const fnd::SharedPtr<fnd::IFile>& base_file, size_t compression_meta_offset) :
+CompressedArchiveIFile::CompressedArchiveIFile(const fnd::SharedPtr<fnd::IFile>& base_file, size_t compression_meta_offset, size_t cache_size) :
 	mFile(base_file),
 	mCompEntries(),
 	mLogicalFileSize(0),
+	mLogicalOffset(0),
+	mLastReadEnd(0),
 	mCacheCapacity(nn::hac::compression::kRomfsBlockSize),
-	mCurrentCacheDataSize(0),
-	mCache(std::shared_ptr<byte_t>(new byte_t[mCacheCapacity])),
-	mScratch(std::shared_ptr<byte_t>(new byte_t[mCacheCapacity]))
+	mCacheEntryNumMax(std::max<size_t>(1, cache_size / nn::hac::compression::kRomfsBlockSize)),
+	mCacheList(),
+	mCacheMap(),
+	mScratch(std::shared_ptr<byte_t>(new byte_t[mCacheCapacity], std::default_delete<byte_t[]>())),
+	mSpareBufferList(),
+	mPrefetchPool(),
+	mPrefetchEntryNum(0),
+	mReadRangeEnd(0)
 {
 	// determine and check the compression metadata size
 	size_t compression_meta_size = (*mFile)->size() - compression_meta_offset;
@@ -21,7 +29,7 @@ CompressedArchiveIFile::CompressedArchiveIFile(const fnd::SharedPtr<fnd::IFile>&
 	
 	// import raw metadata
 	std::shared_ptr<byte_t> entries_raw = std::shared_ptr<byte_t>(new byte_t[compression_meta_size]);
-	(*mFile)->read(entries_raw.get(), compression_meta_offset, compression_meta_size);
+	readFileAt(**mFile, entries_raw.get(), compression_meta_offset, compression_meta_size);
 
 	// process metadata entries
 	nn::hac::sCompressionEntry* entries = (nn::hac::sCompressionEntry*)entries_raw.get();
@@ -41,6 +49,9 @@ CompressedArchiveIFile::CompressedArchiveIFile(const fnd::SharedPtr<fnd::IFile>&
 			if (entries[idx].virtual_offset.get() <= entries[idx - 1].virtual_offset.get())
 				throw fnd::Exception(kModuleName, "Entry was not virtually aligned with previous entry");
 
+			if (entries[idx].virtual_offset.get() - mCompEntries[mCompEntries.size() - 1].virtual_offset > mCacheCapacity)
+				throw fnd::Exception(kModuleName, "Entry virtual size was too large");
+
 			// set previous entry virtual_size = this->virtual_offset - prev->virtual_offset;
 			mCompEntries[mCompEntries.size() - 1].virtual_size = uint32_t(entries[idx].virtual_offset.get() - mCompEntries[mCompEntries.size() - 1].virtual_offset);
 		}
@@ -61,9 +72,8 @@ CompressedArchiveIFile::CompressedArchiveIFile(const fnd::SharedPtr<fnd::IFile>&
 	}
 
 	// determine logical file size and final entry size
-	importEntryDataToCache(mCompEntries.size() - 1);
-	mCompEntries[mCurrentEntryIndex].virtual_size = mCurrentCacheDataSize;
-	mLogicalFileSize = mCompEntries[mCurrentEntryIndex].virtual_offset + mCompEntries[mCurrentEntryIndex].virtual_size;
+	mCompEntries.back().virtual_size = importEntryDataToCache(mCompEntries.size() - 1).data_size;
+	mLogicalFileSize = mCompEntries.back().virtual_offset + mCompEntries.back().virtual_size;
 
 	/*
 	for (auto itr = mCompEntries.begin(); itr != mCompEntries.end(); itr++)
@@ -80,6 +90,28 @@ CompressedArchiveIFile::CompressedArchiveIFile(const fnd::SharedPtr<fnd::IFile>&
 	*/
 }
 
+CompressedArchiveIFile::~CompressedArchiveIFile()
+{
+	// background decompression must finish before the buffers it writes to are released
+	for (auto itr = mCacheList.begin(); itr != mCacheList.end(); itr++)
+	{
+		if (itr->pending.valid())
+			itr->pending.wait();
+	}
+}
+
+void CompressedArchiveIFile::setPrefetch(const std::shared_ptr<ThreadPool>& pool, size_t entry_num)
+{
+	mPrefetchPool = pool;
+	mPrefetchEntryNum = std::min<size_t>(entry_num, mCacheEntryNumMax - 1);
+}
+
+void CompressedArchiveIFile::setReadRangeEnd(size_t offset)
+{
+	std::lock_guard<std::mutex> lock(mCacheLock);
+	mReadRangeEnd = std::min<size_t>(offset, mLogicalFileSize);
+}
+
 size_t CompressedArchiveIFile::size()
 {
 	return mLogicalFileSize;
@@ -92,30 +124,48 @@ void CompressedArchiveIFile::seek(size_t offset)
 
 void CompressedArchiveIFile::read(byte_t* out, size_t len)
 {
+	std::lock_guard<std::mutex> lock(mCacheLock);
+
 	// limit len to the end of the logical file
 	len = std::min<size_t>(len, mLogicalFileSize - mLogicalOffset);
 
+	// reads continuing from the end of the last read are assumed to be sequential
+	bool sequential = mLogicalOffset == mLastReadEnd;
+	size_t last_entry_index = len > 0 ? getEntryIndexForLogicalOffset(mLogicalOffset + len - 1) : 0;
+
+	// a sequential read within the range being read is not prefetched past the end of the range
+	size_t range_end_entry_index = mCompEntries.size();
+	if (sequential && mLogicalOffset < mReadRangeEnd)
+		range_end_entry_index = getEntryIndexForLogicalOffset(mReadRangeEnd - 1) + 1;
+
 	for (size_t pos = 0, entry_index = getEntryIndexForLogicalOffset(mLogicalOffset); pos < len; entry_index++)
 	{
-		// importing entry into cache (this does nothing if the entry is already imported)
-		importEntryDataToCache(entry_index);
-
-		// write padding if required
-		if (mCompEntries[entry_index].virtual_size > mCurrentCacheDataSize)
+		// start decompressing the rest of the entries this read spans (and if sequential, the entries after) in the background
+		if (mPrefetchPool != nullptr)
 		{
-			memset(mCache.get() + mCurrentCacheDataSize, 0, mCompEntries[entry_index].virtual_size - mCurrentCacheDataSize);
+			size_t prefetch_end_index = std::min<size_t>(entry_index + 1 + mPrefetchEntryNum, range_end_entry_index);
+			if (sequential == false)
+				prefetch_end_index = std::min<size_t>(prefetch_end_index, last_entry_index + 1);
+
+			if (prefetch_end_index > entry_index + 1)
+				prefetchEntries(entry_index, prefetch_end_index);
 		}
-		
+
+		// importing entry into cache (this does nothing if the entry is already imported)
+		const CacheEntry& cache = importEntryDataToCache(entry_index);
+
 		// determine subset of cache to copy out
 		size_t read_offset = mLogicalOffset - (size_t)mCompEntries[entry_index].virtual_offset;
-		size_t read_size = std::min<size_t>(len, (size_t)mCompEntries[entry_index].virtual_size - read_offset);
+		size_t read_size = std::min<size_t>(len - pos, (size_t)mCompEntries[entry_index].virtual_size - read_offset);
 
-		memcpy(out + pos, mCache.get() + read_offset, read_size);
+		memcpy(out + pos, cache.data.get() + read_offset, read_size);
 
 		// update position/logical offset
 		pos += read_size;
 		mLogicalOffset += read_size;
 	}
+
+	mLastReadEnd = mLogicalOffset;
 }
 
 void CompressedArchiveIFile::read(byte_t* out, size_t offset, size_t len)
@@ -124,6 +174,34 @@ void CompressedArchiveIFile::read(byte_t* out, size_t offset, size_t len)
 	read(out, len);
 }
 
+void CompressedArchiveIFile::readAt(byte_t* out, size_t offset, size_t len)
+{
+	// limit offset and len to the end of the logical file
+	offset = std::min<size_t>(offset, mLogicalFileSize);
+	len = std::min<size_t>(len, mLogicalFileSize - offset);
+
+	for (size_t pos = 0, entry_index = getEntryIndexForLogicalOffset(offset); pos < len; entry_index++)
+	{
+		size_t read_offset = offset + pos - (size_t)mCompEntries[entry_index].virtual_offset;
+		size_t read_size = std::min<size_t>(len - pos, (size_t)mCompEntries[entry_index].virtual_size - read_offset);
+
+		copyEntryData(entry_index, read_offset, out + pos, read_size);
+
+		pos += read_size;
+	}
+}
+
+uint64_t CompressedArchiveIFile::getStorageOrder(size_t offset)
+{
+	offset = std::min<size_t>(offset, mLogicalFileSize);
+
+	// data in an uncompressed entry is stored as is, a compressed entry is read whole from its start
+	const CompressionEntry& entry = mCompEntries[getEntryIndexForLogicalOffset(offset)];
+	size_t entry_pos = entry.compression_type == nn::hac::compression::CompressionType::None ? std::min<size_t>(offset - entry.virtual_offset, entry.physical_size) : 0;
+
+	return getFileStorageOrder(**mFile, entry.physical_offset + entry_pos);
+}
+
 void CompressedArchiveIFile::write(const byte_t* out, size_t len)
 {
 	throw fnd::Exception(kModuleName, "write() not supported");
@@ -134,62 +212,236 @@ void CompressedArchiveIFile::write(const byte_t* out, size_t offset, size_t len)
 	throw fnd::Exception(kModuleName, "write() not supported");
 }
 
-void CompressedArchiveIFile::importEntryDataToCache(size_t entry_index)
+const CompressedArchiveIFile::CacheEntry& CompressedArchiveIFile::importEntryDataToCache(size_t entry_index)
 {
-	// return if entry already imported
-	if (mCurrentEntryIndex == entry_index && mCurrentCacheDataSize != 0)
-		return;
+	// use the entry if already imported, after marking it most recently used
+	std::list<CacheEntry>::iterator cache;
+	auto cached = mCacheMap.find(entry_index);
+	if (cached != mCacheMap.end())
+	{
+		mCacheList.splice(mCacheList.begin(), mCacheList, cached->second);
+		cache = mCacheList.begin();
+	}
+	else
+	{
+		cache = beginImportEntryDataToCache(entry_index, false);
+	}
+
+	// collect the result of background decompression, a failed entry is removed so it is not used again
+	if (cache->pending.valid())
+	{
+		try
+		{
+			cache->data_size = cache->pending.get();
+		}
+		catch (...)
+		{
+			mCacheMap.erase(entry_index);
+			mCacheList.erase(cache);
+			throw;
+		}
+	}
+
+	return *cache;
+}
+
+std::list<CompressedArchiveIFile::CacheEntry>::iterator CompressedArchiveIFile::beginImportEntryDataToCache(size_t entry_index, bool async)
+{
+	CacheEntry cache;
+	cache.entry_index = entry_index;
+	cache.data_size = 0;
+
+	// evict the least recently used entry if the cache is full, reusing its buffers
+	evictCacheEntry(cache);
+	if (cache.data == nullptr)
+	{
+		cache.data = takeSpareBuffer();
+	}
 
-	// save index
-	mCurrentEntryIndex = entry_index;
-	
 	// reference entry
-	CompressionEntry& entry = mCompEntries[mCurrentEntryIndex]; 
+	const CompressionEntry& entry = mCompEntries[entry_index];
 
-	if (entry.compression_type == nn::hac::compression::CompressionType::None)
+	if (entry.compression_type == nn::hac::compression::CompressionType::Lz4 && async)
 	{
-		(*mFile)->read(mCache.get(), entry.physical_offset, entry.physical_size);
-		mCurrentCacheDataSize = entry.physical_size;
+		// the compressed data is read and decompressed on the pool, the base file is read with readAt() so the pool threads can read it at once.
+		// the reader outlives the task, as the destructor and eviction wait for it
+		if (cache.scratch == nullptr)
+		{
+			cache.scratch = takeSpareBuffer();
+		}
+
+		std::shared_ptr<byte_t> src = cache.scratch;
+		std::shared_ptr<byte_t> dst = cache.data;
+		uint64_t src_offset = entry.physical_offset;
+		uint32_t src_size = entry.physical_size;
+		uint32_t virtual_size = entry.virtual_size;
+		std::shared_ptr<std::packaged_task<uint32_t()>> task = std::make_shared<std::packaged_task<uint32_t()>>([this, src, dst, src_offset, src_size, virtual_size]() {
+			readFileAt(**mFile, src.get(), src_offset, src_size);
+			return decompressEntryData(src.get(), src_size, dst.get(), virtual_size);
+		});
+		cache.pending = task->get_future();
+		mPrefetchPool->enqueue([task](size_t thread_index) { (*task)(); });
 	}
-	else if (entry.compression_type == nn::hac::compression::CompressionType::Lz4)
+	else
 	{
-		(*mFile)->read(mScratch.get(), entry.physical_offset, entry.physical_size);
+		cache.data_size = loadEntryData(entry_index, mScratch.get(), cache.data.get());
+	}
 
-		mCurrentCacheDataSize = 0;
-		fnd::lz4::decompressData(mScratch.get(), entry.physical_size, mCache.get(), uint32_t(mCacheCapacity), mCurrentCacheDataSize);
+	mCacheList.push_front(std::move(cache));
+	mCacheMap[entry_index] = mCacheList.begin();
+
+	return mCacheList.begin();
+}
 
-		if (mCurrentCacheDataSize == 0)
+void CompressedArchiveIFile::prefetchEntries(size_t begin_index, size_t end_index)
+{
+	for (size_t entry_index = begin_index; entry_index < end_index && entry_index < mCompEntries.size(); entry_index++)
+	{
+		auto cached = mCacheMap.find(entry_index);
+		if (cached != mCacheMap.end())
+		{
+			// keep the entry from being evicted by the entries prefetched after it
+			mCacheList.splice(mCacheList.begin(), mCacheList, cached->second);
+		}
+		else
 		{
-			throw fnd::Exception(kModuleName, "Decompression of final block failed");
+			beginImportEntryDataToCache(entry_index, true);
 		}
 	}
 }
 
-size_t CompressedArchiveIFile::getEntryIndexForLogicalOffset(size_t logical_offset)
+void CompressedArchiveIFile::evictCacheEntry(CacheEntry& recycled)
 {
-	// rule out bad offset
-	if (logical_offset > mLogicalFileSize)
-		throw fnd::Exception(kModuleName, "illegal logical offset");
+	if (mCacheList.size() < mCacheEntryNumMax)
+		return;
+
+	CacheEntry& lru = mCacheList.back();
+
+	// a prefetched entry that was never read may still be decompressing, its result is discarded
+	if (lru.pending.valid())
+		lru.pending.wait();
+
+	recycled.data = lru.data;
+	recycled.scratch = lru.scratch;
+	mCacheMap.erase(lru.entry_index);
+	mCacheList.pop_back();
+}
+
+std::shared_ptr<byte_t> CompressedArchiveIFile::takeSpareBuffer()
+{
+	if (mSpareBufferList.empty())
+		return std::shared_ptr<byte_t>(new byte_t[mCacheCapacity], std::default_delete<byte_t[]>());
+
+	std::shared_ptr<byte_t> buffer = mSpareBufferList.back();
+	mSpareBufferList.pop_back();
+	return buffer;
+}
+
+void CompressedArchiveIFile::addSpareBuffer(const std::shared_ptr<byte_t>& buffer)
+{
+	// enough are kept for every thread reading at once, beyond that they are released
+	if (buffer != nullptr && mSpareBufferList.size() < mCacheEntryNumMax)
+		mSpareBufferList.push_back(buffer);
+}
 
-	size_t entry_index = 0;
+void CompressedArchiveIFile::copyEntryData(size_t entry_index, size_t offset, byte_t* out, size_t len)
+{
+	std::shared_ptr<byte_t> scratch;
+	std::shared_ptr<byte_t> data;
+	{
+		std::lock_guard<std::mutex> lock(mCacheLock);
+		if (mCacheMap.find(entry_index) != mCacheMap.end())
+		{
+			const CacheEntry& cache = importEntryDataToCache(entry_index);
+			memcpy(out, cache.data.get() + offset, len);
+			return;
+		}
 
-	// try the current comp entry 
-	if (mCompEntries[mCurrentEntryIndex].virtual_offset <= logical_offset && \
-		mCompEntries[mCurrentEntryIndex].virtual_offset + mCompEntries[mCurrentEntryIndex].virtual_size >= logical_offset)
+		// the buffers are taken from this reader (not the thread), so a read nested in another on the same thread has its own
+		scratch = takeSpareBuffer();
+		data = takeSpareBuffer();
+	}
+
+	// an entry that is not cached is decompressed without holding the lock, so threads reading different entries do not wait on each other.
+	// if two threads decompress the same entry at once, only the first to finish adds it to the cache
+	uint32_t data_size = loadEntryData(entry_index, scratch.get(), data.get());
+	memcpy(out, data.get() + offset, len);
+
+	std::lock_guard<std::mutex> lock(mCacheLock);
+	addSpareBuffer(scratch);
+	if (mCacheMap.find(entry_index) == mCacheMap.end())
 	{
-		entry_index = mCurrentEntryIndex;
+		// the evicted entry's buffers are kept for the next entry loaded
+		CacheEntry cache;
+		evictCacheEntry(cache);
+		addSpareBuffer(cache.data);
+		addSpareBuffer(cache.scratch);
+		cache.entry_index = entry_index;
+		cache.data_size = data_size;
+		cache.data = data;
+		cache.scratch = nullptr;
+
+		mCacheList.push_front(std::move(cache));
+		mCacheMap[entry_index] = mCacheList.begin();
 	}
 	else
 	{
-		for (size_t index = 0; index < mCompEntries.size(); index++)
+		addSpareBuffer(data);
+	}
+}
+
+uint32_t CompressedArchiveIFile::loadEntryData(size_t entry_index, byte_t* scratch, byte_t* data)
+{
+	const CompressionEntry& entry = mCompEntries[entry_index];
+	uint32_t data_size = 0;
+
+	if (entry.compression_type == nn::hac::compression::CompressionType::None)
+	{
+		readFileAt(**mFile, data, entry.physical_offset, entry.physical_size);
+		data_size = entry.physical_size;
+
+		// write padding if required
+		if (entry.virtual_size > data_size)
 		{
-			if (mCompEntries[index].virtual_offset <= logical_offset && \
-				mCompEntries[index].virtual_offset + mCompEntries[index].virtual_size >= logical_offset)
-			{
-				entry_index = index;
-			}
+			memset(data + data_size, 0, entry.virtual_size - data_size);
 		}
 	}
+	else if (entry.compression_type == nn::hac::compression::CompressionType::Lz4)
+	{
+		readFileAt(**mFile, scratch, entry.physical_offset, entry.physical_size);
+		data_size = decompressEntryData(scratch, entry.physical_size, data, entry.virtual_size);
+	}
+
+	return data_size;
+}
+
+uint32_t CompressedArchiveIFile::decompressEntryData(const byte_t* src, uint32_t src_size, byte_t* dst, uint32_t virtual_size) const
+{
+	uint32_t data_size = 0;
+	fnd::lz4::decompressData(src, src_size, dst, uint32_t(mCacheCapacity), data_size);
+
+	if (data_size == 0)
+	{
+		throw fnd::Exception(kModuleName, "Decompression of final block failed");
+	}
+
+	// write padding if required
+	if (virtual_size > data_size)
+	{
+		memset(dst + data_size, 0, virtual_size - data_size);
+	}
+
+	return data_size;
+}
 
-	return entry_index;
-}
\ No newline at end of file
+size_t CompressedArchiveIFile::getEntryIndexForLogicalOffset(size_t logical_offset)
+{
+	// rule out bad offset
+	if (logical_offset > mLogicalFileSize)
+		throw fnd::Exception(kModuleName, "illegal logical offset");
+
+	// entries are sorted by virtual offset, so find the last entry that starts at or before logical_offset
+	auto entry = std::upper_bound(mCompEntries.begin(), mCompEntries.end(), logical_offset, [](size_t offset, const CompressionEntry& e) { return offset < e.virtual_offset; });
+
+	return (entry == mCompEntries.begin()) ? 0 : size_t(entry - mCompEntries.begin()) - 1;
+}
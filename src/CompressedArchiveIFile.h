@@ -4,22 +4,42 @@
 #include <fnd/SharedPtr.h>
 #include <memory>
 #include <vector>
+#include <list>
+#include <unordered_map>
+#include <future>
+#include <mutex>
 #include <nn/hac/define/compression.h>
+#include "ThreadPool.h"
+#include "IReadAtFile.h"
 
-class CompressedArchiveIFile : public fnd::IFile
+class CompressedArchiveIFile : public IReadAtFile
 {
 public:
-	CompressedArchiveIFile(const fnd::SharedPtr<fnd::IFile>& file, size_t compression_meta_offset);
+	static const size_t kDefaultCacheSize = 0x1000000;
+
+	// cache_size is the size of the LRU cache of decompressed entries (at least one entry is always cached)
+	CompressedArchiveIFile(const fnd::SharedPtr<fnd::IFile>& file, size_t compression_meta_offset, size_t cache_size = kDefaultCacheSize);
+	~CompressedArchiveIFile();
+
+	// decompress entries on pool (which may be shared between readers), up to entry_num entries ahead of sequential reads,
+	// and in parallel for reads spanning several entries. entry_num is limited by the cache size
+	void setPrefetch(const std::shared_ptr<ThreadPool>& pool, size_t entry_num);
+
+	// sequential reads that begin before offset do not prefetch past it (e.g. the end of the file being extracted),
+	// reads beginning at or after it are not limited, so a range that has been read past has no effect
+	void setReadRangeEnd(size_t offset);
 
 	size_t size();
 	void seek(size_t offset);
 	void read(byte_t* out, size_t len);
 	void read(byte_t* out, size_t offset, size_t len);
+	// the decompressed entry cache is shared by all threads, entries not in the cache are decompressed by the thread reading them (without prefetch)
+	void readAt(byte_t* out, size_t offset, size_t len);
+	uint64_t getStorageOrder(size_t offset);
 	void write(const byte_t* out, size_t len);
 	void write(const byte_t* out, size_t offset, size_t len);
 private:
 	const std::string kModuleName = "CompressedArchiveIFile";
-	std::stringstream mErrorSs;
 
 	struct CompressionEntry
 	{
@@ -37,15 +57,39 @@ private:
 	std::vector<CompressionEntry> mCompEntries;
 	size_t mLogicalFileSize;
 	size_t mLogicalOffset;
+	size_t mLastReadEnd;
+
+	// cached decompressed entries, most recently used at the front (the cache and mScratch are only used with mCacheLock held)
+	struct CacheEntry
+	{
+		size_t entry_index;
+		uint32_t data_size; // size of decompressed data, the rest of the entry is zero padding
+		std::shared_ptr<byte_t> data;
+		std::shared_ptr<byte_t> scratch; // compressed data for background decompression
+		std::future<uint32_t> pending; // valid until the result of background decompression is collected
+	};
+	size_t mCacheCapacity; // capacity of each cache entry
+	size_t mCacheEntryNumMax;
+	std::mutex mCacheLock;
+	std::list<CacheEntry> mCacheList;
+	std::unordered_map<size_t, std::list<CacheEntry>::iterator> mCacheMap;
+	std::shared_ptr<byte_t> mScratch; // same size as a cache entry, but is used for storing data pre-compression
+	std::vector<std::shared_ptr<byte_t>> mSpareBufferList; // buffers of evicted entries, reused for the next entries loaded
 
-	// cached decompressed entry
-	size_t mCacheCapacity; // capacity 
-	size_t mCurrentEntryIndex; // index of entry currently associated with the cache
-	uint32_t mCurrentCacheDataSize; // size of data currently in cache
-	std::shared_ptr<byte_t> mCache; // where decompressed data resides
-	std::shared_ptr<byte_t> mScratch; // same size as cache, but is used for storing data pre-compression
+	// prefetch
+	std::shared_ptr<ThreadPool> mPrefetchPool;
+	size_t mPrefetchEntryNum;
+	size_t mReadRangeEnd;
 
-	// this will import entry to cache
-	void importEntryDataToCache(size_t entry_index);
+	// this will import entry to cache, and return the cache entry
+	const CacheEntry& importEntryDataToCache(size_t entry_index);
+	std::list<CacheEntry>::iterator beginImportEntryDataToCache(size_t entry_index, bool async);
+	void prefetchEntries(size_t begin_index, size_t end_index);
+	void evictCacheEntry(CacheEntry& recycled);
+	std::shared_ptr<byte_t> takeSpareBuffer();
+	void addSpareBuffer(const std::shared_ptr<byte_t>& buffer);
+	void copyEntryData(size_t entry_index, size_t offset, byte_t* out, size_t len);
+	uint32_t loadEntryData(size_t entry_index, byte_t* scratch, byte_t* data);
+	uint32_t decompressEntryData(const byte_t* src, uint32_t src_size, byte_t* dst, uint32_t virtual_size) const;
 	size_t getEntryIndexForLogicalOffset(size_t logical_offset);
 };
\ No newline at end of file
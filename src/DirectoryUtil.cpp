@@ -0,0 +1,86 @@
+#include "DirectoryUtil.h"
+#include <fnd/types.h>
+#include <fnd/io.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <fnd/StringConv.h>
+#else
+#include <sys/stat.h>
+#include <dirent.h>
+#endif
+
+static const std::string kModuleName = "DirectoryUtil";
+
+bool DirectoryUtil::isDirectory(const std::string& path)
+{
+#ifdef _WIN32
+	DWORD attributes = GetFileAttributesW((LPCWSTR)fnd::StringConv::ConvertChar8ToChar16(path).c_str());
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+#endif
+}
+
+void DirectoryUtil::getFileList(const std::string& dir_path, std::vector<std::string>& file_list)
+{
+#ifdef _WIN32
+	std::string search_path;
+	fnd::io::appendToPath(search_path, dir_path);
+	fnd::io::appendToPath(search_path, "*");
+
+	WIN32_FIND_DATAW find_data;
+	HANDLE find_handle = FindFirstFileW((LPCWSTR)fnd::StringConv::ConvertChar8ToChar16(search_path).c_str(), &find_data);
+	if (find_handle == INVALID_HANDLE_VALUE)
+	{
+		throw fnd::Exception(kModuleName, "Failed to open directory: " + dir_path);
+	}
+
+	do
+	{
+		std::string name = fnd::StringConv::ConvertChar16ToChar8(std::u16string((char16_t*)find_data.cFileName));
+		if (name == "." || name == "..")
+			continue;
+
+		std::string path;
+		fnd::io::appendToPath(path, dir_path);
+		fnd::io::appendToPath(path, name);
+
+		if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			getFileList(path, file_list);
+		else
+			file_list.push_back(path);
+	} while (FindNextFileW(find_handle, &find_data));
+
+	FindClose(find_handle);
+#else
+	DIR* dir = opendir(dir_path.c_str());
+	if (dir == nullptr)
+	{
+		throw fnd::Exception(kModuleName, "Failed to open directory: " + dir_path);
+	}
+
+	for (struct dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+	{
+		std::string name = entry->d_name;
+		if (name == "." || name == "..")
+			continue;
+
+		std::string path;
+		fnd::io::appendToPath(path, dir_path);
+		fnd::io::appendToPath(path, name);
+
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0)
+			continue;
+
+		if (S_ISDIR(st.st_mode))
+			getFileList(path, file_list);
+		else if (S_ISREG(st.st_mode))
+			file_list.push_back(path);
+	}
+
+	closedir(dir);
+#endif
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <string>
+#include <vector>
+
+class DirectoryUtil
+{
+public:
+	// returns true if path is an existing directory
+	static bool isDirectory(const std::string& path);
+
+	// appends the path of every regular file in dir_path (and its sub-directories) to file_list, in no particular order
+	static void getFileList(const std::string& dir_path, std::vector<std::string>& file_list);
+};
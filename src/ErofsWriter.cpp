@@ -0,0 +1,237 @@
+#include "ErofsWriter.h"
+#include <cstring>
+#include <algorithm>
+#include "IReadAtFile.h"
+
+#ifdef _WIN32
+#include <fnd/StringConv.h>
+#endif
+
+ErofsWriter::ErofsWriter(const std::string& path) :
+	mStream(nullptr)
+{
+#ifdef _WIN32
+	mStream = _wfopen((const wchar_t*)fnd::StringConv::ConvertChar8ToChar16(path).c_str(), L"wb");
+#else
+	mStream = fopen(path.c_str(), "wb");
+#endif
+
+	if (mStream == nullptr)
+	{
+		throw fnd::Exception(kModuleName, "Failed to open image for writing");
+	}
+}
+
+ErofsWriter::~ErofsWriter()
+{
+	fclose(mStream);
+}
+
+void ErofsWriter::writeImage(const std::vector<RomfsProcess::sDirEntry>& dir_list, const std::vector<RomfsProcess::sFileEntry>& file_list, fnd::IFile& romfs, fnd::Vec<byte_t>& cache)
+{
+	/*
+	the image is laid out as:
+		block 0: super block (at 0x400)
+		metadata area: one extended inode per directory, then one per file (so the root directory has nid 0)
+		directory data: the dirent blocks of each directory
+		file data: each file starts on a block, in the order the files are stored in the RomFS
+	*/
+	size_t inode_num = dir_list.size() + file_list.size();
+	uint32_t dir_data_block_addr = kMetaBlockAddr + getBlockNum(inode_num * sizeof(sInodeExtended));
+
+	// the directory data is small, so it is generated up front to know each directory's size
+	std::vector<byte_t> dir_data;
+	std::vector<uint32_t> dir_block_addr(dir_list.size());
+	std::vector<uint64_t> dir_size(dir_list.size());
+	for (uint32_t i = 0; i < dir_list.size(); i++)
+	{
+		dir_block_addr[i] = dir_data_block_addr + (uint32_t)(dir_data.size() / kBlockSize);
+		createDirData(dir_list, file_list, i, dir_data, dir_size[i]);
+	}
+	uint32_t block_addr = dir_data_block_addr + (uint32_t)(dir_data.size() / kBlockSize);
+
+	// files are given blocks in the order they are stored (resolved through the reader, as a patched RomFS is stored in the base and patch partitions),
+	// files that share their data in the RomFS share their blocks in the image
+	std::vector<uint32_t> file_order(file_list.size());
+	std::vector<uint64_t> file_storage_order(file_list.size());
+	for (uint32_t i = 0; i < file_order.size(); i++)
+	{
+		file_order[i] = i;
+		file_storage_order[i] = IReadAtFile::getFileStorageOrder(romfs, file_list[i].offset);
+	}
+	std::stable_sort(file_order.begin(), file_order.end(), [&file_list, &file_storage_order](uint32_t a, uint32_t b) {
+		return file_storage_order[a] < file_storage_order[b] || (file_storage_order[a] == file_storage_order[b] && file_list[a].offset < file_list[b].offset);
+	});
+
+	std::vector<uint32_t> file_block_addr(file_list.size());
+	std::vector<bool> file_data_shared(file_list.size(), false);
+	for (size_t i = 0; i < file_order.size(); i++)
+	{
+		const RomfsProcess::sFileEntry& file = file_list[file_order[i]];
+		if (i > 0 && file_list[file_order[i-1]].offset == file.offset && file_list[file_order[i-1]].size == file.size)
+		{
+			file_block_addr[file_order[i]] = file_block_addr[file_order[i-1]];
+			file_data_shared[file_order[i]] = true;
+			continue;
+		}
+
+		if ((uint64_t)block_addr + getBlockNum(file.size) > 0xffffffff)
+		{
+			throw fnd::Exception(kModuleName, "RomFS is too large for an EROFS image");
+		}
+
+		file_block_addr[file_order[i]] = block_addr;
+		block_addr += getBlockNum(file.size);
+	}
+
+	// super block
+	byte_t super_block[kBlockSize] = {0};
+	sSuperBlock* sb = (sSuperBlock*)(super_block + kSuperBlockOffset);
+	sb->magic.set(kMagic);
+	sb->block_size_bits = kBlockSizeBits;
+	sb->root_nid.set((uint16_t)getDirNid(0));
+	sb->inode_num.set(inode_num);
+	sb->block_num.set(block_addr);
+	sb->meta_block_addr.set(kMetaBlockAddr);
+	writeRaw(super_block, kBlockSize);
+
+	// inodes
+	sInodeExtended inode;
+	for (uint32_t i = 0; i < dir_list.size(); i++)
+	{
+		uint32_t subdir_num = 0;
+		for (uint32_t child_index = dir_list[i].child; child_index != RomfsProcess::kNullIndex; child_index = dir_list[child_index].sibling)
+			subdir_num++;
+
+		memset(&inode, 0, sizeof(sInodeExtended));
+		inode.format.set(INODE_FORMAT_EXTENDED);
+		inode.mode.set(0040755);
+		inode.size.set(dir_size[i]);
+		inode.raw_block_addr.set(dir_block_addr[i]);
+		inode.ino.set(i + 1);
+		inode.nlink.set(2 + subdir_num);
+		writeRaw(&inode, sizeof(sInodeExtended));
+	}
+	for (uint32_t i = 0; i < file_list.size(); i++)
+	{
+		memset(&inode, 0, sizeof(sInodeExtended));
+		inode.format.set(INODE_FORMAT_EXTENDED);
+		inode.mode.set(0100644);
+		inode.size.set(file_list[i].size);
+		inode.raw_block_addr.set(file_block_addr[i]);
+		inode.ino.set((uint32_t)(dir_list.size() + i + 1));
+		inode.nlink.set(1);
+		writeRaw(&inode, sizeof(sInodeExtended));
+	}
+	writePadding(inode_num * sizeof(sInodeExtended));
+
+	// directory data (already padded to a block for each directory)
+	writeRaw(dir_data.data(), dir_data.size());
+
+	// file data, in one sweep through the RomFS
+	for (size_t i = 0; i < file_order.size(); i++)
+	{
+		const RomfsProcess::sFileEntry& file = file_list[file_order[i]];
+		if (file_data_shared[file_order[i]])
+			continue;
+
+		romfs.seek(file.offset);
+		for (uint64_t pos = 0; pos < file.size; pos += cache.size())
+		{
+			size_t chunk_size = (size_t)_MIN(file.size - pos, (uint64_t)cache.size());
+			romfs.read(cache.data(), chunk_size);
+			writeRaw(cache.data(), chunk_size);
+		}
+		writePadding(file.size);
+	}
+
+	if (fflush(mStream) != 0)
+	{
+		throw fnd::Exception(kModuleName, "Failed to write to image");
+	}
+}
+
+uint64_t ErofsWriter::getDirNid(uint32_t dir_index)
+{
+	return (uint64_t)dir_index * (sizeof(sInodeExtended) / kInodeSlotSize);
+}
+
+uint64_t ErofsWriter::getFileNid(size_t dir_num, uint32_t file_index)
+{
+	return (uint64_t)(dir_num + file_index) * (sizeof(sInodeExtended) / kInodeSlotSize);
+}
+
+uint32_t ErofsWriter::getBlockNum(uint64_t size)
+{
+	return (uint32_t)((size + kBlockSize - 1) / kBlockSize);
+}
+
+void ErofsWriter::createDirData(const std::vector<RomfsProcess::sDirEntry>& dir_list, const std::vector<RomfsProcess::sFileEntry>& file_list, uint32_t dir_index, std::vector<byte_t>& data, uint64_t& dir_size) const
+{
+	const RomfsProcess::sDirEntry& dir = dir_list[dir_index];
+
+	// the entries of a directory (including "." and "..") are sorted by name, both within and across blocks, as they are binary searched
+	std::vector<sDirChild> child;
+	child.push_back({".", 1, getDirNid(dir_index), FT_DIR});
+	child.push_back({"..", 2, getDirNid(dir_index == 0 ? 0 : dir.parent), FT_DIR});
+	for (uint32_t child_index = dir.child; child_index != RomfsProcess::kNullIndex; child_index = dir_list[child_index].sibling)
+		child.push_back({dir_list[child_index].name, dir_list[child_index].name_size, getDirNid(child_index), FT_DIR});
+	for (uint32_t file_index = dir.file; file_index != RomfsProcess::kNullIndex; file_index = file_list[file_index].sibling)
+		child.push_back({file_list[file_index].name, file_list[file_index].name_size, getFileNid(dir_list.size(), file_index), FT_REG_FILE});
+
+	std::sort(child.begin(), child.end(), [](const sDirChild& a, const sDirChild& b) {
+		int cmp = memcmp(a.name, b.name, _MIN(a.name_size, b.name_size));
+		return cmp < 0 || (cmp == 0 && a.name_size < b.name_size);
+	});
+
+	// each block is an array of dirents followed by the names they point to, as many entries as fit are packed into each block
+	size_t dir_offset = data.size();
+	size_t block_offset = dir_offset;
+	for (size_t begin = 0, end = 0; begin < child.size(); begin = end)
+	{
+		size_t used_size = 0;
+		for (end = begin; end < child.size() && used_size + sizeof(sDirent) + child[end].name_size <= kBlockSize; end++)
+			used_size += sizeof(sDirent) + child[end].name_size;
+
+		if (end == begin)
+		{
+			throw fnd::Exception(kModuleName, "RomFS file name is too long for an EROFS image");
+		}
+
+		block_offset = data.size();
+		data.resize(block_offset + kBlockSize, 0);
+
+		size_t name_offset = (end - begin) * sizeof(sDirent);
+		for (size_t i = begin; i < end; i++)
+		{
+			sDirent dirent;
+			memset(&dirent, 0, sizeof(sDirent));
+			dirent.nid.set(child[i].nid);
+			dirent.name_offset.set((uint16_t)name_offset);
+			dirent.file_type = child[i].file_type;
+
+			memcpy(data.data() + block_offset + (i - begin) * sizeof(sDirent), &dirent, sizeof(sDirent));
+			memcpy(data.data() + block_offset + name_offset, child[i].name, child[i].name_size);
+			name_offset += child[i].name_size;
+		}
+
+		// the directory ends after the last name, the rest of its last block is padding
+		dir_size = (block_offset - dir_offset) + used_size;
+	}
+}
+
+void ErofsWriter::writeRaw(const void* data, size_t len)
+{
+	if (fwrite(data, 1, len, mStream) != len)
+	{
+		throw fnd::Exception(kModuleName, "Failed to write to image");
+	}
+}
+
+void ErofsWriter::writePadding(uint64_t size)
+{
+	static const byte_t kPadding[kBlockSize] = {0};
+
+	size_t padding_size = (kBlockSize - (size % kBlockSize)) % kBlockSize;
+	writeRaw(kPadding, padding_size);
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <fnd/types.h>
+#include <fnd/IFile.h>
+#include <fnd/Vec.h>
+
+#include "RomfsProcess.h"
+
+// writes a RomFS as an uncompressed EROFS image (which Linux can mount read-only), the image is written front to back and the RomFS data is read once, in the order it is stored
+class ErofsWriter
+{
+public:
+	ErofsWriter(const std::string& path);
+	~ErofsWriter();
+
+	// dir_list and file_list are the index of the RomFS (see RomfsProcess), the file data is read from romfs through cache
+	void writeImage(const std::vector<RomfsProcess::sDirEntry>& dir_list, const std::vector<RomfsProcess::sFileEntry>& file_list, fnd::IFile& romfs, fnd::Vec<byte_t>& cache);
+private:
+	const std::string kModuleName = "ErofsWriter";
+	static const uint32_t kMagic = 0xE0F5E1E2;
+	static const size_t kBlockSizeBits = 12;
+	static const size_t kBlockSize = 1 << kBlockSizeBits;
+	static const size_t kSuperBlockOffset = 0x400;
+	static const size_t kInodeSlotSize = 0x20; // a nid is an offset into the metadata area in these units
+	static const uint32_t kMetaBlockAddr = 1;
+
+	enum FileType
+	{
+		FT_REG_FILE = 1,
+		FT_DIR = 2
+	};
+
+	enum InodeFormat
+	{
+		INODE_FORMAT_EXTENDED = 1, // bit 0, the data layout is in bits 1-3 (0 is flat plain, the data is stored in consecutive blocks)
+	};
+
+#pragma pack(push,1)
+	struct sSuperBlock
+	{
+		le_uint32_t magic;
+		le_uint32_t checksum;
+		le_uint32_t feature_compat;
+		byte_t block_size_bits;
+		byte_t sb_extslots;
+		le_uint16_t root_nid;
+		le_uint64_t inode_num;
+		le_uint64_t build_time;
+		le_uint32_t build_time_nsec;
+		le_uint32_t block_num;
+		le_uint32_t meta_block_addr;
+		le_uint32_t xattr_block_addr;
+		byte_t uuid[16];
+		byte_t volume_name[16];
+		le_uint32_t feature_incompat;
+		le_uint16_t available_compr_algs;
+		le_uint16_t extra_devices;
+		le_uint16_t devt_slotoff;
+		byte_t reserved[38];
+	};
+
+	struct sInodeExtended
+	{
+		le_uint16_t format;
+		le_uint16_t xattr_icount;
+		le_uint16_t mode;
+		le_uint16_t reserved;
+		le_uint64_t size;
+		le_uint32_t raw_block_addr;
+		le_uint32_t ino;
+		le_uint32_t uid;
+		le_uint32_t gid;
+		le_uint64_t mtime;
+		le_uint32_t mtime_nsec;
+		le_uint32_t nlink;
+		byte_t reserved2[16];
+	};
+
+	struct sDirent
+	{
+		le_uint64_t nid;
+		le_uint16_t name_offset;
+		byte_t file_type;
+		byte_t reserved;
+	};
+#pragma pack(pop)
+
+	struct sDirChild
+	{
+		const char* name;
+		uint32_t name_size;
+		uint64_t nid;
+		FileType file_type;
+	};
+
+	FILE* mStream;
+
+	static uint64_t getDirNid(uint32_t dir_index);
+	static uint64_t getFileNid(size_t dir_num, uint32_t file_index);
+	static uint32_t getBlockNum(uint64_t size);
+	void createDirData(const std::vector<RomfsProcess::sDirEntry>& dir_list, const std::vector<RomfsProcess::sFileEntry>& file_list, uint32_t dir_index, std::vector<byte_t>& data, uint64_t& dir_size) const;
+	void writeRaw(const void* data, size_t len);
+	void writePadding(uint64_t size);
+};
@@ -10,6 +10,7 @@
 
 EsTikProcess::EsTikProcess() :
 	mFile(),
+	mKeyCfg(KeyConfiguration::getEmptyKeyCfg()),
 	mCliOutputMode(_BIT(OUTPUT_BASIC)),
 	mVerify(false)
 {
@@ -31,7 +32,7 @@ void EsTikProcess::setInputFile(const fnd::SharedPtr<fnd::IFile>& file)
 	mFile = file;
 }
 
-void EsTikProcess::setKeyCfg(const KeyConfiguration& keycfg)
+void EsTikProcess::setKeyCfg(const std::shared_ptr<const KeyConfiguration>& keycfg)
 {
 	mKeyCfg = keycfg;
 }
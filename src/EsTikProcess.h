@@ -18,7 +18,7 @@ public:
 	void process();
 
 	void setInputFile(const fnd::SharedPtr<fnd::IFile>& file);
-	void setKeyCfg(const KeyConfiguration& keycfg);
+	void setKeyCfg(const std::shared_ptr<const KeyConfiguration>& keycfg);
 	void setCertificateChain(const fnd::List<nn::pki::SignedData<nn::pki::CertificateBody>>& certs);
 	void setCliOutputMode(CliOutputMode mode);
 	void setVerifyMode(bool verify);
@@ -27,7 +27,7 @@ private:
 	const std::string kModuleName = "EsTikProcess";
 
 	fnd::SharedPtr<fnd::IFile> mFile;
-	KeyConfiguration mKeyCfg;
+	std::shared_ptr<const KeyConfiguration> mKeyCfg;
 	CliOutputMode mCliOutputMode;
 	bool mVerify;
 	
@@ -0,0 +1,118 @@
+#include "ExtractUtil.h"
+#include "MemoryMappedFile.h"
+#include "CompressedArchiveIFile.h"
+#include <fnd/SimpleFile.h>
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+static const std::string kModuleName = "ExtractUtil";
+
+#ifdef __linux__
+static ssize_t copyFileRange(int in_fd, loff_t* in_offset, int out_fd, size_t len)
+{
+#ifdef SYS_copy_file_range
+	return syscall(SYS_copy_file_range, in_fd, in_offset, out_fd, nullptr, len, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+#endif
+
+void ExtractUtil::extractFile(fnd::IFile& in_file, size_t offset, size_t size, const std::string& out_path, fnd::Vec<byte_t>& cache)
+{
+	if (extractFileInKernel(in_file, offset, size, out_path))
+		return;
+
+	// the file is read with seek() and read(), so readers that prefetch ahead of sequential reads (CompressedArchiveIFile) can do so, up to the end of the file
+	CompressedArchiveIFile* compressed_file = dynamic_cast<CompressedArchiveIFile*>(&in_file);
+	if (compressed_file != nullptr)
+		compressed_file->setReadRangeEnd(offset + size);
+
+	fnd::SimpleFile out_file(out_path, fnd::SimpleFile::Create);
+	in_file.seek(offset);
+	for (size_t j = 0; j < ((size / cache.size()) + ((size % cache.size()) != 0)); j++)
+	{
+		in_file.read(cache.data(), _MIN(size - (cache.size() * j), cache.size()));
+		out_file.write(cache.data(), _MIN(size - (cache.size() * j), cache.size()));
+	}
+	out_file.close();
+}
+
+bool ExtractUtil::extractFileInKernel(fnd::IFile& in_file, size_t offset, size_t size, const std::string& out_path)
+{
+#ifdef __linux__
+	// only a view of a file on disk can be copied without passing through user space
+	MemoryMappedFile* mapped_file = dynamic_cast<MemoryMappedFile*>(&in_file);
+	if (mapped_file == nullptr || offset > mapped_file->size() || size > mapped_file->size() - offset)
+		return false;
+
+	int out_fd = open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (out_fd == -1)
+	{
+		throw fnd::Exception(kModuleName, "Failed to open file: " + out_path);
+	}
+
+	int in_fd = mapped_file->getFileDescriptor();
+	loff_t in_offset = mapped_file->getFileOffset() + offset;
+	size_t remaining = size;
+
+	// copy_file_range can reflink on filesystems that support it, sendfile is used if copy_file_range
+	// is unsupported (old kernels, or across filesystems), and failing both the data is written from the mapping
+	bool use_copy_file_range = true;
+	bool use_sendfile = true;
+	while (remaining > 0)
+	{
+		ssize_t copied;
+		if (use_copy_file_range)
+		{
+			copied = copyFileRange(in_fd, &in_offset, out_fd, remaining);
+		}
+		else if (use_sendfile)
+		{
+			off_t sendfile_offset = in_offset;
+			copied = sendfile(out_fd, in_fd, &sendfile_offset, remaining);
+			if (copied > 0)
+				in_offset = sendfile_offset;
+		}
+		else
+		{
+			copied = write(out_fd, mapped_file->data() + (in_offset - mapped_file->getFileOffset()), remaining);
+			if (copied > 0)
+				in_offset += copied;
+		}
+
+		// interrupted, try again
+		if (copied == -1 && errno == EINTR)
+			continue;
+
+		// fall back to the next method (which resumes from in_offset)
+		if (copied <= 0)
+		{
+			if (use_copy_file_range)
+				use_copy_file_range = false;
+			else if (use_sendfile)
+				use_sendfile = false;
+			else
+			{
+				close(out_fd);
+				throw fnd::Exception(kModuleName, "Failed to write file: " + out_path);
+			}
+			continue;
+		}
+
+		remaining -= copied;
+	}
+
+	close(out_fd);
+	return true;
+#else
+	return false;
+#endif
+}
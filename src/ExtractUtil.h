@@ -0,0 +1,16 @@
+#pragma once
+#include <string>
+#include <fnd/types.h>
+#include <fnd/IFile.h>
+#include <fnd/Vec.h>
+
+class ExtractUtil
+{
+public:
+	// writes size bytes from offset in in_file to a new file at out_path.
+	// if in_file is an untransformed view of a file on disk the copy is done in-kernel, otherwise it is done through cache.
+	static void extractFile(fnd::IFile& in_file, size_t offset, size_t size, const std::string& out_path, fnd::Vec<byte_t>& cache);
+
+private:
+	static bool extractFileInKernel(fnd::IFile& in_file, size_t offset, size_t size, const std::string& out_path);
+};
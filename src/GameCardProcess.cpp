@@ -1,17 +1,25 @@
 #include <iostream>
 #include <iomanip>
+#include <vector>
+#include <algorithm>
 #include <fnd/SimpleTextOutput.h>
-#include <fnd/OffsetAdjustedIFile.h>
 #include <nn/hac/GameCardUtil.h>
 #include <nn/hac/ContentMetaUtil.h>
 #include <nn/hac/ContentArchiveUtil.h>
 #include "GameCardProcess.h"
+#include "MemoryMappedFile.h"
 
 GameCardProcess::GameCardProcess() :
 	mFile(),
+	mFileFactory(),
+	mKeyCfg(KeyConfiguration::getEmptyKeyCfg()),
 	mCliOutputMode(_BIT(OUTPUT_BASIC)),
 	mVerify(false),
 	mListFs(false),
+	mThreadNum(1),
+	mStreamInput(false),
+	mExtractFilter(),
+	mExtractArchive(),
 	mProccessExtendedHeader(false),
 	mRootPfs(),
 	mExtractInfo()
@@ -42,7 +50,12 @@ void GameCardProcess::setInputFile(const fnd::SharedPtr<fnd::IFile>& file)
 	mFile = file;
 }
 
-void GameCardProcess::setKeyCfg(const KeyConfiguration& keycfg)
+void GameCardProcess::setInputFileFactory(const IFileFactory& factory)
+{
+	mFileFactory = factory;
+}
+
+void GameCardProcess::setKeyCfg(const std::shared_ptr<const KeyConfiguration>& keycfg)
 {
 	mKeyCfg = keycfg;
 }
@@ -67,6 +80,26 @@ void GameCardProcess::setListFs(bool list_fs)
 	mListFs = list_fs;
 }
 
+void GameCardProcess::setThreadNum(size_t thread_num)
+{
+	mThreadNum = thread_num;
+}
+
+void GameCardProcess::setStreamInput(bool stream_input)
+{
+	mStreamInput = stream_input;
+}
+
+void GameCardProcess::setExtractFilter(const std::shared_ptr<const PathFilter>& filter)
+{
+	mExtractFilter = filter;
+}
+
+void GameCardProcess::setExtractArchive(const std::shared_ptr<TarWriter>& archive)
+{
+	mExtractArchive = archive;
+}
+
 void GameCardProcess::importHeader()
 {
 	fnd::Vec<byte_t> scratch;
@@ -108,7 +141,7 @@ void GameCardProcess::importHeader()
 	
 	// decrypt extended header
 	fnd::aes::sAes128Key header_key;
-	if (mKeyCfg.getXciHeaderKey(header_key))
+	if (mKeyCfg->getXciHeaderKey(header_key))
 	{
 		nn::hac::GameCardUtil::decryptXciHeader(&hdr_ptr->header, header_key.key);
 		mProccessExtendedHeader = true;
@@ -237,7 +270,7 @@ void GameCardProcess::validateXciSignature()
 {
 	fnd::rsa::sRsa2048Key header_sign_key;
 
-	mKeyCfg.getXciHeaderSignKey(header_sign_key);
+	mKeyCfg->getXciHeaderSignKey(header_sign_key);
 	if (fnd::rsa::pkcs::rsaVerify(header_sign_key, fnd::sha::HASH_SHA256, mHdrHash.bytes, mHdrSignature) != 0)
 	{
 		std::cout << "[WARNING] GameCard Header Signature: FAIL" << std::endl;
@@ -250,19 +283,30 @@ void GameCardProcess::processRootPfs()
 	{
 		std::cout << "[WARNING] GameCard Root HFS0: FAIL (bad hash)" << std::endl;
 	}
-	mRootPfs.setInputFile(new fnd::OffsetAdjustedIFile(mFile, mHdr.getPartitionFsAddress(), mHdr.getPartitionFsSize()));
+	mRootPfs.setInputFile(MemoryMappedFile::createOffsetAdjustedIFile(mFile, mHdr.getPartitionFsAddress(), mHdr.getPartitionFsSize()));
 	mRootPfs.setListFs(mListFs);
 	mRootPfs.setVerifyMode(false);
 	mRootPfs.setCliOutputMode(mCliOutputMode);
 	mRootPfs.setMountPointName(kXciMountPointName);
+	mRootPfs.setStreamInput(mStreamInput);
 	mRootPfs.process();
 }
 
 void GameCardProcess::processPartitionPfs()
 {
 	const fnd::List<nn::hac::PartitionFsHeader::sFile>& rootPartitions = mRootPfs.getPfsHeader().getFileList();
-	for (size_t i = 0; i < rootPartitions.size(); i++)
+
+	// a stream can only be read forwards, so the partitions are processed in the order they are stored
+	std::vector<size_t> partition_order(rootPartitions.size());
+	for (size_t i = 0; i < partition_order.size(); i++)
+		partition_order[i] = i;
+	if (mStreamInput)
+		std::stable_sort(partition_order.begin(), partition_order.end(), [&rootPartitions](size_t a, size_t b) { return rootPartitions[a].offset < rootPartitions[b].offset; });
+
+	for (size_t j = 0; j < partition_order.size(); j++)
 	{
+		size_t i = partition_order[j];
+
 		// this must be validated here because only the size of the root partiton header is known at verification time
 		if (mVerify && validateRegionOfFile(mHdr.getPartitionFsAddress() + rootPartitions[i].offset, rootPartitions[i].hash_protected_size, rootPartitions[i].hash.bytes) == false)
 		{
@@ -270,13 +314,24 @@ void GameCardProcess::processPartitionPfs()
 		}
 
 		PfsProcess tmp;
-		tmp.setInputFile(new fnd::OffsetAdjustedIFile(mFile, mHdr.getPartitionFsAddress() + rootPartitions[i].offset, rootPartitions[i].size));
+		tmp.setInputFile(MemoryMappedFile::createOffsetAdjustedIFile(mFile, mHdr.getPartitionFsAddress() + rootPartitions[i].offset, rootPartitions[i].size));
 		tmp.setListFs(mListFs);
 		tmp.setVerifyMode(mVerify);
 		tmp.setCliOutputMode(mCliOutputMode);
 		tmp.setMountPointName(kXciMountPointName + rootPartitions[i].name);
 		if (mExtractInfo.hasElement<std::string>(rootPartitions[i].name))
 			tmp.setExtractPath(mExtractInfo.getElement<std::string>(rootPartitions[i].name).extract_path);
+		if (mFileFactory != nullptr)
+		{
+			IFileFactory file_factory = mFileFactory;
+			size_t partition_offset = mHdr.getPartitionFsAddress() + rootPartitions[i].offset;
+			size_t partition_size = rootPartitions[i].size;
+			tmp.setInputFileFactory([file_factory, partition_offset, partition_size]() -> fnd::SharedPtr<fnd::IFile> { return MemoryMappedFile::createOffsetAdjustedIFile(file_factory(), partition_offset, partition_size); });
+		}
+		tmp.setThreadNum(mThreadNum);
+		tmp.setStreamInput(mStreamInput);
+		tmp.setExtractFilter(mExtractFilter);
+		tmp.setExtractArchive(mExtractArchive);
 	
 		tmp.process();
 	}
@@ -19,23 +19,33 @@ public:
 
 	// generic
 	void setInputFile(const fnd::SharedPtr<fnd::IFile>& file);
-	void setKeyCfg(const KeyConfiguration& keycfg);
+	void setInputFileFactory(const IFileFactory& factory);
+	void setKeyCfg(const std::shared_ptr<const KeyConfiguration>& keycfg);
 	void setCliOutputMode(CliOutputMode type);
 	void setVerifyMode(bool verify);
 
 	// xci specific
 	void setPartitionForExtract(const std::string& partition_name, const std::string& extract_path);
 	void setListFs(bool list_fs);
+	void setThreadNum(size_t thread_num);
+	void setStreamInput(bool stream_input);
+	void setExtractFilter(const std::shared_ptr<const PathFilter>& filter);
+	void setExtractArchive(const std::shared_ptr<TarWriter>& archive);
 
 private:
 	const std::string kModuleName = "GameCardProcess";
 	const std::string kXciMountPointName = "gamecard:/";
 
 	fnd::SharedPtr<fnd::IFile> mFile;
-	KeyConfiguration mKeyCfg;
+	IFileFactory mFileFactory;
+	std::shared_ptr<const KeyConfiguration> mKeyCfg;
 	CliOutputMode mCliOutputMode;
 	bool mVerify;
 	bool mListFs;
+	size_t mThreadNum;
+	bool mStreamInput;
+	std::shared_ptr<const PathFilter> mExtractFilter;
+	std::shared_ptr<TarWriter> mExtractArchive;
 
 	struct sExtractInfo
 	{
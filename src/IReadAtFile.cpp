@@ -0,0 +1,24 @@
+#include "IReadAtFile.h"
+#include <mutex>
+
+// recursive, as a reader without readAt() may wrap another
+static std::recursive_mutex sSeekReadLock;
+
+void IReadAtFile::readFileAt(fnd::IFile& file, byte_t* out, size_t offset, size_t len)
+{
+	IReadAtFile* read_at_file = dynamic_cast<IReadAtFile*>(&file);
+	if (read_at_file != nullptr)
+	{
+		read_at_file->readAt(out, offset, len);
+		return;
+	}
+
+	std::lock_guard<std::recursive_mutex> lock(sSeekReadLock);
+	file.read(out, offset, len);
+}
+
+uint64_t IReadAtFile::getFileStorageOrder(fnd::IFile& file, size_t offset)
+{
+	IReadAtFile* read_at_file = dynamic_cast<IReadAtFile*>(&file);
+	return read_at_file != nullptr ? read_at_file->getStorageOrder(offset) : offset;
+}
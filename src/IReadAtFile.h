@@ -0,0 +1,22 @@
+#pragma once
+#include <fnd/types.h>
+#include <fnd/IFile.h>
+
+// reader that can also be read at an offset without using the seek position (like pread()), readAt() may be called from any number of threads at once,
+// so one reader stack can be shared between threads. seek() and read() are unchanged, and are for one thread at a time
+class IReadAtFile : public fnd::IFile
+{
+public:
+	virtual void readAt(byte_t* out, size_t offset, size_t len) = 0;
+
+	// key that orders offsets of this reader by where their data is stored, readers that map offsets to another reader resolve them through it,
+	// so reading in key order is one sweep through each underlying file (even where a patch relocates data between the base and patch partitions)
+	virtual uint64_t getStorageOrder(size_t offset) { return offset; }
+
+	// reads from file with readAt() if it is an IReadAtFile, otherwise with seek() and read() while holding a lock shared by all such files,
+	// so readers without readAt() (streams, fnd readers) are safe to share between threads, but are only read by one thread at a time
+	static void readFileAt(fnd::IFile& file, byte_t* out, size_t offset, size_t len);
+
+	// getStorageOrder() if file is an IReadAtFile, otherwise offset
+	static uint64_t getFileStorageOrder(fnd::IFile& file, size_t offset);
+};
@@ -0,0 +1,92 @@
+#include "IndirectIFile.h"
+#include <sstream>
+#include <limits>
+
+IndirectIFile::IndirectIFile(const fnd::SharedPtr<fnd::IFile>& base_file, const fnd::SharedPtr<fnd::IFile>& patch_file, const fnd::SharedPtr<BucketTree>& relocation_tree) :
+	mOffset(0),
+	mRelocationTree(relocation_tree)
+{
+	mStorage[STORAGE_BASE] = base_file;
+	mStorage[STORAGE_PATCH] = patch_file;
+}
+
+size_t IndirectIFile::size()
+{
+	return (*mRelocationTree)->getEndOffset();
+}
+
+void IndirectIFile::seek(size_t offset)
+{
+	mOffset = offset;
+}
+
+void IndirectIFile::read(byte_t* out, size_t len)
+{
+	readAt(out, mOffset, len);
+	mOffset += len;
+}
+
+void IndirectIFile::read(byte_t* out, size_t offset, size_t len)
+{
+	seek(offset);
+	read(out, len);
+}
+
+void IndirectIFile::readAt(byte_t* out, size_t offset, size_t len)
+{
+	// the relocation is looked up once per call and kept for the rest of it, so there is no state shared between calls
+	sEntry entry;
+	uint64_t entry_begin = 0;
+	uint64_t entry_end = 0;
+
+	while (len > 0)
+	{
+		if (offset < entry_begin || offset >= entry_end)
+		{
+			(*mRelocationTree)->find(offset, (byte_t*)&entry, entry_begin, entry_end);
+
+			if (entry.storage_index.get() != STORAGE_BASE && entry.storage_index.get() != STORAGE_PATCH)
+			{
+				std::stringstream error;
+				error << "Relocation at offset 0x" << std::hex << entry_begin << " has an invalid storage index (" << std::dec << entry.storage_index.get() << ")";
+				throw fnd::Exception(kModuleName, error.str());
+			}
+		}
+
+		size_t chunk_len = _MIN(len, entry_end - offset);
+		readFileAt(**mStorage[entry.storage_index.get()], out, entry.physical_offset.get() + (offset - entry_begin), chunk_len);
+
+		out += chunk_len;
+		len -= chunk_len;
+		offset += chunk_len;
+	}
+}
+
+uint64_t IndirectIFile::getStorageOrder(size_t offset)
+{
+	// the end of the view has no storage, it is ordered after everything else
+	if (offset >= size())
+		return std::numeric_limits<uint64_t>::max();
+
+	sEntry entry;
+	uint64_t entry_begin = 0;
+	uint64_t entry_end = 0;
+	(*mRelocationTree)->find(offset, (byte_t*)&entry, entry_begin, entry_end);
+	if (entry.storage_index.get() != STORAGE_BASE && entry.storage_index.get() != STORAGE_PATCH)
+	{
+		return std::numeric_limits<uint64_t>::max();
+	}
+
+	// the base and patch partitions are separate files, so the data in the base partition is ordered before the data in the patch partition
+	return ((uint64_t)entry.storage_index.get() << 63) | getFileStorageOrder(**mStorage[entry.storage_index.get()], entry.physical_offset.get() + (offset - entry_begin));
+}
+
+void IndirectIFile::write(const byte_t* out, size_t len)
+{
+	throw fnd::Exception(kModuleName, "write() not supported");
+}
+
+void IndirectIFile::write(const byte_t* out, size_t offset, size_t len)
+{
+	throw fnd::Exception(kModuleName, "write() not supported");
+}
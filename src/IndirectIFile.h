@@ -0,0 +1,43 @@
+#pragma once
+#include <string>
+#include <fnd/IFile.h>
+#include <fnd/SharedPtr.h>
+#include "BucketTree.h"
+#include "IReadAtFile.h"
+
+// patched view of a partition, where each range of the view is relocated to either the base or the patch partition by the indirect bucket tree
+class IndirectIFile : public IReadAtFile
+{
+public:
+#pragma pack(push,1)
+	struct sEntry
+	{
+		le_uint64_t virtual_offset;
+		le_uint64_t physical_offset;
+		le_uint32_t storage_index; // StorageIndex
+	};
+#pragma pack(pop)
+
+	enum StorageIndex
+	{
+		STORAGE_BASE,
+		STORAGE_PATCH
+	};
+
+	IndirectIFile(const fnd::SharedPtr<fnd::IFile>& base_file, const fnd::SharedPtr<fnd::IFile>& patch_file, const fnd::SharedPtr<BucketTree>& relocation_tree);
+
+	size_t size();
+	void seek(size_t offset);
+	void read(byte_t* out, size_t len);
+	void read(byte_t* out, size_t offset, size_t len);
+	void readAt(byte_t* out, size_t offset, size_t len);
+	uint64_t getStorageOrder(size_t offset);
+	void write(const byte_t* out, size_t len);
+	void write(const byte_t* out, size_t offset, size_t len);
+private:
+	const std::string kModuleName = "IndirectIFile";
+
+	fnd::SharedPtr<fnd::IFile> mStorage[2];
+	size_t mOffset;
+	fnd::SharedPtr<BucketTree> mRelocationTree;
+};
@@ -3,9 +3,10 @@
 #include <fnd/io.h>
 #include <fnd/SimpleFile.h>
 #include <fnd/SimpleTextOutput.h>
-#include <fnd/OffsetAdjustedIFile.h>
 #include <fnd/Vec.h>
 #include "IniProcess.h"
+#include "MemoryMappedFile.h"
+#include "ExtractUtil.h"
 #include "KipProcess.h"
 
 
@@ -90,7 +91,7 @@ void IniProcess::importKipList()
 		(*mFile)->read(hdr_raw.data(), kip_pos, hdr_raw.size());
 		hdr.fromBytes(hdr_raw.data(), hdr_raw.size());		
 		kip_size = getKipSizeFromHeader(hdr);
-		mKipList.addElement(new fnd::OffsetAdjustedIFile(mFile, kip_pos, kip_size));
+		mKipList.addElement(MemoryMappedFile::createOffsetAdjustedIFile(mFile, kip_pos, kip_size));
 		kip_pos += kip_size;
 	}
 }
@@ -129,38 +130,27 @@ void IniProcess::extractKipList()
 	fnd::io::makeDirectory(mKipExtractPath);
 
 	
-	// outfile object for writing KIP
-	fnd::SimpleFile out_file;
 	std::string out_path;
 	size_t out_size;
 
 	for (size_t i = 0; i < mKipList.size(); i++)
 	{
 		// read header
-		(*mKipList[i])->read(cache.data(), 0, cache.size());
-		hdr.fromBytes(cache.data(), cache.size());		
+		(*mKipList[i])->read(cache.data(), 0, sizeof(nn::hac::sKipHeader));
+		hdr.fromBytes(cache.data(), sizeof(nn::hac::sKipHeader));
 
 		// generate path
 		out_path.clear();
 		fnd::io::appendToPath(out_path, mKipExtractPath);
 		fnd::io::appendToPath(out_path, hdr.getName() + kKipExtention);
 
-		// open file
-		out_file.open(out_path, fnd::SimpleFile::Create);
-
 		// get kip file size
 		out_size = (*mKipList[i])->size();
 		// extract kip
 		if (_HAS_BIT(mCliOutputMode, OUTPUT_BASIC))
 			printf("extract=[%s]\n", out_path.c_str());
 
-		(*mKipList[i])->seek(0);
-		for (size_t j = 0; j < ((out_size / kCacheSize) + ((out_size % kCacheSize) != 0)); j++)
-		{
-			(*mKipList[i])->read(cache.data(), _MIN(out_size - (kCacheSize * j), kCacheSize));
-			out_file.write(cache.data(), _MIN(out_size - (kCacheSize * j), kCacheSize));
-		}			
-		out_file.close();
+		ExtractUtil::extractFile(**mKipList[i], 0, out_size, out_path, cache);
 	}
 }
 
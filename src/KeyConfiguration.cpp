@@ -1,7 +1,16 @@
 #include "KeyConfiguration.h"
 #include <fnd/ResourceFileReader.h>
 #include <fnd/SimpleTextOutput.h>
+#include <fnd/SimpleFile.h>
 #include <nn/hac/AesKeygen.h>
+#include <nn/hac/ContentArchiveUtil.h>
+#include "DirectoryUtil.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
 
 KeyConfiguration::KeyConfiguration()
 {
@@ -9,38 +18,10 @@ KeyConfiguration::KeyConfiguration()
 	clearNcaExternalKeys();
 }
 
-KeyConfiguration::KeyConfiguration(const KeyConfiguration& other)
+const std::shared_ptr<const KeyConfiguration>& KeyConfiguration::getEmptyKeyCfg()
 {
-	*this = other;
-}
-
-void KeyConfiguration::operator=(const KeyConfiguration& other)
-{
-	mPkg2SignKey = other.mPkg2SignKey;
-	mXciHeaderSignKey = other.mXciHeaderSignKey;
-
-	mContentArchiveHeaderKey = other.mContentArchiveHeaderKey;
-	mXciHeaderKey = other.mXciHeaderKey;
-
-	for (size_t i = 0; i < kMasterKeyNum; i++)
-	{
-		mAcidSignKey[i] = other.mAcidSignKey[i];
-		mContentArchiveHeader0SignKey[i] = other.mContentArchiveHeader0SignKey[i];
-		mNrrCertificateSignKey[i] = other.mNrrCertificateSignKey[i];
-		mPkg2Key[i] = other.mPkg2Key[i];
-		mPkg1Key[i] = other.mPkg1Key[i];
-		mNcaKeyAreaEncryptionKey[0][i] = other.mNcaKeyAreaEncryptionKey[0][i];
-		mNcaKeyAreaEncryptionKey[1][i] = other.mNcaKeyAreaEncryptionKey[1][i];
-		mNcaKeyAreaEncryptionKey[2][i] = other.mNcaKeyAreaEncryptionKey[2][i];
-		mNcaKeyAreaEncryptionKeyHw[0][i] = other.mNcaKeyAreaEncryptionKeyHw[0][i];
-		mNcaKeyAreaEncryptionKeyHw[1][i] = other.mNcaKeyAreaEncryptionKeyHw[1][i];
-		mNcaKeyAreaEncryptionKeyHw[2][i] = other.mNcaKeyAreaEncryptionKeyHw[2][i];
-		mETicketCommonKey[i] = other.mETicketCommonKey[i];
-	}
-
-	mPkiRootKeyList = other.mPkiRootKeyList;
-	
-	mNcaExternalContentKeyList = other.mNcaExternalContentKeyList;
+	static const std::shared_ptr<const KeyConfiguration> empty_keycfg = std::make_shared<KeyConfiguration>();
+	return empty_keycfg;
 }
 
 void KeyConfiguration::importHactoolGenericKeyfile(const std::string& path)
@@ -202,6 +183,131 @@ void KeyConfiguration::importHactoolGenericKeyfile(const std::string& path)
 	}
 }
 
+void KeyConfiguration::importHactoolGenericKeyfile(const std::string& path, const std::string& cache_path)
+{
+	fnd::Vec<byte_t> keyfile;
+	fnd::sha::sSha256Hash source_hash;
+
+	// the cache stores the hash of the keyfile it was generated from, so changes to the keyfile can be detected
+	try
+	{
+		fnd::SimpleFile file(path, fnd::SimpleFile::Read);
+		keyfile.alloc(file.size());
+		file.read(keyfile.data(), keyfile.size());
+	}
+	catch (const fnd::Exception&)
+	{
+		throw fnd::Exception(kModuleName, "Failed to open key file: " + path);
+	}
+	fnd::sha::Sha256(keyfile.data(), keyfile.size(), source_hash.bytes);
+
+	if (importKeyCache(cache_path, source_hash))
+		return;
+
+	importHactoolGenericKeyfile(path);
+	exportKeyCache(cache_path, source_hash);
+}
+
+void KeyConfiguration::importHactoolTitleKeyfile(const std::string& path)
+{
+	fnd::Vec<byte_t> keyfile;
+
+	try
+	{
+		fnd::SimpleFile file(path, fnd::SimpleFile::Read);
+		keyfile.alloc(file.size());
+		file.read(keyfile.data(), keyfile.size());
+	}
+	catch (const fnd::Exception&)
+	{
+		throw fnd::Exception(kModuleName, "Failed to open title key file: " + path);
+	}
+
+	const char* str = (const char*)keyfile.data();
+	size_t str_len = keyfile.size();
+
+	// each line is 66 characters or more, so this reserves enough buckets to never rehash during import
+	mNcaExternalContentKeyMap.reserve(mNcaExternalContentKeyMap.size() + str_len / 66 + 1);
+
+	// each line is "<rights id> = <encrypted title key>" in hex, blank lines and comments are skipped
+	size_t line_num = 0;
+	for (size_t line_start = 0; line_start < str_len; )
+	{
+		size_t line_end = line_start;
+		while (line_end < str_len && str[line_end] != '\n')
+			line_end++;
+		line_num++;
+
+		size_t pos = skipWhitespace(str, line_start, line_end);
+		if (pos < line_end && str[pos] != '#' && str[pos] != ';')
+		{
+			byte_t rights_id[nn::hac::nca::kRightsIdLen];
+			byte_t enc_title_key[fnd::aes::kAes128KeySize];
+
+			bool valid = decodeHexString(str, pos, line_end, rights_id, sizeof(rights_id));
+			pos = skipWhitespace(str, pos, line_end);
+			valid = valid && pos < line_end && str[pos++] == '=';
+			pos = skipWhitespace(str, pos, line_end);
+			valid = valid && decodeHexString(str, pos, line_end, enc_title_key, sizeof(enc_title_key));
+			pos = skipWhitespace(str, pos, line_end);
+			if (valid == false || pos != line_end)
+			{
+				throw fnd::Exception(kModuleName, "Title key file has an invalid entry (line: " + std::to_string(line_num) + ")");
+			}
+
+			// title keys that cannot be decrypted (the common key is not available) are skipped
+			fnd::aes::sAes128Key title_key;
+			if (decryptTitleKey(enc_title_key, rights_id[nn::hac::nca::kRightsIdLen - 1], title_key))
+				addNcaExternalContentKey(rights_id, title_key);
+		}
+
+		line_start = line_end + 1;
+	}
+}
+
+void KeyConfiguration::importTicket(const byte_t* data, size_t size)
+{
+	nn::pki::SignedData<nn::es::TicketBody_V2> tik;
+	fnd::aes::sAes128Key title_key;
+
+	tik.fromBytes(data, size);
+
+	// personalised title keys can only be decrypted by the console they were issued to
+	if (tik.getBody().getTitleKeyEncType() != nn::es::ticket::AES128_CBC)
+		return;
+
+	if (decryptTitleKey(tik.getBody().getEncTitleKey(), tik.getBody().getCommonKeyId(), title_key))
+		addNcaExternalContentKey(tik.getBody().getRightsId(), title_key);
+}
+
+void KeyConfiguration::importTicketDirectory(const std::string& path)
+{
+	std::vector<std::string> file_list;
+	fnd::Vec<byte_t> tik_raw;
+
+	DirectoryUtil::getFileList(path, file_list);
+	mNcaExternalContentKeyMap.reserve(mNcaExternalContentKeyMap.size() + file_list.size());
+
+	for (size_t i = 0; i < file_list.size(); i++)
+	{
+		if (file_list[i].length() < kTicketExtension.length() || file_list[i].compare(file_list[i].length() - kTicketExtension.length(), kTicketExtension.length(), kTicketExtension) != 0)
+			continue;
+
+		// tickets that cannot be read or parsed are skipped, so one bad ticket does not prevent the rest from being imported
+		try
+		{
+			fnd::SimpleFile tik_file(file_list[i], fnd::SimpleFile::Read);
+			tik_raw.alloc(tik_file.size());
+			tik_file.read(tik_raw.data(), tik_raw.size());
+
+			importTicket(tik_raw.data(), tik_raw.size());
+		}
+		catch (const fnd::Exception&)
+		{
+			continue;
+		}
+	}
+}
 
 void KeyConfiguration::clearGeneralKeyConfiguration()
 {
@@ -232,7 +338,7 @@ void KeyConfiguration::clearGeneralKeyConfiguration()
 
 void KeyConfiguration::clearNcaExternalKeys()
 {
-	mNcaExternalContentKeyList.clear();
+	mNcaExternalContentKeyMap.clear();
 }
 
 bool KeyConfiguration::getContentArchiveHeaderKey(fnd::aes::sAesXts128Key& key) const
@@ -282,33 +388,24 @@ bool KeyConfiguration::getNcaKeyAreaEncryptionKeyHw(byte_t masterkey_index, byte
 
 void KeyConfiguration::addNcaExternalContentKey(const byte_t rights_id[nn::hac::nca::kRightsIdLen], const fnd::aes::sAes128Key& key)
 {
-	sNcaExternalContentKey tmp;
-	memcpy(tmp.rights_id.data, rights_id, nn::hac::nca::kRightsIdLen);
-	tmp.key = key;
-
-	if (mNcaExternalContentKeyList.hasElement(tmp))
-		return;
+	sRightsId id;
+	memcpy(id.data, rights_id, nn::hac::nca::kRightsIdLen);
 
-	mNcaExternalContentKeyList.addElement(tmp);
+	// the first key added for a rights id is kept
+	mNcaExternalContentKeyMap.insert(std::make_pair(id, key));
 }
 
 bool KeyConfiguration::getNcaExternalContentKey(const byte_t rights_id[nn::hac::nca::kRightsIdLen], fnd::aes::sAes128Key& key) const
 {
 	sRightsId id;
-	bool res_exists = false;
-
 	memcpy(id.data, rights_id, nn::hac::nca::kRightsIdLen);
-	for (size_t i = 0; i < mNcaExternalContentKeyList.size(); i++)
-	{
-		if (mNcaExternalContentKeyList[i].rights_id == id)
-		{
-			res_exists = true;
-			key = mNcaExternalContentKeyList[i].key;
-			break;
-		}
-	}
 
-	return res_exists;
+	std::unordered_map<sRightsId, fnd::aes::sAes128Key, sRightsIdHash>::const_iterator itr = mNcaExternalContentKeyMap.find(id);
+	if (itr == mNcaExternalContentKeyMap.end())
+		return false;
+
+	key = itr->second;
+	return true;
 }
 
 bool KeyConfiguration::getNrrCertificateSignKey(fnd::rsa::sRsa2048Key& key, byte_t key_generation) const
@@ -410,4 +507,205 @@ bool KeyConfiguration::getPkiRootSignKey(const std::string& root_name, fnd::ecds
 	}
 
 	return res_exists;
-}
\ No newline at end of file
+}
+
+bool KeyConfiguration::decryptTitleKey(const byte_t enc_title_key[fnd::aes::kAes128KeySize], byte_t key_generation, fnd::aes::sAes128Key& title_key) const
+{
+	fnd::aes::sAes128Key common_key;
+
+	if (getETicketCommonKey(nn::hac::ContentArchiveUtil::getMasterKeyRevisionFromKeyGeneration(key_generation), common_key) == false)
+		return false;
+
+	nn::hac::AesKeygen::generateKey(title_key.key, enc_title_key, common_key.key);
+	return true;
+}
+
+size_t KeyConfiguration::skipWhitespace(const char* str, size_t pos, size_t end)
+{
+	while (pos < end && (str[pos] == ' ' || str[pos] == '\t' || str[pos] == '\r'))
+		pos++;
+	return pos;
+}
+
+bool KeyConfiguration::decodeHexString(const char* str, size_t& pos, size_t end, byte_t* out, size_t out_len)
+{
+	if (end - pos < out_len * 2)
+		return false;
+
+	for (size_t i = 0; i < out_len * 2; i++)
+	{
+		char c = str[pos + i];
+		byte_t nibble;
+		if (c >= '0' && c <= '9')
+			nibble = c - '0';
+		else if (c >= 'a' && c <= 'f')
+			nibble = c - 'a' + 0xa;
+		else if (c >= 'A' && c <= 'F')
+			nibble = c - 'A' + 0xa;
+		else
+			return false;
+
+		out[i / 2] = (i % 2) == 0 ? (nibble << 4) : (out[i / 2] | nibble);
+	}
+	pos += out_len * 2;
+
+	return true;
+}
+
+// general key config members stored in the keyset cache (in order), these are all plain byte arrays
+#define _KEY_CACHE_MEMBERS(_MEMBER) \
+	_MEMBER(mAcidSignKey) \
+	_MEMBER(mPkg1Key) \
+	_MEMBER(mPkg2SignKey) \
+	_MEMBER(mPkg2Key) \
+	_MEMBER(mContentArchiveHeader0SignKey) \
+	_MEMBER(mContentArchiveHeaderKey) \
+	_MEMBER(mNcaKeyAreaEncryptionKey) \
+	_MEMBER(mNcaKeyAreaEncryptionKeyHw) \
+	_MEMBER(mNrrCertificateSignKey) \
+	_MEMBER(mXciHeaderSignKey) \
+	_MEMBER(mXciHeaderKey) \
+	_MEMBER(mETicketCommonKey)
+
+size_t KeyConfiguration::getKeyCacheBodySize(size_t pki_root_key_num) const
+{
+	size_t body_size = 0;
+
+#define _MEMBER_SIZE(member) body_size += sizeof(member);
+	_KEY_CACHE_MEMBERS(_MEMBER_SIZE)
+#undef _MEMBER_SIZE
+
+	body_size += pki_root_key_num * (kPkiRootNameLen + sizeof(le_uint32_t) + sizeof(fnd::rsa::sRsa4096Key) + sizeof(fnd::rsa::sRsa2048Key) + sizeof(fnd::ecdsa::sEcdsa240Key));
+
+	return body_size;
+}
+
+bool KeyConfiguration::importKeyCache(const std::string& cache_path, const fnd::sha::sSha256Hash& source_hash)
+{
+	fnd::Vec<byte_t> cache;
+
+	// a missing or unreadable cache is regenerated
+	try
+	{
+		fnd::SimpleFile file(cache_path, fnd::SimpleFile::Read);
+		cache.alloc(file.size());
+		file.read(cache.data(), cache.size());
+	}
+	catch (const fnd::Exception&)
+	{
+		return false;
+	}
+
+	if (cache.size() < sizeof(sKeyCacheHeader))
+		return false;
+
+	// the cache is only used if it was generated from this keyfile, in this format and was completely written
+	const sKeyCacheHeader* hdr = (const sKeyCacheHeader*)cache.data();
+	if (memcmp(hdr->st_magic, kKeyCacheMagic.c_str(), sizeof(hdr->st_magic)) != 0 \
+		|| hdr->format_version.get() != kKeyCacheFormatVersion \
+		|| memcmp(hdr->source_hash, source_hash.bytes, fnd::sha::kSha256HashLen) != 0 \
+		|| hdr->body_size.get() != getKeyCacheBodySize(hdr->pki_root_key_num.get()) \
+		|| cache.size() != sizeof(sKeyCacheHeader) + hdr->body_size.get())
+	{
+		return false;
+	}
+
+	clearGeneralKeyConfiguration();
+
+	const byte_t* pos = cache.data() + sizeof(sKeyCacheHeader);
+
+#define _IMPORT_MEMBER(member) memcpy((byte_t*)&member, pos, sizeof(member)); pos += sizeof(member);
+	_KEY_CACHE_MEMBERS(_IMPORT_MEMBER)
+#undef _IMPORT_MEMBER
+
+	for (size_t i = 0; i < hdr->pki_root_key_num.get(); i++)
+	{
+		sPkiRootKey tmp;
+
+		tmp.name = std::string((const char*)pos, strnlen((const char*)pos, kPkiRootNameLen));
+		pos += kPkiRootNameLen;
+		tmp.key_type = (nn::pki::sign::SignatureAlgo)((const le_uint32_t*)pos)->get();
+		pos += sizeof(le_uint32_t);
+		memcpy((byte_t*)&tmp.rsa4096_key, pos, sizeof(tmp.rsa4096_key));
+		pos += sizeof(tmp.rsa4096_key);
+		memcpy((byte_t*)&tmp.rsa2048_key, pos, sizeof(tmp.rsa2048_key));
+		pos += sizeof(tmp.rsa2048_key);
+		memcpy((byte_t*)&tmp.ecdsa240_key, pos, sizeof(tmp.ecdsa240_key));
+		pos += sizeof(tmp.ecdsa240_key);
+
+		mPkiRootKeyList.addElement(tmp);
+	}
+
+	return true;
+}
+
+void KeyConfiguration::exportKeyCache(const std::string& cache_path, const fnd::sha::sSha256Hash& source_hash) const
+{
+	fnd::Vec<byte_t> cache;
+
+	cache.alloc(sizeof(sKeyCacheHeader) + getKeyCacheBodySize(mPkiRootKeyList.size()));
+	memset(cache.data(), 0, cache.size());
+
+	sKeyCacheHeader* hdr = (sKeyCacheHeader*)cache.data();
+	memcpy(hdr->st_magic, kKeyCacheMagic.c_str(), sizeof(hdr->st_magic));
+	hdr->format_version.set(kKeyCacheFormatVersion);
+	hdr->body_size.set((uint32_t)(cache.size() - sizeof(sKeyCacheHeader)));
+	hdr->pki_root_key_num.set((uint32_t)mPkiRootKeyList.size());
+	memcpy(hdr->source_hash, source_hash.bytes, fnd::sha::kSha256HashLen);
+
+	byte_t* pos = cache.data() + sizeof(sKeyCacheHeader);
+
+#define _EXPORT_MEMBER(member) memcpy(pos, (const byte_t*)&member, sizeof(member)); pos += sizeof(member);
+	_KEY_CACHE_MEMBERS(_EXPORT_MEMBER)
+#undef _EXPORT_MEMBER
+
+	for (size_t i = 0; i < mPkiRootKeyList.size(); i++)
+	{
+		const sPkiRootKey& key = mPkiRootKeyList[i];
+
+		memcpy(pos, key.name.c_str(), _MIN(key.name.length(), kPkiRootNameLen));
+		pos += kPkiRootNameLen;
+		((le_uint32_t*)pos)->set((uint32_t)key.key_type);
+		pos += sizeof(le_uint32_t);
+		memcpy(pos, (const byte_t*)&key.rsa4096_key, sizeof(key.rsa4096_key));
+		pos += sizeof(key.rsa4096_key);
+		memcpy(pos, (const byte_t*)&key.rsa2048_key, sizeof(key.rsa2048_key));
+		pos += sizeof(key.rsa2048_key);
+		memcpy(pos, (const byte_t*)&key.ecdsa240_key, sizeof(key.ecdsa240_key));
+		pos += sizeof(key.ecdsa240_key);
+	}
+
+	// the cache is only an optimisation, so failing to write it (e.g. read-only keyset directory) is not an error
+#ifdef _WIN32
+	try
+	{
+		fnd::SimpleFile file(cache_path, fnd::SimpleFile::Create);
+		file.write(cache.data(), cache.size());
+	}
+	catch (const fnd::Exception&)
+	{
+	}
+#else
+	// the cache holds the derived keys, so like the keyset it is only readable by its owner (an existing cache is given the same mode)
+	int fd = open(cache_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd == -1)
+		return;
+
+	bool written = fchmod(fd, S_IRUSR | S_IWUSR) == 0;
+	for (size_t pos = 0; written && pos < cache.size(); )
+	{
+		ssize_t len = write(fd, cache.data() + pos, cache.size() - pos);
+		if (len <= 0)
+			written = false;
+		else
+			pos += len;
+	}
+	close(fd);
+
+	// a partly written cache is removed, rather than being left to fail validation
+	if (written == false)
+		unlink(cache_path.c_str());
+#endif
+}
+
+#undef _KEY_CACHE_MEMBERS
@@ -1,24 +1,38 @@
 #pragma once
 #include <string>
 #include <cstring>
+#include <memory>
+#include <unordered_map>
 #include <fnd/types.h>
 #include <fnd/aes.h>
 #include <fnd/rsa.h>
 #include <fnd/ecdsa.h>
+#include <fnd/sha.h>
 #include <nn/hac/define/nca.h>
 #include <nn/pki/SignedData.h>
 #include <nn/es/TicketBody_V2.h>
 
+// once populated the key configuration is shared between processors as std::shared_ptr<const KeyConfiguration>,
+// the const interface does not modify any state so it may be used from multiple threads at once
 class KeyConfiguration
 {
 public:
 	KeyConfiguration();
-	KeyConfiguration(const KeyConfiguration& other);
+	KeyConfiguration(const KeyConfiguration& other) = delete;
 
-	void operator=(const KeyConfiguration& other);
+	void operator=(const KeyConfiguration& other) = delete;
+
+	// an empty key configuration, shared by every processor until one is set, so processors do not each allocate their own
+	static const std::shared_ptr<const KeyConfiguration>& getEmptyKeyCfg();
 
 	void importHactoolGenericKeyfile(const std::string& path);
-	//void importHactoolTitleKeyfile(const std::string& path);
+	// same as above, but the derived keys are loaded from cache_path if it was generated from the current keyfile, otherwise the cache is (re)generated
+	void importHactoolGenericKeyfile(const std::string& path, const std::string& cache_path);
+
+	// bulk title key import, the title keys are decrypted with the ticket common keys so the generic keyfile must be imported first
+	void importHactoolTitleKeyfile(const std::string& path);
+	void importTicket(const byte_t* data, size_t size);
+	void importTicketDirectory(const std::string& path);
 	
 	void clearGeneralKeyConfiguration();
 	void clearNcaExternalKeys();
@@ -94,6 +108,23 @@ private:
 	const std::string kNcaKeyAreaKeyIndexStr[kNcaKeakNum] = { "application", "ocean", "system" };	
 	const std::string kKeyIndex[kMasterKeyNum] = {"00","01","02","03","04","05","06","07","08","09","0a","0b","0c","0d","0e","0f","10","11","12","13","14","15","16","17","18","19","1a","1b","1c","1d","1e","1f"};
 
+	// binary keyset cache
+	static const uint32_t kKeyCacheFormatVersion = 1;
+	const std::string kKeyCacheMagic = "NKC0";
+
+	// title keys
+	const std::string kTicketExtension = ".tik";
+	static const size_t kPkiRootNameLen = 0x40;
+
+	struct sKeyCacheHeader
+	{
+		char st_magic[4];
+		le_uint32_t format_version;
+		le_uint32_t body_size;
+		le_uint32_t pki_root_key_num;
+		byte_t source_hash[fnd::sha::kSha256HashLen];
+	};
+
 	struct sRightsId
 	{
 		byte_t data[nn::hac::nca::kRightsIdLen];
@@ -114,26 +145,15 @@ private:
 		}
 	};
 
-	struct sNcaExternalContentKey
+	struct sRightsIdHash
 	{
-		sRightsId rights_id;
-		fnd::aes::sAes128Key key;
-
-		void operator=(const sNcaExternalContentKey& other)
+		size_t operator()(const sRightsId& id) const
 		{
-			rights_id = other.rights_id;
-			key = other.key;
-		}
-
-		bool operator==(const sNcaExternalContentKey& other) const
-		{
-			return (rights_id == other.rights_id) \
-				&& (key == other.key);
-		}
-
-		bool operator!=(const sNcaExternalContentKey& other) const
-		{
-			return !(operator==(other));
+			// rights ids are the title id followed by the key generation, so mixing both halves is enough to spread them
+			uint64_t lo, hi;
+			memcpy(&lo, id.data, sizeof(uint64_t));
+			memcpy(&hi, id.data + sizeof(uint64_t), sizeof(uint64_t));
+			return std::hash<uint64_t>()(lo ^ (hi * 0x9e3779b97f4a7c15ULL));
 		}
 	};
 
@@ -199,7 +219,14 @@ private:
 	fnd::List<sPkiRootKey> mPkiRootKeyList;
 
 	/* Nca External Keys */
-	fnd::List<sNcaExternalContentKey> mNcaExternalContentKeyList;
+	std::unordered_map<sRightsId, fnd::aes::sAes128Key, sRightsIdHash> mNcaExternalContentKeyMap;
+
+	size_t getKeyCacheBodySize(size_t pki_root_key_num) const;
+	bool decryptTitleKey(const byte_t enc_title_key[fnd::aes::kAes128KeySize], byte_t key_generation, fnd::aes::sAes128Key& title_key) const;
+	static size_t skipWhitespace(const char* str, size_t pos, size_t end);
+	static bool decodeHexString(const char* str, size_t& pos, size_t end, byte_t* out, size_t out_len);
+	bool importKeyCache(const std::string& cache_path, const fnd::sha::sSha256Hash& source_hash);
+	void exportKeyCache(const std::string& cache_path, const fnd::sha::sSha256Hash& source_hash) const;
 
 	template <class T>
 	bool copyOutKeyResourceIfExists(const T& src, T& dst, const T& null_sample) const
@@ -0,0 +1,269 @@
+#include "LayeredIntegrityIFile.h"
+#include "MemoryMappedFile.h"
+#include "Sha256Engine.h"
+#include <cstring>
+
+LayeredIntegrityIFile::LayeredIntegrityIFile(const fnd::SharedPtr<fnd::IFile>& file, const fnd::LayeredIntegrityMetadata& hdr, const std::shared_ptr<BlockCache>& block_cache) :
+	mFile(file),
+	mAlignHashCalcToBlock(false),
+	mData(),
+	mDataOffset(0),
+	mDataBlockSize(0),
+	mDataHashLayer(),
+	mCacheBlockNum(0),
+	mScratchList(),
+	mBlockCache(block_cache),
+	mLayerId()
+{
+	initialiseDataLayer(hdr);
+}
+
+size_t LayeredIntegrityIFile::size()
+{
+	return (*mData)->size();
+}
+
+void LayeredIntegrityIFile::seek(size_t offset)
+{
+	mDataOffset = offset;
+}
+
+void LayeredIntegrityIFile::read(byte_t* out, size_t len)
+{
+	readAt(out, mDataOffset, len);
+	seek(mDataOffset + len);
+}
+
+void LayeredIntegrityIFile::read(byte_t* out, size_t offset, size_t len)
+{
+	seek(offset);
+	read(out, len);
+}
+
+void LayeredIntegrityIFile::readAt(byte_t* out, size_t offset, size_t len)
+{
+	if (len == 0)
+		return;
+
+	// the scratchpad is returned to the pool after the read (a scratchpad in use when an exception is thrown is released instead)
+	std::unique_ptr<sScratch> scratch = acquireScratch();
+	fnd::Vec<byte_t>& cache = scratch->cache;
+	fnd::Vec<byte_t>& hash_cache = scratch->hash_cache;
+
+	size_t end_offset = offset + len;
+	size_t total_blk_num = getBlockNum(end_offset) - (offset / mDataBlockSize);
+	if (cache.size() < _MIN(mCacheBlockNum, total_blk_num) * mDataBlockSize)
+	{
+		cache.alloc(_MIN(mCacheBlockNum, total_blk_num) * mDataBlockSize);
+	}
+
+	while (offset < end_offset)
+	{
+		// blocks already verified by any reader of this layer are copied from the block cache
+		if (mBlockCache != nullptr)
+		{
+			size_t copied = mBlockCache->copy(mLayerId, mDataBlockSize, offset, out, end_offset - offset);
+			offset += copied;
+			out += copied;
+			if (offset == end_offset)
+				break;
+		}
+
+		// otherwise blocks are read and verified up to the next cached block (at least one, as another thread may have just cached it)
+		size_t blk_index = offset / mDataBlockSize;
+		size_t blk_pos = offset % mDataBlockSize;
+		size_t read_blk_num = _MIN(mCacheBlockNum, getBlockNum(end_offset) - blk_index);
+		if (mBlockCache != nullptr)
+		{
+			size_t uncached_blk_num = mBlockCache->getUncachedBlockNum(mLayerId, blk_index, read_blk_num);
+			read_blk_num = _MAX(1, uncached_blk_num);
+		}
+
+		readData(blk_index, read_blk_num, cache, hash_cache);
+
+		// the last block is cached with its zero padding, so it reads the same as when it is verified
+		if (mBlockCache != nullptr)
+			mBlockCache->add(mLayerId, blk_index, cache.data(), mDataBlockSize, read_blk_num);
+
+		size_t export_len = _MIN(end_offset - offset, read_blk_num * mDataBlockSize - blk_pos);
+		memcpy(out, cache.data() + blk_pos, export_len);
+		offset += export_len;
+		out += export_len;
+	}
+
+	releaseScratch(std::move(scratch));
+}
+
+uint64_t LayeredIntegrityIFile::getStorageOrder(size_t offset)
+{
+	return getFileStorageOrder(**mData, offset);
+}
+
+void LayeredIntegrityIFile::write(const byte_t* out, size_t len)
+{
+	throw fnd::Exception(kModuleName, "write() not supported");
+}
+
+void LayeredIntegrityIFile::write(const byte_t* out, size_t offset, size_t len)
+{
+	throw fnd::Exception(kModuleName, "write() not supported");
+}
+
+size_t LayeredIntegrityIFile::getBlockNum(size_t size) const
+{
+	return (size / mDataBlockSize) + ((size % mDataBlockSize) != 0);
+}
+
+void LayeredIntegrityIFile::findBadBlocks(const byte_t* data, size_t block_size, size_t block_num, size_t last_block_size, const byte_t* expected_hash_list, size_t first_block_index, fnd::Vec<byte_t>& hash_cache, std::vector<size_t>& bad_block_list)
+{
+	if (block_num == 0)
+		return;
+
+	if (hash_cache.size() < block_num * fnd::sha::kSha256HashLen)
+	{
+		hash_cache.alloc(block_num * fnd::sha::kSha256HashLen);
+	}
+
+	// whole blocks are hashed as a batch, a truncated last block is hashed on its own
+	size_t batch_block_num = (last_block_size == block_size) ? block_num : block_num - 1;
+	Sha256Engine::hashBlocks(data, block_size, batch_block_num, hash_cache.data());
+	if (batch_block_num != block_num)
+	{
+		Sha256Engine::hash(data + batch_block_num * block_size, last_block_size, hash_cache.data() + batch_block_num * fnd::sha::kSha256HashLen);
+	}
+
+	for (size_t i = 0; i < block_num; i++)
+	{
+		if (memcmp(hash_cache.data() + i * fnd::sha::kSha256HashLen, expected_hash_list + i * fnd::sha::kSha256HashLen, fnd::sha::kSha256HashLen) != 0)
+		{
+			bad_block_list.push_back(first_block_index + i);
+		}
+	}
+}
+
+void LayeredIntegrityIFile::verifyBlocks(const byte_t* data, size_t block_size, size_t block_num, size_t last_block_size, const byte_t* expected_hash_list, const std::string& layer_name, size_t first_block_index, fnd::Vec<byte_t>& hash_cache) const
+{
+	std::vector<size_t> bad_block_list;
+	findBadBlocks(data, block_size, block_num, last_block_size, expected_hash_list, first_block_index, hash_cache, bad_block_list);
+	if (bad_block_list.empty() == false)
+	{
+		size_t bad_block = bad_block_list.front();
+		size_t validate_size = (bad_block + 1 == first_block_index + block_num) ? last_block_size : block_size;
+		std::stringstream error;
+		error << "Hash tree layer verification failed (layer: " << layer_name << ", block: " << bad_block << ", offset: 0x" << std::hex << (bad_block * block_size) << ", size: 0x" << std::hex << validate_size << ")";
+		throw fnd::Exception(kModuleName, error.str());
+	}
+}
+
+void LayeredIntegrityIFile::initialiseDataLayer(const fnd::LayeredIntegrityMetadata& hdr)
+{
+	fnd::Vec<byte_t> cur, prev, hash_cache;
+
+	mAlignHashCalcToBlock = hdr.getAlignHashToBlock();
+
+	// copy master hash into prev
+	prev.alloc(fnd::sha::kSha256HashLen * hdr.getMasterHashList().size());
+	for (size_t i = 0; i < hdr.getMasterHashList().size(); i++)
+	{
+		memcpy(prev.data() + i * fnd::sha::kSha256HashLen, hdr.getMasterHashList()[i].bytes, fnd::sha::kSha256HashLen);
+	}
+
+	// check each hash layer
+	for (size_t i = 0; i < hdr.getHashLayerInfo().size(); i++)
+	{
+		const fnd::LayeredIntegrityMetadata::sLayer& layer = hdr.getHashLayerInfo()[i];
+
+		// allocate layer
+		size_t block_num = (layer.size / layer.block_size) + ((layer.size % layer.block_size) != 0);
+		cur.alloc(block_num * layer.block_size);
+		memset(cur.data(), 0, cur.size());
+
+		// read layer
+		readFileAt(**mFile, cur.data(), layer.offset, layer.size);
+
+		if (prev.size() < block_num * fnd::sha::kSha256HashLen)
+		{
+			throw fnd::Exception(kModuleName, "Hash tree layer is larger than the hashes for it");
+		}
+
+		// validate blocks
+		size_t last_block_size = mAlignHashCalcToBlock ? layer.block_size : layer.size - ((block_num - 1) * layer.block_size);
+		std::stringstream layer_name;
+		layer_name << i;
+		verifyBlocks(cur.data(), layer.block_size, block_num, last_block_size, prev.data(), layer_name.str(), 0, hash_cache);
+
+		// set prev to cur
+		prev = cur;
+	}
+
+	// save last layer as hash table for data layer
+	mDataHashLayer = prev;
+
+	// generate reader for data layer
+	mData = MemoryMappedFile::createOffsetAdjustedIFile(mFile, hdr.getDataLayer().offset, hdr.getDataLayer().size);
+	mDataOffset = 0;
+	mDataBlockSize = hdr.getDataLayer().block_size;
+
+	// large enough that there are plenty of blocks to hash at once
+	mCacheBlockNum = _MAX(kMinCacheBlockNum, kCacheSize / mDataBlockSize);
+
+	// the master hash covers the whole tree, the geometry is included as it is not covered by the master hash
+	le_uint64_t layer_geometry[2];
+	layer_geometry[0].set(mDataBlockSize);
+	layer_geometry[1].set((*mData)->size());
+	fnd::Vec<byte_t> layer_id_src;
+	layer_id_src.alloc(fnd::sha::kSha256HashLen * hdr.getMasterHashList().size() + sizeof(layer_geometry));
+	for (size_t i = 0; i < hdr.getMasterHashList().size(); i++)
+	{
+		memcpy(layer_id_src.data() + i * fnd::sha::kSha256HashLen, hdr.getMasterHashList()[i].bytes, fnd::sha::kSha256HashLen);
+	}
+	memcpy(layer_id_src.data() + fnd::sha::kSha256HashLen * hdr.getMasterHashList().size(), layer_geometry, sizeof(layer_geometry));
+	Sha256Engine::hash(layer_id_src.data(), layer_id_src.size(), mLayerId.bytes);
+}
+
+std::unique_ptr<LayeredIntegrityIFile::sScratch> LayeredIntegrityIFile::acquireScratch()
+{
+	std::lock_guard<std::mutex> lock(mScratchLock);
+	if (mScratchList.empty())
+		return std::unique_ptr<sScratch>(new sScratch());
+
+	std::unique_ptr<sScratch> scratch = std::move(mScratchList.back());
+	mScratchList.pop_back();
+	return scratch;
+}
+
+void LayeredIntegrityIFile::releaseScratch(std::unique_ptr<sScratch> scratch)
+{
+	std::lock_guard<std::mutex> lock(mScratchLock);
+	mScratchList.push_back(std::move(scratch));
+}
+
+void LayeredIntegrityIFile::readData(size_t block_offset, size_t block_num, fnd::Vec<byte_t>& cache, fnd::Vec<byte_t>& hash_cache)
+{
+	size_t data_block_num = getBlockNum((*mData)->size());
+	if (block_num > mCacheBlockNum || block_num * mDataBlockSize > cache.size())
+	{
+		throw fnd::Exception(kModuleName, "Read excessive of cache size");
+	}
+	if ((block_offset + block_num) > data_block_num || (block_offset + block_num) * fnd::sha::kSha256HashLen > mDataHashLayer.size())
+	{
+		throw fnd::Exception(kModuleName, "Out of bounds file read");
+	}
+
+	// determine read size, the last block of the data layer may be truncated
+	size_t read_len = block_num * mDataBlockSize;
+	size_t last_block_size = mDataBlockSize;
+	if ((block_offset + block_num) == data_block_num)
+	{
+		read_len = ((*mData)->size() - (block_offset * mDataBlockSize));
+		memset(cache.data(), 0, block_num * mDataBlockSize);
+		if (mAlignHashCalcToBlock == false)
+			last_block_size = read_len - ((block_num - 1) * mDataBlockSize);
+	}
+
+	// read
+	readFileAt(**mData, cache.data(), block_offset * mDataBlockSize, read_len);
+
+	// validate blocks
+	verifyBlocks(cache.data(), mDataBlockSize, block_num, last_block_size, mDataHashLayer.data() + block_offset * fnd::sha::kSha256HashLen, "data", block_offset, hash_cache);
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <string>
+#include <sstream>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <fnd/IFile.h>
+#include <fnd/SharedPtr.h>
+#include <fnd/Vec.h>
+#include <fnd/LayeredIntegrityMetadata.h>
+#include "IReadAtFile.h"
+#include "BlockCache.h"
+
+// hash tree verifying reader, drop in replacement for fnd::LayeredIntegrityWrappedIFile that verifies blocks in batches using Sha256Engine
+class LayeredIntegrityIFile : public IReadAtFile
+{
+public:
+	// verified data blocks are added to block_cache (if set), and blocks found there are not read again
+	LayeredIntegrityIFile(const fnd::SharedPtr<fnd::IFile>& file, const fnd::LayeredIntegrityMetadata& hdr, const std::shared_ptr<BlockCache>& block_cache = nullptr);
+
+	size_t size();
+	void seek(size_t offset);
+	void read(byte_t* out, size_t len);
+	void read(byte_t* out, size_t offset, size_t len);
+	void readAt(byte_t* out, size_t offset, size_t len);
+	uint64_t getStorageOrder(size_t offset);
+	void write(const byte_t* out, size_t len);
+	void write(const byte_t* out, size_t offset, size_t len);
+
+	// hashes block_num blocks of block_size bytes (the last of which is hashed as last_block_size bytes) and compares them with expected_hash_list,
+	// the index (offset by first_block_index) of every block that does not match is appended to bad_block_list
+	static void findBadBlocks(const byte_t* data, size_t block_size, size_t block_num, size_t last_block_size, const byte_t* expected_hash_list, size_t first_block_index, fnd::Vec<byte_t>& hash_cache, std::vector<size_t>& bad_block_list);
+private:
+	const std::string kModuleName = "LayeredIntegrityIFile";
+	static const size_t kCacheSize = 0x100000;
+	static const size_t kMinCacheBlockNum = 0x10;
+
+	fnd::SharedPtr<fnd::IFile> mFile;
+	bool mAlignHashCalcToBlock;
+
+	// data layer
+	fnd::SharedPtr<fnd::IFile> mData;
+	size_t mDataOffset;
+	size_t mDataBlockSize;
+	fnd::Vec<byte_t> mDataHashLayer;
+
+	// blocks are verified in batches of up to this many, in a scratchpad taken from this reader's pool for the length of each read,
+	// so threads (and a read nested in another read on the same thread) never share one
+	size_t mCacheBlockNum;
+	struct sScratch
+	{
+		fnd::Vec<byte_t> cache;
+		fnd::Vec<byte_t> hash_cache;
+	};
+	std::mutex mScratchLock;
+	std::vector<std::unique_ptr<sScratch>> mScratchList;
+
+	// the data layer is identified in the block cache by a hash of the master hash and its geometry, so every reader of the same data shares its blocks
+	std::shared_ptr<BlockCache> mBlockCache;
+	fnd::sha::sSha256Hash mLayerId;
+
+	size_t getBlockNum(size_t size) const;
+	void verifyBlocks(const byte_t* data, size_t block_size, size_t block_num, size_t last_block_size, const byte_t* expected_hash_list, const std::string& layer_name, size_t first_block_index, fnd::Vec<byte_t>& hash_cache) const;
+	void initialiseDataLayer(const fnd::LayeredIntegrityMetadata& hdr);
+	void readData(size_t block_offset, size_t block_num, fnd::Vec<byte_t>& cache, fnd::Vec<byte_t>& hash_cache);
+	std::unique_ptr<sScratch> acquireScratch();
+	void releaseScratch(std::unique_ptr<sScratch> scratch);
+};
@@ -0,0 +1,222 @@
+#include "MemoryMappedFile.h"
+#include "RegionIFile.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <fnd/StringConv.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MemoryMappedFile::MemoryMappedFile(const std::string& path) :
+	mMapping(new Mapping(path)),
+	mBaseOffset(0),
+	mSize(mMapping->size()),
+	mOffset(0)
+{
+}
+
+MemoryMappedFile::MemoryMappedFile(const MemoryMappedFile& file, size_t offset, size_t size) :
+	mMapping(file.mMapping),
+	mBaseOffset(file.mBaseOffset + offset),
+	mSize(size),
+	mOffset(0)
+{
+	if (offset > file.mSize || size > file.mSize - offset)
+	{
+		throw fnd::Exception(kModuleName, "View exceeds the bounds of the mapped file");
+	}
+}
+
+size_t MemoryMappedFile::size()
+{
+	return mSize;
+}
+
+void MemoryMappedFile::seek(size_t offset)
+{
+	mOffset = std::min<size_t>(offset, mSize);
+}
+
+void MemoryMappedFile::read(byte_t* out, size_t len)
+{
+	readAt(out, mOffset, len);
+	mOffset += len;
+}
+
+void MemoryMappedFile::read(byte_t* out, size_t offset, size_t len)
+{
+	seek(offset);
+	read(out, len);
+}
+
+void MemoryMappedFile::readAt(byte_t* out, size_t offset, size_t len)
+{
+	if (offset > mSize || len > mSize - offset)
+	{
+		throw fnd::Exception(kModuleName, "Failed to read from file (read past end of file)");
+	}
+
+	memcpy(out, data() + offset, len);
+}
+
+void MemoryMappedFile::write(const byte_t* out, size_t len)
+{
+	throw fnd::Exception(kModuleName, "write() not supported");
+}
+
+void MemoryMappedFile::write(const byte_t* out, size_t offset, size_t len)
+{
+	throw fnd::Exception(kModuleName, "write() not supported");
+}
+
+const byte_t* MemoryMappedFile::data() const
+{
+	return mMapping->data() + mBaseOffset;
+}
+
+#ifndef _WIN32
+int MemoryMappedFile::getFileDescriptor() const
+{
+	return mMapping->getFileDescriptor();
+}
+
+size_t MemoryMappedFile::getFileOffset() const
+{
+	return mBaseOffset;
+}
+#endif
+
+bool MemoryMappedFile::isSupported(const std::string& path)
+{
+#ifdef _WIN32
+	DWORD attributes = GetFileAttributesW((LPCWSTR)fnd::StringConv::ConvertChar8ToChar16(path).c_str());
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE)) == 0;
+#else
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0;
+#endif
+}
+
+const byte_t* MemoryMappedFile::getMappedData(const fnd::SharedPtr<fnd::IFile>& file, size_t offset, size_t len)
+{
+	const MemoryMappedFile* mapped_file = dynamic_cast<const MemoryMappedFile*>(*file);
+
+	if (mapped_file == nullptr || offset > mapped_file->mSize || len > mapped_file->mSize - offset)
+		return nullptr;
+
+	return mapped_file->data() + offset;
+}
+
+fnd::SharedPtr<fnd::IFile> MemoryMappedFile::createOffsetAdjustedIFile(const fnd::SharedPtr<fnd::IFile>& file, size_t offset, size_t size)
+{
+	const MemoryMappedFile* mapped_file = dynamic_cast<const MemoryMappedFile*>(*file);
+
+	if (mapped_file != nullptr)
+		return new MemoryMappedFile(*mapped_file, offset, size);
+
+	return new RegionIFile(file, offset, size);
+}
+
+#ifdef _WIN32
+MemoryMappedFile::Mapping::Mapping(const std::string& path) :
+	mData(nullptr),
+	mSize(0),
+	mFileHandle(INVALID_HANDLE_VALUE),
+	mMapHandle(nullptr)
+{
+	LARGE_INTEGER file_size;
+
+	mFileHandle = CreateFileW((LPCWSTR)fnd::StringConv::ConvertChar8ToChar16(path).c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (mFileHandle == INVALID_HANDLE_VALUE)
+	{
+		throw fnd::Exception(kModuleName, "Failed to open file");
+	}
+
+	if (GetFileSizeEx(mFileHandle, &file_size) == false || file_size.QuadPart == 0)
+	{
+		CloseHandle(mFileHandle);
+		throw fnd::Exception(kModuleName, "Failed to determine file size (or file is empty)");
+	}
+	mSize = (size_t)file_size.QuadPart;
+
+	mMapHandle = CreateFileMappingW(mFileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mMapHandle == nullptr)
+	{
+		CloseHandle(mFileHandle);
+		throw fnd::Exception(kModuleName, "Failed to create file mapping");
+	}
+
+	mData = (byte_t*)MapViewOfFile(mMapHandle, FILE_MAP_READ, 0, 0, 0);
+	if (mData == nullptr)
+	{
+		CloseHandle(mMapHandle);
+		CloseHandle(mFileHandle);
+		throw fnd::Exception(kModuleName, "Failed to map file");
+	}
+}
+
+MemoryMappedFile::Mapping::~Mapping()
+{
+	UnmapViewOfFile(mData);
+	CloseHandle(mMapHandle);
+	CloseHandle(mFileHandle);
+}
+#else
+MemoryMappedFile::Mapping::Mapping(const std::string& path) :
+	mData(nullptr),
+	mSize(0),
+	mFileDescriptor(-1)
+{
+	struct stat st;
+
+	mFileDescriptor = open(path.c_str(), O_RDONLY);
+	if (mFileDescriptor == -1)
+	{
+		throw fnd::Exception(kModuleName, "Failed to open file");
+	}
+
+	if (fstat(mFileDescriptor, &st) != 0 || st.st_size == 0)
+	{
+		close(mFileDescriptor);
+		throw fnd::Exception(kModuleName, "Failed to determine file size (or file is empty)");
+	}
+	mSize = (size_t)st.st_size;
+
+	void* map = mmap(nullptr, mSize, PROT_READ, MAP_SHARED, mFileDescriptor, 0);
+	if (map == MAP_FAILED)
+	{
+		close(mFileDescriptor);
+		throw fnd::Exception(kModuleName, "Failed to map file");
+	}
+	mData = (byte_t*)map;
+}
+
+MemoryMappedFile::Mapping::~Mapping()
+{
+	munmap(mData, mSize);
+	close(mFileDescriptor);
+}
+#endif
+
+const byte_t* MemoryMappedFile::Mapping::data() const
+{
+	return mData;
+}
+
+size_t MemoryMappedFile::Mapping::size() const
+{
+	return mSize;
+}
+
+#ifndef _WIN32
+int MemoryMappedFile::Mapping::getFileDescriptor() const
+{
+	return mFileDescriptor;
+}
+#endif
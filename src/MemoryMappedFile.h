@@ -0,0 +1,74 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <fnd/types.h>
+#include <fnd/IFile.h>
+#include <fnd/SharedPtr.h>
+#include "IReadAtFile.h"
+
+class MemoryMappedFile : public IReadAtFile
+{
+public:
+	// maps the whole file read-only
+	MemoryMappedFile(const std::string& path);
+
+	// creates a view of a region of another mapped file, the mapping is shared (not copied)
+	MemoryMappedFile(const MemoryMappedFile& file, size_t offset, size_t size);
+
+	size_t size();
+	void seek(size_t offset);
+	void read(byte_t* out, size_t len);
+	void read(byte_t* out, size_t offset, size_t len);
+	void readAt(byte_t* out, size_t offset, size_t len);
+	void write(const byte_t* out, size_t len);
+	void write(const byte_t* out, size_t offset, size_t len);
+
+	// pointer to the start of this view, valid for as long as any view of the mapping exists
+	const byte_t* data() const;
+
+#ifndef _WIN32
+	// descriptor of the mapped file and the offset of this view in it, so data can be copied in-kernel
+	int getFileDescriptor() const;
+	size_t getFileOffset() const;
+#endif
+
+	// returns true if path is a regular file that can be mapped
+	static bool isSupported(const std::string& path);
+
+	// returns a pointer into the mapping if file is a mapped file and the region is in range, otherwise nullptr
+	static const byte_t* getMappedData(const fnd::SharedPtr<fnd::IFile>& file, size_t offset, size_t len);
+
+	// creates a view of the region when file is a mapped file, otherwise falls back to RegionIFile
+	static fnd::SharedPtr<fnd::IFile> createOffsetAdjustedIFile(const fnd::SharedPtr<fnd::IFile>& file, size_t offset, size_t size);
+private:
+	const std::string kModuleName = "MemoryMappedFile";
+
+	class Mapping
+	{
+	public:
+		Mapping(const std::string& path);
+		~Mapping();
+
+		const byte_t* data() const;
+		size_t size() const;
+#ifndef _WIN32
+		int getFileDescriptor() const;
+#endif
+	private:
+		const std::string kModuleName = "MemoryMappedFile";
+
+		byte_t* mData;
+		size_t mSize;
+#ifdef _WIN32
+		void* mFileHandle; // HANDLE
+		void* mMapHandle; // HANDLE
+#else
+		int mFileDescriptor;
+#endif
+	};
+
+	std::shared_ptr<Mapping> mMapping;
+	size_t mBaseOffset;
+	size_t mSize;
+	size_t mOffset;
+};
@@ -12,6 +12,7 @@
 
 MetaProcess::MetaProcess() :
 	mFile(),
+	mKeyCfg(KeyConfiguration::getEmptyKeyCfg()),
 	mCliOutputMode(_BIT(OUTPUT_BASIC)),
 	mVerify(false)
 {
@@ -54,7 +55,7 @@ void MetaProcess::setInputFile(const fnd::SharedPtr<fnd::IFile>& file)
 	mFile = file;
 }
 
-void MetaProcess::setKeyCfg(const KeyConfiguration& keycfg)
+void MetaProcess::setKeyCfg(const std::shared_ptr<const KeyConfiguration>& keycfg)
 {
 	mKeyCfg = keycfg;
 }
@@ -93,7 +94,7 @@ void MetaProcess::validateAcidSignature(const nn::hac::AccessControlInfoDesc& ac
 {
 	try {
 		fnd::rsa::sRsa2048Key acid_sign_key;
-		if (mKeyCfg.getAcidSignKey(acid_sign_key, key_generation) != true)
+		if (mKeyCfg->getAcidSignKey(acid_sign_key, key_generation) != true)
 			throw fnd::Exception();
 
 		acid.validateSignature(acid_sign_key);
@@ -16,7 +16,7 @@ public:
 	void process();
 
 	void setInputFile(const fnd::SharedPtr<fnd::IFile>& file);
-	void setKeyCfg(const KeyConfiguration& keycfg);
+	void setKeyCfg(const std::shared_ptr<const KeyConfiguration>& keycfg);
 	void setCliOutputMode(CliOutputMode type);
 	void setVerifyMode(bool verify);
 
@@ -26,7 +26,7 @@ private:
 	const std::string kModuleName = "MetaProcess";
 
 	fnd::SharedPtr<fnd::IFile> mFile;
-	KeyConfiguration mKeyCfg;
+	std::shared_ptr<const KeyConfiguration> mKeyCfg;
 	CliOutputMode mCliOutputMode;
 	bool mVerify;
 
@@ -3,15 +3,24 @@
 #include "PfsProcess.h"
 #include "RomfsProcess.h"
 #include "MetaProcess.h"
+#include "MemoryMappedFile.h"
+#include "AesCtrIFile.h"
+#include "AesXtsIFile.h"
+#include "AesCtrExIFile.h"
+#include "IndirectIFile.h"
+#include "RegionIFile.h"
+#include "LayeredIntegrityIFile.h"
+#include "ThreadPool.h"
+#include "CompressedArchiveIFile.h"
 
 #include <iostream>
 #include <iomanip>
 #include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
 
 #include <fnd/SimpleTextOutput.h>
-#include <fnd/OffsetAdjustedIFile.h>
-#include <fnd/AesCtrWrappedIFile.h>
-#include <fnd/LayeredIntegrityWrappedIFile.h>
 
 #include <nn/hac/ContentArchiveUtil.h>
 #include <nn/hac/AesKeygen.h>
@@ -20,9 +29,21 @@
 
 NcaProcess::NcaProcess() :
 	mFile(),
+	mFileFactory(),
+	mKeyCfg(KeyConfiguration::getEmptyKeyCfg()),
 	mCliOutputMode(_BIT(OUTPUT_BASIC)),
 	mVerify(false),
-	mListFs(false)
+	mVerifyFull(false),
+	mRomfsExtractFilePath(),
+	mExtractFilter(),
+	mExtractArchive(),
+	mRomfsErofsImagePath(),
+	mListFs(false),
+	mThreadNum(1),
+	mBlockCacheSize(CompressedArchiveIFile::kDefaultCacheSize),
+	mVerifiedBlockCache(),
+	mBaseFile(),
+	mBaseFileFactory()
 {
 	for (size_t i = 0; i < nn::hac::nca::kPartitionNum; i++)
 	{
@@ -49,8 +70,18 @@ void NcaProcess::process()
 	if (_HAS_BIT(mCliOutputMode, OUTPUT_BASIC))
 		displayHeader();
 
+	// verify every block of the partition hash trees
+	bool hash_trees_valid = true;
+	if (mVerifyFull)
+		hash_trees_valid = verifyPartitionHashTrees();
+
 	// process partition
 	processPartitions();
+
+	if (hash_trees_valid == false)
+	{
+		throw fnd::Exception(kModuleName, "NCA partition hash tree verification failed");
+	}
 }
 
 void NcaProcess::setInputFile(const fnd::SharedPtr<fnd::IFile>& file)
@@ -58,7 +89,12 @@ void NcaProcess::setInputFile(const fnd::SharedPtr<fnd::IFile>& file)
 	mFile = file;
 }
 
-void NcaProcess::setKeyCfg(const KeyConfiguration& keycfg)
+void NcaProcess::setInputFileFactory(const IFileFactory& factory)
+{
+	mFileFactory = factory;
+}
+
+void NcaProcess::setKeyCfg(const std::shared_ptr<const KeyConfiguration>& keycfg)
 {
 	mKeyCfg = keycfg;
 }
@@ -73,6 +109,11 @@ void NcaProcess::setVerifyMode(bool verify)
 	mVerify = verify;
 }
 
+void NcaProcess::setFullVerifyMode(bool verify_full)
+{
+	mVerifyFull = verify_full;
+}
+
 void NcaProcess::setPartition0ExtractPath(const std::string& path)
 {
 	mPartitionPath[0].path = path;
@@ -97,11 +138,56 @@ void NcaProcess::setPartition3ExtractPath(const std::string& path)
 	mPartitionPath[3].doExtract = true;
 }
 
+void NcaProcess::setRomfsExtractFilePath(const std::string& romfs_path)
+{
+	mRomfsExtractFilePath = romfs_path;
+}
+
+void NcaProcess::setExtractFilter(const std::shared_ptr<const PathFilter>& filter)
+{
+	mExtractFilter = filter;
+}
+
+void NcaProcess::setExtractArchive(const std::shared_ptr<TarWriter>& archive)
+{
+	mExtractArchive = archive;
+}
+
+void NcaProcess::setRomfsErofsImagePath(const std::string& path)
+{
+	mRomfsErofsImagePath = path;
+}
+
 void NcaProcess::setListFs(bool list_fs)
 {
 	mListFs = list_fs;
 }
 
+void NcaProcess::setThreadNum(size_t thread_num)
+{
+	mThreadNum = thread_num;
+}
+
+void NcaProcess::setBlockCacheSize(size_t size)
+{
+	mBlockCacheSize = size;
+}
+
+void NcaProcess::setVerifiedBlockCache(const std::shared_ptr<BlockCache>& block_cache)
+{
+	mVerifiedBlockCache = block_cache;
+}
+
+void NcaProcess::setBaseNcaFile(const fnd::SharedPtr<fnd::IFile>& file)
+{
+	mBaseFile = file;
+}
+
+void NcaProcess::setBaseNcaFileFactory(const IFileFactory& factory)
+{
+	mBaseFileFactory = factory;
+}
+
 void NcaProcess::importHeader()
 {
 	if (*mFile == nullptr)
@@ -114,7 +200,7 @@ void NcaProcess::importHeader()
 	
 	// decrypt header block
 	fnd::aes::sAesXts128Key header_key;
-	mKeyCfg.getContentArchiveHeaderKey(header_key);
+	mKeyCfg->getContentArchiveHeaderKey(header_key);
 	nn::hac::ContentArchiveUtil::decryptContentArchiveHeader((byte_t*)&mHdrBlock, (byte_t*)&mHdrBlock, header_key);
 
 	// generate header hash
@@ -146,13 +232,13 @@ void NcaProcess::generateNcaBodyEncryptionKeys()
 			kak.index = (byte_t)i;
 			kak.enc = key_area[i];
 			// key[0-3]
-			if (i < 4 && mKeyCfg.getNcaKeyAreaEncryptionKey(masterkey_rev, keak_index, key_area_enc_key) == true)
+			if (i < 4 && mKeyCfg->getNcaKeyAreaEncryptionKey(masterkey_rev, keak_index, key_area_enc_key) == true)
 			{
 				kak.decrypted = true;
 				nn::hac::AesKeygen::generateKey(kak.dec.key, kak.enc.key, key_area_enc_key.key);
 			}
 			// key[KEY_AESCTR_HW]
-			else if (i == nn::hac::nca::KEY_AESCTR_HW && mKeyCfg.getNcaKeyAreaEncryptionKeyHw(masterkey_rev, keak_index, key_area_enc_key) == true)
+			else if (i == nn::hac::nca::KEY_AESCTR_HW && mKeyCfg->getNcaKeyAreaEncryptionKeyHw(masterkey_rev, keak_index, key_area_enc_key) == true)
 			{
 				kak.decrypted = true;
 				nn::hac::AesKeygen::generateKey(kak.dec.key, kak.enc.key, key_area_enc_key.key);
@@ -167,19 +253,20 @@ void NcaProcess::generateNcaBodyEncryptionKeys()
 
 	// set flag to indicate that the keys are not available
 	mContentKey.aes_ctr.isSet = false;
+	mContentKey.aes_xts.isSet = false;
 
 	// if this has a rights id, the key needs to be sourced from a ticket
 	if (mHdr.hasRightsId() == true)
 	{
 		fnd::aes::sAes128Key tmp_key;
-		if (mKeyCfg.getNcaExternalContentKey(mHdr.getRightsId(), tmp_key) == true)
+		if (mKeyCfg->getNcaExternalContentKey(mHdr.getRightsId(), tmp_key) == true)
 		{
 			mContentKey.aes_ctr = tmp_key;
 		}
-		else if (mKeyCfg.getNcaExternalContentKey(kDummyRightsIdForUserTitleKey, tmp_key) == true)
+		else if (mKeyCfg->getNcaExternalContentKey(kDummyRightsIdForUserTitleKey, tmp_key) == true)
 		{
 			fnd::aes::sAes128Key common_key;
-			if (mKeyCfg.getETicketCommonKey(masterkey_rev, common_key) == true)
+			if (mKeyCfg->getETicketCommonKey(masterkey_rev, common_key) == true)
 			{
 				nn::hac::AesKeygen::generateKey(tmp_key.key, tmp_key.key, common_key.key);
 			}
@@ -202,23 +289,42 @@ void NcaProcess::generateNcaBodyEncryptionKeys()
 		{
 			mContentKey.aes_ctr = kak_aes_ctr;
 		}
+
+		// the AES-XTS key is made of the first two key area keys
+		bool has_aes_xts[2] = {false, false};
+		for (size_t i = 0; i < mContentKey.kak_list.size(); i++)
+		{
+			const sKeys::sKeyAreaKey& kak = mContentKey.kak_list[i];
+			if ((kak.index == nn::hac::nca::KEY_AESXTS_0 || kak.index == nn::hac::nca::KEY_AESXTS_1) && kak.decrypted)
+			{
+				memcpy(mContentKey.aes_xts.var.key[kak.index - nn::hac::nca::KEY_AESXTS_0], kak.dec.key, sizeof(kak.dec.key));
+				has_aes_xts[kak.index - nn::hac::nca::KEY_AESXTS_0] = true;
+			}
+		}
+		mContentKey.aes_xts.isSet = has_aes_xts[0] && has_aes_xts[1];
 	}
 
 	// if the keys weren't generated, check if the keys were supplied by the user
 	if (mContentKey.aes_ctr.isSet == false)
 	{
-		if (mKeyCfg.getNcaExternalContentKey(kDummyRightsIdForUserBodyKey, mContentKey.aes_ctr.var) == true)
+		if (mKeyCfg->getNcaExternalContentKey(kDummyRightsIdForUserBodyKey, mContentKey.aes_ctr.var) == true)
 			mContentKey.aes_ctr.isSet = true;
 	}
 	
 	
 	if (_HAS_BIT(mCliOutputMode, OUTPUT_KEY_DATA))
 	{
+		if (mContentKey.aes_ctr.isSet || mContentKey.aes_xts.isSet)
+			std::cout << "[NCA Content Key]" << std::endl;
 		if (mContentKey.aes_ctr.isSet)
 		{
-			std::cout << "[NCA Content Key]" << std::endl;
 			std::cout << "  AES-CTR Key: " << fnd::SimpleTextOutput::arrayToString(mContentKey.aes_ctr.var.key, sizeof(mContentKey.aes_ctr.var), true, ":") << std::endl;
 		}
+		if (mContentKey.aes_xts.isSet)
+		{
+			std::cout << "  AES-XTS Key0: " << fnd::SimpleTextOutput::arrayToString(mContentKey.aes_xts.var.key[0], sizeof(mContentKey.aes_xts.var.key[0]), true, ":") << std::endl;
+			std::cout << "  AES-XTS Key1: " << fnd::SimpleTextOutput::arrayToString(mContentKey.aes_xts.var.key[1], sizeof(mContentKey.aes_xts.var.key[1]), true, ":") << std::endl;
+		}
 	}
 	
 	
@@ -265,6 +371,8 @@ void NcaProcess::generatePartitionConfiguration()
 		info.format_type = (nn::hac::nca::FormatType)fs_header.format_type;
 		info.hash_type = (nn::hac::nca::HashType)fs_header.hash_type;
 		info.enc_type = (nn::hac::nca::EncryptionType)fs_header.encryption_type;
+		memcpy(&info.patch_info, fs_header.patch_info, sizeof(sPatchInfo));
+		info.base_reader_factory = nullptr;
 		if (info.hash_type == nn::hac::nca::HashType::HierarchicalSha256)
 		{
 			// info.hash_tree_meta.importData(fs_header.hash_info, nn::hac::nca::kHashInfoLen, LayeredIntegrityMetadata::HASH_TYPE_SHA256);
@@ -345,22 +453,26 @@ void NcaProcess::generatePartitionConfiguration()
 					throw fnd::Exception(kModuleName, error.str());
 			}
 
-			// create reader based on encryption type0
+			// filter out unrecognised encryption types
 			if (info.enc_type == nn::hac::nca::EncryptionType::None)
 			{
-				info.reader = new fnd::OffsetAdjustedIFile(mFile, info.offset, info.size);
 			}
 			else if (info.enc_type == nn::hac::nca::EncryptionType::AesCtr)
 			{
 				if (mContentKey.aes_ctr.isSet == false)
 					throw fnd::Exception(kModuleName, "AES-CTR Key was not determined");
-				info.reader = new fnd::OffsetAdjustedIFile(new fnd::AesCtrWrappedIFile(mFile, mContentKey.aes_ctr.var, info.aes_ctr), info.offset, info.size);
 			}
-			else if (info.enc_type == nn::hac::nca::EncryptionType::AesXts || info.enc_type == nn::hac::nca::EncryptionType::AesCtrEx)
+			else if (info.enc_type == nn::hac::nca::EncryptionType::AesXts)
 			{
-				error.clear();
-				error <<  "EncryptionType(" << nn::hac::ContentArchiveUtil::getEncryptionTypeAsString(info.enc_type) << "): UNSUPPORTED";
-				throw fnd::Exception(kModuleName, error.str());
+				if (mContentKey.aes_xts.isSet == false)
+					throw fnd::Exception(kModuleName, "AES-XTS Key was not determined");
+			}
+			else if (info.enc_type == nn::hac::nca::EncryptionType::AesCtrEx)
+			{
+				if (mContentKey.aes_ctr.isSet == false)
+					throw fnd::Exception(kModuleName, "AES-CTR Key was not determined");
+
+				info.base_reader_factory = createBaseRawPartitionReaderFactory(partition.header_index);
 			}
 			else
 			{
@@ -369,17 +481,16 @@ void NcaProcess::generatePartitionConfiguration()
 				throw fnd::Exception(kModuleName, error.str());
 			}
 
-			// filter out unrecognised hash types, and hash based readers
-			if (info.hash_type == nn::hac::nca::HashType::HierarchicalSha256 || info.hash_type == nn::hac::nca::HashType::HierarchicalIntegrity)
-			{	
-				info.reader = new fnd::LayeredIntegrityWrappedIFile(info.reader, info.layered_intergrity_metadata);
-			}
-			else if (info.hash_type != nn::hac::nca::HashType::None)
+			// filter out unrecognised hash types
+			if (info.hash_type != nn::hac::nca::HashType::None && info.hash_type != nn::hac::nca::HashType::HierarchicalSha256 && info.hash_type != nn::hac::nca::HashType::HierarchicalIntegrity)
 			{
 				error.clear();
 				error <<  "HashType(" << nn::hac::ContentArchiveUtil::getHashTypeAsString(info.hash_type) << "): UNKNOWN";
 				throw fnd::Exception(kModuleName, error.str());
 			}
+
+			// create reader based on encryption type and hash type
+			info.reader = createPartitionReader(mFile, info, mContentKey.aes_ctr.var, mContentKey.aes_xts.var, mVerifiedBlockCache);
 		}
 		catch (const fnd::Exception& e)
 		{
@@ -392,7 +503,7 @@ void NcaProcess::validateNcaSignatures()
 {
 	// validate signature[0]
 	fnd::rsa::sRsa2048Key sign0_key;
-	mKeyCfg.getContentArchiveHeader0SignKey(sign0_key, mHdr.getSignatureKeyGeneration());
+	mKeyCfg->getContentArchiveHeader0SignKey(sign0_key, mHdr.getSignatureKeyGeneration());
 	if (fnd::rsa::pss::rsaVerify(sign0_key, fnd::sha::HASH_SHA256, mHdrHash.bytes, mHdrBlock.signature_main) != 0)
 	{
 		std::cout << "[WARNING] NCA Header Main Signature: FAIL" << std::endl;
@@ -416,7 +527,7 @@ void NcaProcess::validateNcaSignatures()
 					const nn::hac::PartitionFsHeader::sFile& file = exefs.getPfsHeader().getFileList().getElement(kNpdmExefsPath);
 
 					MetaProcess npdm;
-					npdm.setInputFile(new fnd::OffsetAdjustedIFile(mPartitions[nn::hac::nca::PARTITION_CODE].reader, file.offset, file.size));
+					npdm.setInputFile(MemoryMappedFile::createOffsetAdjustedIFile(mPartitions[nn::hac::nca::PARTITION_CODE].reader, file.offset, file.size));
 					npdm.setKeyCfg(mKeyCfg);
 					npdm.setVerifyMode(true);
 					npdm.setCliOutputMode(0);
@@ -501,7 +612,7 @@ void NcaProcess::displayHeader()
 			std::cout << "      Format Type: " << nn::hac::ContentArchiveUtil::getFormatTypeAsString(info.format_type) << std::endl;
 			std::cout << "      Hash Type:   " << nn::hac::ContentArchiveUtil::getHashTypeAsString(info.hash_type) << std::endl;
 			std::cout << "      Enc. Type:   " << nn::hac::ContentArchiveUtil::getEncryptionTypeAsString(info.enc_type) << std::endl;
-			if (info.enc_type == nn::hac::nca::EncryptionType::AesCtr)
+			if (info.enc_type == nn::hac::nca::EncryptionType::AesCtr || info.enc_type == nn::hac::nca::EncryptionType::AesCtrEx)
 			{
 				fnd::aes::sAesIvCtr ctr;
 				fnd::aes::AesIncrementCounter(info.aes_ctr.iv, info.offset>>4, ctr.iv);
@@ -587,6 +698,11 @@ void NcaProcess::processPartitions()
 			
 			if (mPartitionPath[index].doExtract)
 				pfs.setExtractPath(mPartitionPath[index].path);
+			pfs.setExtractFilter(mExtractFilter);
+			pfs.setExtractArchive(mExtractArchive);
+			if (mFileFactory != nullptr)
+				pfs.setInputFileFactory(createPartitionReaderFactory(index));
+			pfs.setThreadNum(mThreadNum);
 			pfs.process();
 		}
 		else if (partition.format_type == nn::hac::nca::FormatType::RomFs)
@@ -606,11 +722,343 @@ void NcaProcess::processPartitions()
 
 			if (mPartitionPath[index].doExtract)
 				romfs.setExtractPath(mPartitionPath[index].path);
+			if (mRomfsExtractFilePath.isSet)
+				romfs.setExtractFilePath(mRomfsExtractFilePath.var);
+			romfs.setExtractFilter(mExtractFilter);
+			romfs.setExtractArchive(mExtractArchive);
+			if (mRomfsErofsImagePath.isSet)
+				romfs.setErofsImagePath(mRomfsErofsImagePath.var);
+			if (mFileFactory != nullptr)
+				romfs.setInputFileFactory(createPartitionReaderFactory(index));
+			romfs.setThreadNum(mThreadNum);
+			romfs.setBlockCacheSize(mBlockCacheSize);
 			romfs.process();
 		}
 	}
 }
 
+bool NcaProcess::verifyPartitionHashTrees()
+{
+	bool valid = true;
+	for (size_t i = 0; i < mHdr.getPartitionEntryList().size(); i++)
+	{
+		uint32_t index = mHdr.getPartitionEntryList()[i].header_index;
+		const sPartitionInfo& info = mPartitions[index];
+
+		if (info.hash_type != nn::hac::nca::HashType::HierarchicalSha256 && info.hash_type != nn::hac::nca::HashType::HierarchicalIntegrity)
+			continue;
+
+		// the hash tree is verified even if creating the reader failed, as that is what happens when the hash layers are corrupt
+		bool decryptable = info.enc_type == nn::hac::nca::EncryptionType::None \
+			|| (info.enc_type == nn::hac::nca::EncryptionType::AesCtr && mContentKey.aes_ctr.isSet) \
+			|| (info.enc_type == nn::hac::nca::EncryptionType::AesXts && mContentKey.aes_xts.isSet) \
+			|| (info.enc_type == nn::hac::nca::EncryptionType::AesCtrEx && mContentKey.aes_ctr.isSet && info.base_reader_factory != nullptr);
+		if (decryptable == false)
+		{
+			std::cout << "[WARNING] NCA Partition " << std::dec << index << " hash tree not verifiable. (" << nn::hac::ContentArchiveUtil::getEncryptionTypeAsString(info.enc_type) << " partition could not be decrypted)" << std::endl;
+			continue;
+		}
+
+		if (verifyPartitionHashTree(index) == false)
+			valid = false;
+	}
+
+	return valid;
+}
+
+bool NcaProcess::verifyPartitionHashTree(size_t index)
+{
+	const sPartitionInfo& info = mPartitions[index];
+	const fnd::LayeredIntegrityMetadata& hash_hdr = info.layered_intergrity_metadata;
+	bool align_hash = hash_hdr.getAlignHashToBlock();
+	std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+	fnd::SharedPtr<fnd::IFile> reader = createRawPartitionReader(mFile, info, mContentKey.aes_ctr.var, mContentKey.aes_xts.var);
+	fnd::Vec<byte_t> hash_cache;
+	size_t block_num_total = 0;
+	size_t bad_block_num = 0;
+	uint64_t verified_size = 0;
+
+	// blocks are reported with their offset in the NCA
+	auto reportBadBlock = [&](const std::string& layer_name, size_t offset, size_t block_index, size_t size) {
+		std::cout << "[WARNING] NCA Partition " << std::dec << index << " " << layer_name << " Block " << std::dec << block_index << " (offset: 0x" << std::hex << (uint64_t)(info.offset + offset) << ", size: 0x" << std::hex << size << "): FAIL" << std::endl;
+		bad_block_num++;
+	};
+
+	// blocks whose hash is in a bad (or itself unverifiable) block of the layer above cannot be verified, they are reported as ranges instead of as bad blocks
+	std::vector<size_t> prev_untrusted_block_list;
+	size_t prev_block_size = fnd::sha::kSha256HashLen;
+	size_t unverifiable_block_num = 0;
+	auto isUnverifiable = [&](size_t block_index) {
+		return std::binary_search(prev_untrusted_block_list.begin(), prev_untrusted_block_list.end(), (block_index * fnd::sha::kSha256HashLen) / prev_block_size);
+	};
+	auto reportUnverifiableBlocks = [&](const std::string& layer_name, const fnd::LayeredIntegrityMetadata::sLayer& layer, size_t block_num) {
+		size_t hashes_per_block = prev_block_size / fnd::sha::kSha256HashLen;
+		for (size_t i = 0; i < prev_untrusted_block_list.size(); )
+		{
+			// adjacent untrusted hash blocks are reported as one range
+			size_t j = i + 1;
+			while (j < prev_untrusted_block_list.size() && prev_untrusted_block_list[j] == prev_untrusted_block_list[j-1] + 1)
+				j++;
+
+			size_t first_block = prev_untrusted_block_list[i] * hashes_per_block;
+			size_t end_block = _MIN(block_num, (prev_untrusted_block_list[j-1] + 1) * hashes_per_block);
+			i = j;
+			if (first_block >= end_block)
+				continue;
+
+			uint64_t offset = layer.offset + (uint64_t)first_block * layer.block_size;
+			uint64_t size = _MIN((uint64_t)end_block * layer.block_size, (uint64_t)layer.size) - (uint64_t)first_block * layer.block_size;
+			std::cout << "[WARNING] NCA Partition " << std::dec << index << " " << layer_name << " Blocks " << std::dec << first_block << "-" << (end_block - 1) << " (offset: 0x" << std::hex << (uint64_t)(info.offset + offset) << ", size: 0x" << std::hex << size << "): UNVERIFIABLE (hash block failed)" << std::endl;
+			unverifiable_block_num += end_block - first_block;
+		}
+	};
+
+	// the hash layers are small, so are verified on this thread, top down from the master hash
+	fnd::Vec<byte_t> prev, cur;
+	prev.alloc(fnd::sha::kSha256HashLen * hash_hdr.getMasterHashList().size());
+	for (size_t i = 0; i < hash_hdr.getMasterHashList().size(); i++)
+	{
+		memcpy(prev.data() + i * fnd::sha::kSha256HashLen, hash_hdr.getMasterHashList()[i].bytes, fnd::sha::kSha256HashLen);
+	}
+
+	for (size_t i = 0; i < hash_hdr.getHashLayerInfo().size(); i++)
+	{
+		const fnd::LayeredIntegrityMetadata::sLayer& layer = hash_hdr.getHashLayerInfo()[i];
+		size_t block_num = (layer.size / layer.block_size) + ((layer.size % layer.block_size) != 0);
+		if (prev.size() < block_num * fnd::sha::kSha256HashLen)
+		{
+			std::cout << "[WARNING] NCA Partition " << std::dec << index << " Hash Layer " << i << " is larger than the hashes for it." << std::endl;
+			return false;
+		}
+
+		cur.alloc(block_num * layer.block_size);
+		memset(cur.data(), 0, cur.size());
+		(*reader)->read(cur.data(), layer.offset, layer.size);
+
+		std::vector<size_t> bad_block_list;
+		size_t last_block_size = align_hash ? layer.block_size : layer.size - ((block_num - 1) * layer.block_size);
+		LayeredIntegrityIFile::findBadBlocks(cur.data(), layer.block_size, block_num, last_block_size, prev.data(), 0, hash_cache, bad_block_list);
+
+		std::stringstream layer_name;
+		layer_name << "Hash Layer " << i;
+		for (size_t j = 0; j < bad_block_list.size(); j++)
+		{
+			size_t block = bad_block_list[j];
+			if (isUnverifiable(block) == false)
+				reportBadBlock(layer_name.str(), layer.offset + block * layer.block_size, block, (block + 1 == block_num) ? last_block_size : layer.block_size);
+		}
+		reportUnverifiableBlocks(layer_name.str(), layer, block_num);
+
+		// the hashes in bad and unverifiable blocks cannot be trusted for the next layer
+		std::vector<size_t> untrusted_block_list;
+		for (size_t block = 0; block < block_num; block++)
+		{
+			if (isUnverifiable(block) || std::binary_search(bad_block_list.begin(), bad_block_list.end(), block))
+				untrusted_block_list.push_back(block);
+		}
+		prev_untrusted_block_list = untrusted_block_list;
+		prev_block_size = layer.block_size;
+
+		block_num_total += block_num;
+		verified_size += layer.size;
+		prev = cur;
+	}
+
+	// the data layer is split into block ranges that are verified in parallel
+	const fnd::LayeredIntegrityMetadata::sLayer& data_layer = hash_hdr.getDataLayer();
+	size_t data_block_num = (data_layer.size / data_layer.block_size) + ((data_layer.size % data_layer.block_size) != 0);
+	if (prev.size() < data_block_num * fnd::sha::kSha256HashLen)
+	{
+		std::cout << "[WARNING] NCA Partition " << std::dec << index << " Data Layer is larger than the hashes for it." << std::endl;
+		return false;
+	}
+
+	size_t job_block_num = _MAX(1, kVerifyJobSize / data_layer.block_size);
+	size_t thread_num = (mFileFactory != nullptr) ? mThreadNum : 1;
+
+	// each worker lazily creates its own reader and buffers, the first worker can use the reader already created
+	std::vector<fnd::SharedPtr<fnd::IFile>> worker_file(thread_num);
+	std::vector<fnd::Vec<byte_t>> worker_cache(thread_num);
+	std::vector<fnd::Vec<byte_t>> worker_hash_cache(thread_num);
+	std::vector<std::vector<size_t>> worker_bad_block_list(thread_num);
+	worker_file[0] = reader;
+
+	ThreadPool pool(thread_num);
+	for (size_t first_block = 0; first_block < data_block_num; first_block += job_block_num)
+	{
+		size_t block_num = _MIN(job_block_num, data_block_num - first_block);
+		pool.enqueue([this, &info, &data_layer, &prev, align_hash, data_block_num, job_block_num, first_block, block_num, &worker_file, &worker_cache, &worker_hash_cache, &worker_bad_block_list](size_t thread_index) {
+			fnd::SharedPtr<fnd::IFile>& in_file = worker_file[thread_index];
+			fnd::Vec<byte_t>& cache = worker_cache[thread_index];
+
+			if (*in_file == nullptr)
+				in_file = createRawPartitionReader(mFileFactory(), info, mContentKey.aes_ctr.var, mContentKey.aes_xts.var);
+			if (cache.size() == 0)
+				cache.alloc(job_block_num * data_layer.block_size);
+
+			// the last block of the data layer may be truncated
+			size_t read_len = block_num * data_layer.block_size;
+			size_t last_block_size = data_layer.block_size;
+			if (first_block + block_num == data_block_num)
+			{
+				read_len = data_layer.size - (first_block * data_layer.block_size);
+				memset(cache.data(), 0, block_num * data_layer.block_size);
+				if (align_hash == false)
+					last_block_size = read_len - ((block_num - 1) * data_layer.block_size);
+			}
+
+			(*in_file)->read(cache.data(), data_layer.offset + first_block * data_layer.block_size, read_len);
+			LayeredIntegrityIFile::findBadBlocks(cache.data(), data_layer.block_size, block_num, last_block_size, prev.data() + first_block * fnd::sha::kSha256HashLen, first_block, worker_hash_cache[thread_index], worker_bad_block_list[thread_index]);
+		});
+	}
+	pool.wait();
+
+	std::vector<size_t> bad_block_list;
+	for (size_t i = 0; i < worker_bad_block_list.size(); i++)
+		bad_block_list.insert(bad_block_list.end(), worker_bad_block_list[i].begin(), worker_bad_block_list[i].end());
+	std::sort(bad_block_list.begin(), bad_block_list.end());
+
+	for (size_t i = 0; i < bad_block_list.size(); i++)
+	{
+		size_t block = bad_block_list[i];
+		size_t size = _MIN(data_layer.block_size, data_layer.size - block * data_layer.block_size);
+		if (isUnverifiable(block) == false)
+			reportBadBlock("Data Layer", data_layer.offset + block * data_layer.block_size, block, size);
+	}
+	reportUnverifiableBlocks("Data Layer", data_layer, data_block_num);
+
+	block_num_total += data_block_num;
+	verified_size += data_layer.size;
+
+	if (_HAS_BIT(mCliOutputMode, OUTPUT_BASIC))
+	{
+		double elapsed_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+		double verified_mib = (double)verified_size / (double)(1024 * 1024);
+
+		std::cout << "verified partition " << std::dec << index << " hash tree, " << block_num_total << " block(s), " << std::fixed << std::setprecision(2) << verified_mib << " MiB in " << elapsed_sec << " sec";
+		if (elapsed_sec > 0)
+			std::cout << " (" << (verified_mib / elapsed_sec) << " MiB/s)";
+		std::cout << std::defaultfloat << ": ";
+		if (bad_block_num == 0)
+			std::cout << "OK" << std::endl;
+		else
+		{
+			std::cout << "FAIL (" << std::dec << bad_block_num << " bad block(s)";
+			if (unverifiable_block_num > 0)
+				std::cout << ", " << std::dec << unverifiable_block_num << " unverifiable block(s)";
+			std::cout << ")" << std::endl;
+		}
+	}
+
+	return bad_block_num == 0;
+}
+
+fnd::SharedPtr<fnd::IFile> NcaProcess::createRawPartitionReader(const fnd::SharedPtr<fnd::IFile>& file, const sPartitionInfo& info, const fnd::aes::sAes128Key& aes_ctr_key, const fnd::aes::sAesXts128Key& aes_xts_key)
+{
+	fnd::SharedPtr<fnd::IFile> reader;
+
+	// create reader based on encryption type
+	if (info.enc_type == nn::hac::nca::EncryptionType::AesCtr)
+	{
+		reader = new RegionIFile(new AesCtrIFile(file, aes_ctr_key, info.aes_ctr), info.offset, info.size);
+	}
+	else if (info.enc_type == nn::hac::nca::EncryptionType::AesXts)
+	{
+		// XTS sectors are numbered from the start of the partition
+		reader = new AesXtsIFile(MemoryMappedFile::createOffsetAdjustedIFile(file, info.offset, info.size), aes_xts_key);
+	}
+	else if (info.enc_type == nn::hac::nca::EncryptionType::AesCtrEx)
+	{
+		// the subsection table at the end of the partition is encrypted with the partition counter as is
+		const sPatchInfo& patch_info = info.patch_info;
+		fnd::SharedPtr<fnd::IFile> subsection_table = new RegionIFile(new AesCtrIFile(file, aes_ctr_key, info.aes_ctr), info.offset + patch_info.aes_ctr_ex_offset.get(), patch_info.aes_ctr_ex_size.get());
+		fnd::SharedPtr<BucketTree> subsection_tree = new BucketTree(subsection_table, patch_info.aes_ctr_ex_header, sizeof(AesCtrExIFile::sEntry));
+		fnd::SharedPtr<fnd::IFile> patch_reader = new AesCtrExIFile(file, aes_ctr_key, info.aes_ctr, info.offset, info.size, subsection_tree);
+
+		// the relocation table maps the patched partition onto the base and patch partitions, without building the patched partition
+		fnd::SharedPtr<fnd::IFile> relocation_table = new RegionIFile(patch_reader, patch_info.indirect_offset.get(), patch_info.indirect_size.get());
+		fnd::SharedPtr<BucketTree> relocation_tree = new BucketTree(relocation_table, patch_info.indirect_header, sizeof(IndirectIFile::sEntry));
+		reader = new IndirectIFile(info.base_reader_factory(), patch_reader, relocation_tree);
+	}
+	else
+	{
+		reader = MemoryMappedFile::createOffsetAdjustedIFile(file, info.offset, info.size);
+	}
+
+	return reader;
+}
+
+fnd::SharedPtr<fnd::IFile> NcaProcess::createPartitionReader(const fnd::SharedPtr<fnd::IFile>& file, const sPartitionInfo& info, const fnd::aes::sAes128Key& aes_ctr_key, const fnd::aes::sAesXts128Key& aes_xts_key, const std::shared_ptr<BlockCache>& block_cache)
+{
+	fnd::SharedPtr<fnd::IFile> reader = createRawPartitionReader(file, info, aes_ctr_key, aes_xts_key);
+
+	// wrap hash based readers. PartitionFs partitions (ExeFS, logo) are read more than once (signature check, listing, extraction),
+	// so the blocks they verify are shared through block_cache, a RomFS is read in bulk so caching its blocks would only churn the cache
+	if (info.hash_type == nn::hac::nca::HashType::HierarchicalSha256 || info.hash_type == nn::hac::nca::HashType::HierarchicalIntegrity)
+	{
+		reader = new LayeredIntegrityIFile(reader, info.layered_intergrity_metadata, info.format_type == nn::hac::nca::FormatType::PartitionFs ? block_cache : nullptr);
+	}
+
+	return reader;
+}
+
+IFileFactory NcaProcess::createPartitionReaderFactory(size_t index) const
+{
+	IFileFactory file_factory = mFileFactory;
+	fnd::aes::sAes128Key aes_ctr_key = mContentKey.aes_ctr.var;
+	fnd::aes::sAesXts128Key aes_xts_key = mContentKey.aes_xts.var;
+	std::shared_ptr<BlockCache> block_cache = mVerifiedBlockCache;
+	
+	// copy the partition config without the reader, so the factory shares no state with this object (other than the thread-safe block cache)
+	sPartitionInfo info = mPartitions[index];
+	info.reader = nullptr;
+
+	return [file_factory, info, aes_ctr_key, aes_xts_key, block_cache]() -> fnd::SharedPtr<fnd::IFile> {
+		return createPartitionReader(file_factory(), info, aes_ctr_key, aes_xts_key, block_cache);
+	};
+}
+
+IFileFactory NcaProcess::createBaseRawPartitionReaderFactory(size_t index) const
+{
+	if (*mBaseFile == nullptr)
+	{
+		throw fnd::Exception(kModuleName, "AesCtrEx partitions can only be read with the base NCA (--basenca)");
+	}
+
+	// the base NCA is only processed as far as configuring its partitions
+	NcaProcess base;
+	base.setInputFile(mBaseFile);
+	base.setKeyCfg(mKeyCfg);
+	base.importHeader();
+	base.generateNcaBodyEncryptionKeys();
+	base.generatePartitionConfiguration();
+
+	std::stringstream error;
+	sPartitionInfo info = base.mPartitions[index];
+	if (*info.reader == nullptr)
+	{
+		error << "Base NCA Partition " << std::dec << index << " not readable.";
+		if (info.fail_reason.empty() == false)
+			error << " (" << info.fail_reason << ")";
+		throw fnd::Exception(kModuleName, error.str());
+	}
+	info.reader = nullptr;
+
+	IFileFactory file_factory = mBaseFileFactory;
+	if (file_factory == nullptr)
+	{
+		fnd::SharedPtr<fnd::IFile> base_file = mBaseFile;
+		file_factory = [base_file]() -> fnd::SharedPtr<fnd::IFile> { return base_file; };
+	}
+	fnd::aes::sAes128Key aes_ctr_key = base.mContentKey.aes_ctr.var;
+	fnd::aes::sAesXts128Key aes_xts_key = base.mContentKey.aes_xts.var;
+
+	return [file_factory, info, aes_ctr_key, aes_xts_key]() -> fnd::SharedPtr<fnd::IFile> {
+		return createRawPartitionReader(file_factory(), info, aes_ctr_key, aes_xts_key);
+	};
+}
+
 const char* NcaProcess::getContentTypeForMountStr(nn::hac::nca::ContentType cont_type) const
 {
 	const char* str = nullptr;
@@ -6,6 +6,10 @@
 #include <fnd/LayeredIntegrityMetadata.h>
 #include <nn/hac/ContentArchiveHeader.h>
 #include "KeyConfiguration.h"
+#include "BucketTree.h"
+#include "PathFilter.h"
+#include "TarWriter.h"
+#include "BlockCache.h"
 
 
 #include "common.h"
@@ -19,26 +23,42 @@ public:
 
 	// generic
 	void setInputFile(const fnd::SharedPtr<fnd::IFile>& file);
-	void setKeyCfg(const KeyConfiguration& keycfg);
+	void setInputFileFactory(const IFileFactory& factory);
+	void setKeyCfg(const std::shared_ptr<const KeyConfiguration>& keycfg);
 	void setCliOutputMode(CliOutputMode type);
 	void setVerifyMode(bool verify);
+	void setFullVerifyMode(bool verify_full);
 
 	// nca specfic
 	void setPartition0ExtractPath(const std::string& path);
 	void setPartition1ExtractPath(const std::string& path);
 	void setPartition2ExtractPath(const std::string& path);
 	void setPartition3ExtractPath(const std::string& path);
+	void setRomfsExtractFilePath(const std::string& romfs_path);
+	void setExtractFilter(const std::shared_ptr<const PathFilter>& filter);
+	void setExtractArchive(const std::shared_ptr<TarWriter>& archive);
+	void setRomfsErofsImagePath(const std::string& path);
 	void setListFs(bool list_fs);
+	void setThreadNum(size_t thread_num);
+	void setBlockCacheSize(size_t size);
+	void setVerifiedBlockCache(const std::shared_ptr<BlockCache>& block_cache);
+
+	// patch (AesCtrEx) partitions are read as a patched view of the same partition in the base NCA
+	void setBaseNcaFile(const fnd::SharedPtr<fnd::IFile>& file);
+	void setBaseNcaFileFactory(const IFileFactory& factory);
 
 private:
 	const std::string kModuleName = "NcaProcess";
 	const std::string kNpdmExefsPath = "main.npdm";
+	static const size_t kVerifyJobSize = 0x400000;
 
 	// user options
 	fnd::SharedPtr<fnd::IFile> mFile;
-	KeyConfiguration mKeyCfg;
+	IFileFactory mFileFactory;
+	std::shared_ptr<const KeyConfiguration> mKeyCfg;
 	CliOutputMode mCliOutputMode;
 	bool mVerify;
+	bool mVerifyFull;
 
 	struct sExtract
 	{
@@ -46,7 +66,16 @@ private:
 		bool doExtract;
 	} mPartitionPath[nn::hac::nca::kPartitionNum];
 
+	sOptional<std::string> mRomfsExtractFilePath;
+	std::shared_ptr<const PathFilter> mExtractFilter;
+	std::shared_ptr<TarWriter> mExtractArchive;
+	sOptional<std::string> mRomfsErofsImagePath;
 	bool mListFs;
+	size_t mThreadNum;
+	size_t mBlockCacheSize;
+	std::shared_ptr<BlockCache> mVerifiedBlockCache;
+	fnd::SharedPtr<fnd::IFile> mBaseFile;
+	IFileFactory mBaseFileFactory;
 
 	// data
 	nn::hac::sContentArchiveHeaderBlock mHdrBlock;
@@ -87,8 +116,21 @@ private:
 		fnd::List<sKeyAreaKey> kak_list;
 
 		sOptional<fnd::aes::sAes128Key> aes_ctr;
+		sOptional<fnd::aes::sAesXts128Key> aes_xts;
 	} mContentKey;
 	
+#pragma pack(push,1)
+	struct sPatchInfo
+	{
+		le_uint64_t indirect_offset;
+		le_uint64_t indirect_size;
+		BucketTree::sHeader indirect_header;
+		le_uint64_t aes_ctr_ex_offset;
+		le_uint64_t aes_ctr_ex_size;
+		BucketTree::sHeader aes_ctr_ex_header;
+	};
+#pragma pack(pop)
+
 	struct sPartitionInfo
 	{
 		fnd::SharedPtr<fnd::IFile> reader;
@@ -102,6 +144,10 @@ private:
 		nn::hac::nca::EncryptionType enc_type;
 		fnd::LayeredIntegrityMetadata layered_intergrity_metadata;
 		fnd::aes::sAesIvCtr aes_ctr;
+
+		// patch partitions
+		sPatchInfo patch_info;
+		IFileFactory base_reader_factory; // raw reader of the partition in the base NCA
 	} mPartitions[nn::hac::nca::kPartitionNum];
 
 	void importHeader();
@@ -110,6 +156,13 @@ private:
 	void validateNcaSignatures();
 	void displayHeader();
 	void processPartitions();
+	bool verifyPartitionHashTrees();
+	bool verifyPartitionHashTree(size_t index);
+
+	static fnd::SharedPtr<fnd::IFile> createRawPartitionReader(const fnd::SharedPtr<fnd::IFile>& file, const sPartitionInfo& info, const fnd::aes::sAes128Key& aes_ctr_key, const fnd::aes::sAesXts128Key& aes_xts_key);
+	static fnd::SharedPtr<fnd::IFile> createPartitionReader(const fnd::SharedPtr<fnd::IFile>& file, const sPartitionInfo& info, const fnd::aes::sAes128Key& aes_ctr_key, const fnd::aes::sAesXts128Key& aes_xts_key, const std::shared_ptr<BlockCache>& block_cache);
+	IFileFactory createPartitionReaderFactory(size_t index) const;
+	IFileFactory createBaseRawPartitionReaderFactory(size_t index) const;
 
 	const char* getContentTypeForMountStr(nn::hac::nca::ContentType cont_type) const;
 };
\ No newline at end of file
@@ -1,11 +1,11 @@
 #include <iostream>
 #include <iomanip>
 #include <fnd/SimpleTextOutput.h>
-#include <fnd/OffsetAdjustedIFile.h>
 #include <fnd/Vec.h>
 #include <fnd/lz4.h>
 #include <nn/hac/define/nro-hb.h>
 #include "NroProcess.h"
+#include "MemoryMappedFile.h"
 
 NroProcess::NroProcess():
 	mFile(),
@@ -78,6 +78,11 @@ void NroProcess::setAssetRomfsExtractPath(const std::string& path)
 	mAssetProc.setRomfsExtractPath(path);
 }
 
+void NroProcess::setAssetRomfsExtractFilter(const std::shared_ptr<const PathFilter>& filter)
+{
+	mAssetProc.setRomfsExtractFilter(filter);
+}
+
 const RoMetadataProcess& NroProcess::getRoMetadataProcess() const
 {
 	return mRoMeta;
@@ -107,7 +112,7 @@ void NroProcess::importHeader()
 	if (((le_uint64_t*)raw_hdr->reserved_0)->get() == nn::hac::nro::kNroHomebrewStructMagic && (*mFile)->size() > mHdr.getNroSize())
 	{
 		mIsHomebrewNro = true;
-		mAssetProc.setInputFile(new fnd::OffsetAdjustedIFile(mFile, mHdr.getNroSize(), (*mFile)->size() - mHdr.getNroSize()));
+		mAssetProc.setInputFile(MemoryMappedFile::createOffsetAdjustedIFile(mFile, mHdr.getNroSize(), (*mFile)->size() - mHdr.getNroSize()));
 		mAssetProc.setCliOutputMode(mCliOutputMode);
 		mAssetProc.setVerifyMode(mVerify);
 	}
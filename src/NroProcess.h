@@ -31,6 +31,7 @@ public:
 	void setAssetIconExtractPath(const std::string& path);
 	void setAssetNacpExtractPath(const std::string& path);
 	void setAssetRomfsExtractPath(const std::string& path);
+	void setAssetRomfsExtractFilter(const std::shared_ptr<const PathFilter>& filter);
 
 	const RoMetadataProcess& getRoMetadataProcess() const;
 private:
@@ -5,6 +5,7 @@
 #include <fnd/Vec.h>
 #include <fnd/lz4.h>
 #include "NsoProcess.h"
+#include "MemoryMappedFile.h"
 
 NsoProcess::NsoProcess():
 	mFile(),
@@ -84,16 +85,22 @@ void NsoProcess::importHeader()
 void NsoProcess::importCodeSegments()
 {
 	fnd::Vec<byte_t> scratch;
+	const byte_t* compressed_data; // compressed segments are decompressed straight from the mapping if the file is memory mapped
 	uint32_t decompressed_len;
 	fnd::sha::sSha256Hash calc_hash;
 
 	// process text segment
 	if (mHdr.getTextSegmentInfo().is_compressed)
 	{
-		scratch.alloc(mHdr.getTextSegmentInfo().file_layout.size);
-		(*mFile)->read(scratch.data(), mHdr.getTextSegmentInfo().file_layout.offset, scratch.size());
+		compressed_data = MemoryMappedFile::getMappedData(mFile, mHdr.getTextSegmentInfo().file_layout.offset, mHdr.getTextSegmentInfo().file_layout.size);
+		if (compressed_data == nullptr)
+		{
+			scratch.alloc(mHdr.getTextSegmentInfo().file_layout.size);
+			(*mFile)->read(scratch.data(), mHdr.getTextSegmentInfo().file_layout.offset, scratch.size());
+			compressed_data = scratch.data();
+		}
 		mTextBlob.alloc(mHdr.getTextSegmentInfo().memory_layout.size);
-		fnd::lz4::decompressData(scratch.data(), (uint32_t)scratch.size(), mTextBlob.data(), (uint32_t)mTextBlob.size(), decompressed_len);
+		fnd::lz4::decompressData(compressed_data, (uint32_t)mHdr.getTextSegmentInfo().file_layout.size, mTextBlob.data(), (uint32_t)mTextBlob.size(), decompressed_len);
 		if (decompressed_len != mTextBlob.size())
 		{
 			throw fnd::Exception(kModuleName, "NSO text segment failed to decompress");
@@ -116,10 +123,15 @@ void NsoProcess::importCodeSegments()
 	// process ro segment
 	if (mHdr.getRoSegmentInfo().is_compressed)
 	{
-		scratch.alloc(mHdr.getRoSegmentInfo().file_layout.size);
-		(*mFile)->read(scratch.data(), mHdr.getRoSegmentInfo().file_layout.offset, scratch.size());
+		compressed_data = MemoryMappedFile::getMappedData(mFile, mHdr.getRoSegmentInfo().file_layout.offset, mHdr.getRoSegmentInfo().file_layout.size);
+		if (compressed_data == nullptr)
+		{
+			scratch.alloc(mHdr.getRoSegmentInfo().file_layout.size);
+			(*mFile)->read(scratch.data(), mHdr.getRoSegmentInfo().file_layout.offset, scratch.size());
+			compressed_data = scratch.data();
+		}
 		mRoBlob.alloc(mHdr.getRoSegmentInfo().memory_layout.size);
-		fnd::lz4::decompressData(scratch.data(), (uint32_t)scratch.size(), mRoBlob.data(), (uint32_t)mRoBlob.size(), decompressed_len);
+		fnd::lz4::decompressData(compressed_data, (uint32_t)mHdr.getRoSegmentInfo().file_layout.size, mRoBlob.data(), (uint32_t)mRoBlob.size(), decompressed_len);
 		if (decompressed_len != mRoBlob.size())
 		{
 			throw fnd::Exception(kModuleName, "NSO ro segment failed to decompress");
@@ -142,10 +154,15 @@ void NsoProcess::importCodeSegments()
 	// process data segment
 	if (mHdr.getDataSegmentInfo().is_compressed)
 	{
-		scratch.alloc(mHdr.getDataSegmentInfo().file_layout.size);
-		(*mFile)->read(scratch.data(), mHdr.getDataSegmentInfo().file_layout.offset, scratch.size());
+		compressed_data = MemoryMappedFile::getMappedData(mFile, mHdr.getDataSegmentInfo().file_layout.offset, mHdr.getDataSegmentInfo().file_layout.size);
+		if (compressed_data == nullptr)
+		{
+			scratch.alloc(mHdr.getDataSegmentInfo().file_layout.size);
+			(*mFile)->read(scratch.data(), mHdr.getDataSegmentInfo().file_layout.offset, scratch.size());
+			compressed_data = scratch.data();
+		}
 		mDataBlob.alloc(mHdr.getDataSegmentInfo().memory_layout.size);
-		fnd::lz4::decompressData(scratch.data(), (uint32_t)scratch.size(), mDataBlob.data(), (uint32_t)mDataBlob.size(), decompressed_len);
+		fnd::lz4::decompressData(compressed_data, (uint32_t)mHdr.getDataSegmentInfo().file_layout.size, mDataBlob.data(), (uint32_t)mDataBlob.size(), decompressed_len);
 		if (decompressed_len != mDataBlob.size())
 		{
 			throw fnd::Exception(kModuleName, "NSO data segment failed to decompress");
@@ -0,0 +1,167 @@
+#include "PathFilter.h"
+#include <cstring>
+
+PathFilter::PathFilter() :
+	mIncludeList(),
+	mExcludeList()
+{
+}
+
+void PathFilter::addInclude(const std::string& pattern)
+{
+	mIncludeList.push_back(createPattern(pattern));
+}
+
+void PathFilter::addExclude(const std::string& pattern)
+{
+	mExcludeList.push_back(createPattern(pattern));
+}
+
+bool PathFilter::isSelected(const std::string& path) const
+{
+	bool selected = mIncludeList.empty();
+	for (size_t i = 0; i < mIncludeList.size() && selected == false; i++)
+	{
+		selected = isMatch(mIncludeList[i], path);
+	}
+	for (size_t i = 0; i < mExcludeList.size() && selected == true; i++)
+	{
+		selected = isMatch(mExcludeList[i], path) == false;
+	}
+	return selected;
+}
+
+PathFilter::sPattern PathFilter::createPattern(const std::string& pattern) const
+{
+	sPattern out;
+
+	if (pattern.compare(0, kRegexPrefix.length(), kRegexPrefix) == 0)
+	{
+		out.is_regex = true;
+		out.match_name = false;
+		try
+		{
+			out.regex = std::regex(pattern.substr(kRegexPrefix.length()), std::regex::ECMAScript | std::regex::optimize);
+		}
+		catch (const std::regex_error& e)
+		{
+			throw fnd::Exception(kModuleName, "Invalid regular expression \"" + pattern.substr(kRegexPrefix.length()) + "\" (" + e.what() + ")");
+		}
+	}
+	else
+	{
+		out.is_regex = false;
+		out.match_name = pattern.find('/') == std::string::npos;
+
+		// paths always begin with '/', so "dir/*" is the same as "/dir/*"
+		out.glob = (out.match_name || pattern[0] == '/') ? pattern : "/" + pattern;
+	}
+
+	return out;
+}
+
+bool PathFilter::isMatch(const sPattern& pattern, const std::string& path)
+{
+	if (pattern.is_regex)
+	{
+		return std::regex_search(path, pattern.regex);
+	}
+
+	const char* str = path.c_str();
+	if (pattern.match_name)
+	{
+		const char* name = strrchr(str, '/');
+		if (name != nullptr)
+			str = name + 1;
+	}
+
+	return matchGlob(pattern.glob.c_str(), str);
+}
+
+bool PathFilter::matchGlob(const char* glob, const char* str)
+{
+	while (*glob != '\0')
+	{
+		if (glob[0] == '*' && glob[1] == '*')
+		{
+			glob += 2;
+
+			// "/**/" also matches a single '/', so "/a/**/b" matches "/a/b"
+			if (*glob == '/' && matchGlob(glob + 1, str))
+				return true;
+
+			for (const char* s = str; ; s++)
+			{
+				if (matchGlob(glob, s))
+					return true;
+				if (*s == '\0')
+					return false;
+			}
+		}
+		else if (*glob == '*')
+		{
+			glob++;
+			for (const char* s = str; ; s++)
+			{
+				if (matchGlob(glob, s))
+					return true;
+				if (*s == '\0' || *s == '/')
+					return false;
+			}
+		}
+		else if (*glob == '?')
+		{
+			if (*str == '\0' || *str == '/')
+				return false;
+			glob++;
+			str++;
+		}
+		else if (*glob == '[' && strchr(glob + 1, ']') != nullptr)
+		{
+			if (*str == '\0' || *str == '/' || matchCharSet(glob, *str) == false)
+				return false;
+			str++;
+		}
+		else
+		{
+			if (*glob != *str)
+				return false;
+			glob++;
+			str++;
+		}
+	}
+
+	return *str == '\0';
+}
+
+bool PathFilter::matchCharSet(const char*& glob, char c)
+{
+	// skip '['
+	glob++;
+
+	bool negate = (*glob == '!' || *glob == '^');
+	if (negate)
+		glob++;
+
+	// a ']' straight after the '[' (or negation) is part of the set
+	bool match = false;
+	const char* set_begin = glob;
+	for (; *glob != '\0' && (*glob != ']' || glob == set_begin); glob++)
+	{
+		if (glob[1] == '-' && glob[2] != ']' && glob[2] != '\0')
+		{
+			match |= (c >= glob[0] && c <= glob[2]);
+			glob += 2;
+		}
+		else
+		{
+			match |= (c == *glob);
+		}
+	}
+
+	// skip ']'
+	if (*glob == ']')
+		glob++;
+
+	return match != negate;
+}
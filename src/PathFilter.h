@@ -0,0 +1,40 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <regex>
+#include <fnd/types.h>
+
+// selects files by their path in a file system ("/dir/file") with include and exclude patterns.
+// a pattern is a glob ("*" and "?" stop at '/', "**" does not, "[a-z]" and "[!a-z]" are character sets), matched against the file name if it has no '/', otherwise against the whole path.
+// a pattern prefixed with "re:" is instead a regular expression (ECMAScript), searched for in the whole path.
+class PathFilter
+{
+public:
+	PathFilter();
+
+	// throws if a regular expression pattern is invalid
+	void addInclude(const std::string& pattern);
+	void addExclude(const std::string& pattern);
+
+	// a path is selected if it matches any include pattern (or there are none) and no exclude pattern
+	bool isSelected(const std::string& path) const;
+private:
+	const std::string kModuleName = "PathFilter";
+	const std::string kRegexPrefix = "re:";
+
+	struct sPattern
+	{
+		bool is_regex;
+		bool match_name;
+		std::string glob;
+		std::regex regex;
+	};
+
+	std::vector<sPattern> mIncludeList;
+	std::vector<sPattern> mExcludeList;
+
+	sPattern createPattern(const std::string& pattern) const;
+	static bool isMatch(const sPattern& pattern, const std::string& path);
+	static bool matchGlob(const char* glob, const char* str);
+	static bool matchCharSet(const char*& glob, char c);
+};
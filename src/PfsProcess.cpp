@@ -2,21 +2,35 @@
 
 #include <iostream>
 #include <iomanip>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
 
 #include <fnd/SimpleFile.h>
 #include <fnd/io.h>
 
 #include <nn/hac/PartitionFsUtil.h>
 
+#include "ThreadPool.h"
+#include "MemoryMappedFile.h"
+#include "ExtractUtil.h"
+#include "Sha256Engine.h"
+
 
 PfsProcess::PfsProcess() :
 	mFile(),
+	mFileFactory(),
 	mCliOutputMode(_BIT(OUTPUT_BASIC)),
 	mVerify(false),
 	mExtractPath(),
 	mExtract(false),
 	mMountName(),
 	mListFs(false),
+	mThreadNum(1),
+	mStreamInput(false),
+	mExtractFilter(),
+	mExtractArchive(),
 	mPfs()
 {
 }
@@ -31,6 +45,12 @@ void PfsProcess::process()
 		if (mListFs || _HAS_BIT(mCliOutputMode, OUTPUT_EXTENDED))
 			displayFs();
 	}
+	if (mStreamInput)
+	{
+		// the input can only be read forwards, so verification and extraction is done in one pass
+		processFsStream();
+		return;
+	}
 	if (mPfs.getFsType() == mPfs.TYPE_HFS0 && mVerify)
 		validateHfs();
 	if (mExtract)
@@ -42,6 +62,11 @@ void PfsProcess::setInputFile(const fnd::SharedPtr<fnd::IFile>& file)
 	mFile = file;
 }
 
+void PfsProcess::setInputFileFactory(const IFileFactory& factory)
+{
+	mFileFactory = factory;
+}
+
 void PfsProcess::setCliOutputMode(CliOutputMode type)
 {
 	mCliOutputMode = type;
@@ -68,6 +93,26 @@ void PfsProcess::setListFs(bool list_fs)
 	mListFs = list_fs;
 }
 
+void PfsProcess::setThreadNum(size_t thread_num)
+{
+	mThreadNum = thread_num;
+}
+
+void PfsProcess::setStreamInput(bool stream_input)
+{
+	mStreamInput = stream_input;
+}
+
+void PfsProcess::setExtractFilter(const std::shared_ptr<const PathFilter>& filter)
+{
+	mExtractFilter = filter;
+}
+
+void PfsProcess::setExtractArchive(const std::shared_ptr<TarWriter>& archive)
+{
+	mExtractArchive = archive;
+}
+
 const nn::hac::PartitionFsHeader& PfsProcess::getPfsHeader() const
 {
 	return mPfs;
@@ -91,10 +136,18 @@ void PfsProcess::importHeader()
 	}
 	size_t pfsHeaderSize = determineHeaderSize(((nn::hac::sPfsHeader*)scratch.data()));
 	
-	// open minimum header to get full header size
-	scratch.alloc(pfsHeaderSize);
-	(*mFile)->read(scratch.data(), 0, scratch.size());
-	mPfs.fromBytes(scratch.data(), scratch.size());
+	// import full header, directly from the mapping if the file is memory mapped
+	const byte_t* mapped_header = MemoryMappedFile::getMappedData(mFile, 0, pfsHeaderSize);
+	if (mapped_header != nullptr)
+	{
+		mPfs.fromBytes(mapped_header, pfsHeaderSize);
+	}
+	else
+	{
+		scratch.alloc(pfsHeaderSize);
+		(*mFile)->read(scratch.data(), 0, scratch.size());
+		mPfs.fromBytes(scratch.data(), scratch.size());
+	}
 }
 
 void PfsProcess::displayHeader()
@@ -166,34 +219,215 @@ void PfsProcess::validateHfs()
 	}
 }
 
+bool PfsProcess::isSelectedForExtract(const nn::hac::PartitionFsHeader::sFile& file) const
+{
+	return mExtractFilter == nullptr || mExtractFilter->isSelected("/" + file.name);
+}
+
 void PfsProcess::extractFs()
 {
-	// allocate only when extractDir is invoked
-	mCache.alloc(kCacheSize);
+	std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+	const fnd::List<nn::hac::PartitionFsHeader::sFile>& file = mPfs.getFileList();
+
+	// files not selected by the filter are never read
+	std::vector<size_t> extract_list;
+	uint64_t total_size = 0;
+	for (size_t i = 0; i < file.size(); i++)
+	{
+		if (isSelectedForExtract(file[i]))
+		{
+			extract_list.push_back(i);
+			total_size += file[i].size;
+		}
+	}
+
+	// the files are extracted in the order they are stored (which need not be the order they are listed in), to read the input in one sweep
+	std::stable_sort(extract_list.begin(), extract_list.end(), [&file](size_t a, size_t b) { return file[a].offset < file[b].offset; });
 
 	// make extract dir
-	fnd::io::makeDirectory(mExtractPath);
+	if (mExtractArchive != nullptr)
+		mExtractArchive->addDirectory(mExtractPath);
+	else
+		fnd::io::makeDirectory(mExtractPath);
+
+	// an archive is written in one stream, so it is only written by this thread
+	if (mThreadNum > 1 && mFileFactory != nullptr && mExtractArchive == nullptr)
+	{
+		extractFsMultiThreaded(extract_list);
+	}
+	else
+	{
+		// allocate only when extractDir is invoked
+		mCache.alloc(kCacheSize);
+
+		std::string file_path;
+		for (size_t i = 0; i < extract_list.size(); i++)
+		{
+			const nn::hac::PartitionFsHeader::sFile& entry = file[extract_list[i]];
+
+			file_path.clear();
+			fnd::io::appendToPath(file_path, mExtractPath);
+			fnd::io::appendToPath(file_path, entry.name);
+
+			if (_HAS_BIT(mCliOutputMode, OUTPUT_BASIC))
+				std::cout << "extract=[" << file_path << "]" << std::endl;
+
+			if (mExtractArchive != nullptr)
+				mExtractArchive->addFile(file_path, **mFile, entry.offset, entry.size, mCache);
+			else
+				ExtractUtil::extractFile(**mFile, entry.offset, entry.size, file_path, mCache);
+		}
+	}
+
+	if (_HAS_BIT(mCliOutputMode, OUTPUT_BASIC))
+	{
+		displayExtractThroughput(extract_list.size(), total_size, std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count());
+	}
+}
 
-	fnd::SimpleFile outFile;
+void PfsProcess::extractFsMultiThreaded(const std::vector<size_t>& extract_list)
+{
 	const fnd::List<nn::hac::PartitionFsHeader::sFile>& file = mPfs.getFileList();
 
+	// each worker lazily creates its own reader and cache, as the readers are not thread safe
+	std::vector<fnd::SharedPtr<fnd::IFile>> worker_file(mThreadNum);
+	std::vector<fnd::Vec<byte_t>> worker_cache(mThreadNum);
+	std::mutex output_lock;
+
+	ThreadPool pool(mThreadNum);
+	for (size_t i = 0; i < extract_list.size(); i++)
+	{
+		const nn::hac::PartitionFsHeader::sFile& entry = file[extract_list[i]];
+
+		pool.enqueue([this, &entry, &worker_file, &worker_cache, &output_lock](size_t thread_index) {
+			fnd::SharedPtr<fnd::IFile>& in_file = worker_file[thread_index];
+			fnd::Vec<byte_t>& cache = worker_cache[thread_index];
+
+			if (*in_file == nullptr)
+			{
+				in_file = mFileFactory();
+				cache.alloc(kCacheSize);
+			}
+
+			std::string file_path;
+			fnd::io::appendToPath(file_path, mExtractPath);
+			fnd::io::appendToPath(file_path, entry.name);
+
+			if (_HAS_BIT(mCliOutputMode, OUTPUT_BASIC))
+			{
+				std::lock_guard<std::mutex> lock(output_lock);
+				std::cout << "extract=[" << file_path << "]" << std::endl;
+			}
+
+			ExtractUtil::extractFile(**in_file, entry.offset, entry.size, file_path, cache);
+		});
+	}
+	pool.wait();
+}
+
+void PfsProcess::processFsStream()
+{
+	bool verify = mPfs.getFsType() == mPfs.TYPE_HFS0 && mVerify;
+	if (verify == false && mExtract == false)
+		return;
+
+	std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+	const fnd::List<nn::hac::PartitionFsHeader::sFile>& file = mPfs.getFileList();
+
+	// visit the files in the order they are stored, so the input is never read backwards
+	std::vector<size_t> file_order(file.size());
+	for (size_t i = 0; i < file_order.size(); i++)
+		file_order[i] = i;
+	std::stable_sort(file_order.begin(), file_order.end(), [&file](size_t a, size_t b) { return file[a].offset < file[b].offset; });
+
+	if (mExtract && mExtractArchive != nullptr)
+		mExtractArchive->addDirectory(mExtractPath);
+	else if (mExtract)
+		fnd::io::makeDirectory(mExtractPath);
+	mCache.alloc(kCacheSize);
+
+	fnd::Vec<byte_t> hash_protected_data;
+	fnd::sha::sSha256Hash hash;
 	std::string file_path;
-	for (size_t i = 0; i < file.size(); i++)
+	size_t extract_num = 0;
+	uint64_t total_size = 0;
+	for (size_t i = 0; i < file_order.size(); i++)
 	{
-		file_path.clear();
-		fnd::io::appendToPath(file_path, mExtractPath);
-		fnd::io::appendToPath(file_path, file[i].name);
+		const nn::hac::PartitionFsHeader::sFile& entry = file[file_order[i]];
+
+		// files not selected by the filter are skipped over, unless they are read to be verified
+		bool extract = mExtract && isSelectedForExtract(entry);
+		if (extract == false && verify == false)
+			continue;
+
+		fnd::SimpleFile out_file;
+		if (extract)
+		{
+			extract_num++;
+			total_size += entry.size;
+
+			file_path.clear();
+			fnd::io::appendToPath(file_path, mExtractPath);
+			fnd::io::appendToPath(file_path, entry.name);
+
+			if (_HAS_BIT(mCliOutputMode, OUTPUT_BASIC))
+				std::cout << "extract=[" << file_path << "]" << std::endl;
+
+			if (mExtractArchive != nullptr)
+				mExtractArchive->beginFile(file_path, entry.size);
+			else
+				out_file.open(file_path, fnd::SimpleFile::Create);
+		}
+
+		// the hash protected region is collected as it streams past, then hashed once complete
+		size_t read_size = extract ? entry.size : 0;
+		if (verify)
+		{
+			hash_protected_data.alloc(entry.hash_protected_size);
+			read_size = _MAX(read_size, (size_t)entry.hash_protected_size);
+		}
+
+		(*mFile)->seek(entry.offset);
+		for (size_t pos = 0; pos < read_size; pos += mCache.size())
+		{
+			size_t chunk_size = _MIN(read_size - pos, mCache.size());
+			(*mFile)->read(mCache.data(), chunk_size);
 
-		if (_HAS_BIT(mCliOutputMode, OUTPUT_BASIC))
-			printf("extract=[%s]\n", file_path.c_str());
+			if (verify && pos < hash_protected_data.size())
+				memcpy(hash_protected_data.data() + pos, mCache.data(), _MIN(chunk_size, hash_protected_data.size() - pos));
+			if (extract && pos < entry.size && mExtractArchive != nullptr)
+				mExtractArchive->write(mCache.data(), _MIN(chunk_size, entry.size - pos));
+			else if (extract && pos < entry.size)
+				out_file.write(mCache.data(), _MIN(chunk_size, entry.size - pos));
+		}
+
+		if (extract && mExtractArchive != nullptr)
+			mExtractArchive->endFile();
 
-		outFile.open(file_path, outFile.Create);
-		(*mFile)->seek(file[i].offset);
-		for (size_t j = 0; j < ((file[i].size / kCacheSize) + ((file[i].size % kCacheSize) != 0)); j++)
+		if (verify)
 		{
-			(*mFile)->read(mCache.data(), _MIN(file[i].size - (kCacheSize * j),kCacheSize));
-			outFile.write(mCache.data(), _MIN(file[i].size - (kCacheSize * j),kCacheSize));
-		}		
-		outFile.close();
+			Sha256Engine::hash(hash_protected_data.data(), hash_protected_data.size(), hash.bytes);
+			if (hash != entry.hash)
+			{
+				printf("[WARNING] HFS0 %s%s%s: FAIL (bad hash)\n", !mMountName.empty()? mMountName.c_str() : "", (!mMountName.empty() && mMountName.at(mMountName.length()-1) != '/' )? "/" : "", entry.name.c_str());
+			}
+		}
 	}
-}
\ No newline at end of file
+
+	if (mExtract && _HAS_BIT(mCliOutputMode, OUTPUT_BASIC))
+	{
+		displayExtractThroughput(extract_num, total_size, std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count());
+	}
+}
+
+void PfsProcess::displayExtractThroughput(size_t file_num, uint64_t total_size, double elapsed_sec)
+{
+	double total_mib = (double)total_size / (double)(1024 * 1024);
+
+	std::cout << "extracted " << std::dec << file_num << " file(s), " << std::fixed << std::setprecision(2) << total_mib << " MiB in " << elapsed_sec << " sec";
+	if (elapsed_sec > 0)
+		std::cout << " (" << (total_mib / elapsed_sec) << " MiB/s)";
+	std::cout << std::defaultfloat << std::endl;
+}
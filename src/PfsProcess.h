@@ -1,11 +1,15 @@
 #pragma once
 #include <string>
+#include <vector>
+#include <memory>
 #include <fnd/types.h>
 #include <fnd/IFile.h>
 #include <fnd/SharedPtr.h>
 #include <nn/hac/PartitionFsHeader.h>
 
 #include "common.h"
+#include "PathFilter.h"
+#include "TarWriter.h"
 
 class PfsProcess
 {
@@ -16,6 +20,7 @@ public:
 
 	// generic
 	void setInputFile(const fnd::SharedPtr<fnd::IFile>& file);
+	void setInputFileFactory(const IFileFactory& factory);
 	void setCliOutputMode(CliOutputMode type);
 	void setVerifyMode(bool verify);
 
@@ -23,6 +28,12 @@ public:
 	void setMountPointName(const std::string& mount_name);
 	void setExtractPath(const std::string& path);
 	void setListFs(bool list_fs);
+	void setThreadNum(size_t thread_num);
+	void setStreamInput(bool stream_input);
+	// only the files selected by the filter are extracted (and read), matched against "/<file name>"
+	void setExtractFilter(const std::shared_ptr<const PathFilter>& filter);
+	// extracted files and the extract directory are written to the archive (named by their extract path) instead of to disk
+	void setExtractArchive(const std::shared_ptr<TarWriter>& archive);
 
 	const nn::hac::PartitionFsHeader& getPfsHeader() const;
 
@@ -31,6 +42,7 @@ private:
 	static const size_t kCacheSize = 0x10000;
 
 	fnd::SharedPtr<fnd::IFile> mFile;
+	IFileFactory mFileFactory;
 	CliOutputMode mCliOutputMode;
 	bool mVerify;
 
@@ -38,6 +50,10 @@ private:
 	bool mExtract;
 	std::string mMountName;
 	bool mListFs;
+	size_t mThreadNum;
+	bool mStreamInput;
+	std::shared_ptr<const PathFilter> mExtractFilter;
+	std::shared_ptr<TarWriter> mExtractArchive;
 
 	fnd::Vec<byte_t> mCache;
 
@@ -49,5 +65,9 @@ private:
 	size_t determineHeaderSize(const nn::hac::sPfsHeader* hdr);
 	bool validateHeaderMagic(const nn::hac::sPfsHeader* hdr);
 	void validateHfs();
+	bool isSelectedForExtract(const nn::hac::PartitionFsHeader::sFile& file) const;
 	void extractFs();
+	void extractFsMultiThreaded(const std::vector<size_t>& extract_list);
+	void processFsStream();
+	void displayExtractThroughput(size_t file_num, uint64_t total_size, double elapsed_sec);
 };
\ No newline at end of file
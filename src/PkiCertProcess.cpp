@@ -8,6 +8,7 @@
 
 PkiCertProcess::PkiCertProcess() :
 	mFile(),
+	mKeyCfg(KeyConfiguration::getEmptyKeyCfg()),
 	mCliOutputMode(_BIT(OUTPUT_BASIC)),
 	mVerify(false)
 {
@@ -29,7 +30,7 @@ void PkiCertProcess::setInputFile(const fnd::SharedPtr<fnd::IFile>& file)
 	mFile = file;
 }
 
-void PkiCertProcess::setKeyCfg(const KeyConfiguration& keycfg)
+void PkiCertProcess::setKeyCfg(const std::shared_ptr<const KeyConfiguration>& keycfg)
 {
 	mKeyCfg = keycfg;
 }
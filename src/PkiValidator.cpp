@@ -4,12 +4,13 @@
 #include <nn/pki/SignUtils.h>
 #include "PkiValidator.h"
 
-PkiValidator::PkiValidator()
+PkiValidator::PkiValidator() :
+	mKeyCfg(KeyConfiguration::getEmptyKeyCfg())
 {
 	clearCertificates();
 }
 
-void PkiValidator::setKeyCfg(const KeyConfiguration& keycfg)
+void PkiValidator::setKeyCfg(const std::shared_ptr<const KeyConfiguration>& keycfg)
 {
 	// save a copy of the certificate bank
 	fnd::List<nn::pki::SignedData<nn::pki::CertificateBody>> old_certs = mCertificateBank;
@@ -102,15 +103,15 @@ void PkiValidator::validateSignature(const std::string& issuer, nn::pki::sign::S
 		fnd::rsa::sRsa2048Key rsa2048_pub;
 		fnd::ecdsa::sEcdsa240Key ecdsa_pub;
 
-		if (mKeyCfg.getPkiRootSignKey(issuer, rsa4096_pub) == true && sign_algo == nn::pki::sign::SIGN_ALGO_RSA4096)
+		if (mKeyCfg->getPkiRootSignKey(issuer, rsa4096_pub) == true && sign_algo == nn::pki::sign::SIGN_ALGO_RSA4096)
 		{
 			sig_validate_res = fnd::rsa::pkcs::rsaVerify(rsa4096_pub, getCryptoHashAlgoFromEsSignHashAlgo(hash_algo), hash.data(), signature.data()); 
 		}
-		else if (mKeyCfg.getPkiRootSignKey(issuer, rsa2048_pub) == true && sign_algo == nn::pki::sign::SIGN_ALGO_RSA2048)
+		else if (mKeyCfg->getPkiRootSignKey(issuer, rsa2048_pub) == true && sign_algo == nn::pki::sign::SIGN_ALGO_RSA2048)
 		{
 			sig_validate_res = fnd::rsa::pkcs::rsaVerify(rsa2048_pub, getCryptoHashAlgoFromEsSignHashAlgo(hash_algo), hash.data(), signature.data()); 
 		}
-		else if (mKeyCfg.getPkiRootSignKey(issuer, ecdsa_pub) == true && sign_algo == nn::pki::sign::SIGN_ALGO_ECDSA240)
+		else if (mKeyCfg->getPkiRootSignKey(issuer, ecdsa_pub) == true && sign_algo == nn::pki::sign::SIGN_ALGO_ECDSA240)
 		{
 			throw fnd::Exception(kModuleName, "ECDSA signatures are not supported");
 		}
@@ -13,7 +13,7 @@ class PkiValidator
 public:
 	PkiValidator();
 
-	void setKeyCfg(const KeyConfiguration& keycfg);
+	void setKeyCfg(const std::shared_ptr<const KeyConfiguration>& keycfg);
 	void addCertificates(const fnd::List<nn::pki::SignedData<nn::pki::CertificateBody>>& certs);
 	void addCertificate(const nn::pki::SignedData<nn::pki::CertificateBody>& cert);
 	void clearCertificates();
@@ -23,7 +23,7 @@ public:
 private:
 	const std::string kModuleName = "NNPkiValidator";
 
-	KeyConfiguration mKeyCfg;
+	std::shared_ptr<const KeyConfiguration> mKeyCfg;
 	fnd::List<nn::pki::SignedData<nn::pki::CertificateBody>> mCertificateBank;
 
 	void makeCertIdent(const nn::pki::SignedData<nn::pki::CertificateBody>& cert, std::string& ident) const;
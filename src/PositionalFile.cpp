@@ -0,0 +1,133 @@
+#include "PositionalFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <fnd/StringConv.h>
+#else
+#include <cerrno>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+PositionalFile::PositionalFile(const std::string& path) :
+	mFileHandle(INVALID_HANDLE_VALUE),
+	mSize(0),
+	mOffset(0)
+{
+	LARGE_INTEGER file_size;
+
+	mFileHandle = CreateFileW((LPCWSTR)fnd::StringConv::ConvertChar8ToChar16(path).c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (mFileHandle == INVALID_HANDLE_VALUE)
+	{
+		throw fnd::Exception(kModuleName, "Failed to open file");
+	}
+
+	if (GetFileSizeEx(mFileHandle, &file_size) == false)
+	{
+		CloseHandle(mFileHandle);
+		throw fnd::Exception(kModuleName, "Failed to determine file size");
+	}
+	mSize = (size_t)file_size.QuadPart;
+}
+
+PositionalFile::~PositionalFile()
+{
+	CloseHandle(mFileHandle);
+}
+#else
+PositionalFile::PositionalFile(const std::string& path) :
+	mFileDescriptor(-1),
+	mSize(0),
+	mOffset(0)
+{
+	struct stat st;
+
+	mFileDescriptor = open(path.c_str(), O_RDONLY);
+	if (mFileDescriptor == -1)
+	{
+		throw fnd::Exception(kModuleName, "Failed to open file");
+	}
+
+	if (fstat(mFileDescriptor, &st) != 0)
+	{
+		close(mFileDescriptor);
+		throw fnd::Exception(kModuleName, "Failed to determine file size");
+	}
+	mSize = (size_t)st.st_size;
+}
+
+PositionalFile::~PositionalFile()
+{
+	close(mFileDescriptor);
+}
+#endif
+
+size_t PositionalFile::size()
+{
+	return mSize;
+}
+
+void PositionalFile::seek(size_t offset)
+{
+	mOffset = _MIN(offset, mSize);
+}
+
+void PositionalFile::read(byte_t* out, size_t len)
+{
+	readAt(out, mOffset, len);
+	mOffset += len;
+}
+
+void PositionalFile::read(byte_t* out, size_t offset, size_t len)
+{
+	seek(offset);
+	read(out, len);
+}
+
+void PositionalFile::readAt(byte_t* out, size_t offset, size_t len)
+{
+	if (offset > mSize || len > mSize - offset)
+	{
+		throw fnd::Exception(kModuleName, "Failed to read from file (read past end of file)");
+	}
+
+	// reads may return less than asked for, so read until len bytes have been read
+	while (len > 0)
+	{
+#ifdef _WIN32
+		OVERLAPPED overlapped = {0};
+		overlapped.Offset = (DWORD)((uint64_t)offset & 0xffffffff);
+		overlapped.OffsetHigh = (DWORD)((uint64_t)offset >> 32);
+
+		DWORD read_len = 0;
+		if (ReadFile(mFileHandle, out, (DWORD)_MIN(len, (size_t)0x40000000), &read_len, &overlapped) == false || read_len == 0)
+		{
+			throw fnd::Exception(kModuleName, "Failed to read from file");
+		}
+#else
+		ssize_t read_len = pread(mFileDescriptor, out, len, (off_t)offset);
+		if (read_len == -1 && errno == EINTR)
+			continue;
+		if (read_len <= 0)
+		{
+			throw fnd::Exception(kModuleName, "Failed to read from file");
+		}
+#endif
+
+		out += read_len;
+		offset += read_len;
+		len -= read_len;
+	}
+}
+
+void PositionalFile::write(const byte_t* out, size_t len)
+{
+	throw fnd::Exception(kModuleName, "write() not supported");
+}
+
+void PositionalFile::write(const byte_t* out, size_t offset, size_t len)
+{
+	throw fnd::Exception(kModuleName, "write() not supported");
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <string>
+#include <fnd/types.h>
+#include <fnd/IFile.h>
+#include "IReadAtFile.h"
+
+// read-only file on disk read with pread() (ReadFile() at an offset on Windows), used in place of fnd::SimpleFile when the input is not memory mapped,
+// as there is no shared file position one handle can be read by many threads
+class PositionalFile : public IReadAtFile
+{
+public:
+	PositionalFile(const std::string& path);
+	~PositionalFile();
+
+	size_t size();
+	void seek(size_t offset);
+	void read(byte_t* out, size_t len);
+	void read(byte_t* out, size_t offset, size_t len);
+	void readAt(byte_t* out, size_t offset, size_t len);
+	void write(const byte_t* out, size_t len);
+	void write(const byte_t* out, size_t offset, size_t len);
+private:
+	const std::string kModuleName = "PositionalFile";
+
+#ifdef _WIN32
+	void* mFileHandle; // HANDLE
+#else
+	int mFileDescriptor;
+#endif
+	size_t mSize;
+	size_t mOffset;
+};
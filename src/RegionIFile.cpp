@@ -0,0 +1,56 @@
+#include "RegionIFile.h"
+
+RegionIFile::RegionIFile(const fnd::SharedPtr<fnd::IFile>& file, size_t offset, size_t size) :
+	mFile(file),
+	mBaseOffset(offset),
+	mSize(size),
+	mOffset(0)
+{
+}
+
+size_t RegionIFile::size()
+{
+	return mSize;
+}
+
+void RegionIFile::seek(size_t offset)
+{
+	mOffset = _MIN(offset, mSize);
+}
+
+void RegionIFile::read(byte_t* out, size_t len)
+{
+	readAt(out, mOffset, len);
+	mOffset += len;
+}
+
+void RegionIFile::read(byte_t* out, size_t offset, size_t len)
+{
+	seek(offset);
+	read(out, len);
+}
+
+void RegionIFile::readAt(byte_t* out, size_t offset, size_t len)
+{
+	if (offset > mSize || len > mSize - offset)
+	{
+		throw fnd::Exception(kModuleName, "Failed to read from file (read past end of file)");
+	}
+
+	readFileAt(**mFile, out, mBaseOffset + offset, len);
+}
+
+uint64_t RegionIFile::getStorageOrder(size_t offset)
+{
+	return getFileStorageOrder(**mFile, mBaseOffset + offset);
+}
+
+void RegionIFile::write(const byte_t* out, size_t len)
+{
+	throw fnd::Exception(kModuleName, "write() not supported");
+}
+
+void RegionIFile::write(const byte_t* out, size_t offset, size_t len)
+{
+	throw fnd::Exception(kModuleName, "write() not supported");
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+#include <fnd/IFile.h>
+#include <fnd/SharedPtr.h>
+#include "IReadAtFile.h"
+
+// view of [offset, offset+size) of another reader, like fnd::OffsetAdjustedIFile but reads are bounds checked and can be made with readAt()
+class RegionIFile : public IReadAtFile
+{
+public:
+	RegionIFile(const fnd::SharedPtr<fnd::IFile>& file, size_t offset, size_t size);
+
+	size_t size();
+	void seek(size_t offset);
+	void read(byte_t* out, size_t len);
+	void read(byte_t* out, size_t offset, size_t len);
+	void readAt(byte_t* out, size_t offset, size_t len);
+	uint64_t getStorageOrder(size_t offset);
+	void write(const byte_t* out, size_t len);
+	void write(const byte_t* out, size_t offset, size_t len);
+private:
+	const std::string kModuleName = "RegionIFile";
+
+	fnd::SharedPtr<fnd::IFile> mFile;
+	size_t mBaseOffset;
+	size_t mSize;
+	size_t mOffset;
+};
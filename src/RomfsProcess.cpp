@@ -1,40 +1,73 @@
 #include <iostream>
 #include <iomanip>
+#include <mutex>
+#include <algorithm>
 #include <fnd/SimpleTextOutput.h>
 #include <fnd/SimpleFile.h>
 #include <fnd/io.h>
 #include "CompressedArchiveIFile.h"
 #include "RomfsProcess.h"
+#include "MemoryMappedFile.h"
+#include "ExtractUtil.h"
+#include "ThreadPool.h"
+#include "ErofsWriter.h"
+#include "IReadAtFile.h"
 
 RomfsProcess::RomfsProcess() :
 	mFile(),
+	mFileFactory(),
 	mCliOutputMode(_BIT(OUTPUT_BASIC)),
 	mVerify(false),
 	mExtractPath(),
 	mExtract(false),
+	mExtractFilePath(),
+	mExtractFilter(),
+	mExtractArchive(),
+	mErofsImagePath(),
 	mMountName(),
 	mListFs(false),
+	mThreadNum(1),
+	mBlockCacheSize(CompressedArchiveIFile::kDefaultCacheSize),
+	mDecompressPool(),
 	mDirNum(0),
-	mFileNum(0)
+	mFileNum(0),
+	mDirNodeTable(nullptr),
+	mFileNodeTable(nullptr),
+	mDirList(),
+	mFileList(),
+	mDirSelected(),
+	mFileSelected()
 {
-	mRootDir.name.clear();
-	mRootDir.dir_list.clear();
-	mRootDir.file_list.clear();
 }
 
 void RomfsProcess::process()
 {
-	resolveRomfs();	
+	importHeader();
+
+	// extracting a single file needs only the nodes on its path, and listing is streamed from the node tables,
+	// so the file system is only indexed when all of it is extracted
+	bool list_fs = _HAS_BIT(mCliOutputMode, OUTPUT_BASIC) && (mListFs || _HAS_BIT(mCliOutputMode, OUTPUT_EXTENDED));
+	if (mExtractFilePath.isSet == false || list_fs || mErofsImagePath.isSet)
+		importNodeTables();
+	if ((mExtract && mExtractFilePath.isSet == false) || mErofsImagePath.isSet)
+		importFs();
+	else if (mDirNodeTable != nullptr && _HAS_BIT(mCliOutputMode, OUTPUT_BASIC))
+		countFs();
 
 	if (_HAS_BIT(mCliOutputMode, OUTPUT_BASIC))
 	{
 		displayHeader();
-		if (mListFs || _HAS_BIT(mCliOutputMode, OUTPUT_EXTENDED))
+		if (list_fs)
 			displayFs();
 	}
 
-	if (mExtract)
-		extractFs();	
+	if (mExtractFilePath.isSet)
+		extractSingleFile();
+	else if (mExtract)
+		extractFs();
+
+	if (mErofsImagePath.isSet)
+		writeErofsImage();
 }
 
 void RomfsProcess::setInputFile(const fnd::SharedPtr<fnd::IFile>& file)
@@ -42,6 +75,11 @@ void RomfsProcess::setInputFile(const fnd::SharedPtr<fnd::IFile>& file)
 	mFile = file;
 }
 
+void RomfsProcess::setInputFileFactory(const IFileFactory& factory)
+{
+	mFileFactory = factory;
+}
+
 void RomfsProcess::setCliOutputMode(CliOutputMode type)
 {
 	mCliOutputMode = type;
@@ -68,53 +106,162 @@ void RomfsProcess::setListFs(bool list_fs)
 	mListFs = list_fs;
 }
 
-const RomfsProcess::sDirectory& RomfsProcess::getRootDir() const
+void RomfsProcess::setThreadNum(size_t thread_num)
 {
-	return mRootDir;
+	mThreadNum = thread_num;
 }
 
-void RomfsProcess::printTab(size_t tab) const
+void RomfsProcess::setBlockCacheSize(size_t size)
 {
-	for (size_t i = 0; i < tab; i++)
-	{
-		std::cout << "  ";
-	}
+	mBlockCacheSize = size;
 }
 
-void RomfsProcess::displayFile(const sFile& file, size_t tab) const
+void RomfsProcess::setExtractFilePath(const std::string& romfs_path)
 {
-	printTab(tab);
-	std::cout << file.name;
-	if (_HAS_BIT(mCliOutputMode, OUTPUT_LAYOUT))
-	{
-		std::cout << std::hex << " (offset=0x" << file.offset << ", size=0x" << file.size << ")";
-	}
-	std::cout << std::endl;
+	mExtractFilePath = romfs_path;
 }
 
-void RomfsProcess::displayDir(const sDirectory& dir, size_t tab) const
+void RomfsProcess::setExtractFilter(const std::shared_ptr<const PathFilter>& filter)
 {
-	if (dir.name.empty() == false)
+	mExtractFilter = filter;
+}
+
+void RomfsProcess::setExtractArchive(const std::shared_ptr<TarWriter>& archive)
+{
+	mExtractArchive = archive;
+}
+
+void RomfsProcess::setErofsImagePath(const std::string& path)
+{
+	mErofsImagePath = path;
+}
+
+const std::vector<RomfsProcess::sDirEntry>& RomfsProcess::getDirList() const
+{
+	return mDirList;
+}
+
+const std::vector<RomfsProcess::sFileEntry>& RomfsProcess::getFileList() const
+{
+	return mFileList;
+}
+
+void RomfsProcess::traverseFs(const FsVisitor& visitor)
+{
+	if (mDirNodeTable == nullptr || mFileNodeTable == nullptr)
 	{
-		printTab(tab);
-		std::cout << dir.name << std::endl;
+		throw fnd::Exception(kModuleName, "Node tables not imported.");
+	}
+
+	// every node is at least as large as its header, so a corrupted image that links nodes in a loop is caught once this many have been visited
+	size_t max_dir_num = mHdr.sections[nn::hac::romfs::DIR_NODE_TABLE].size.get() / sizeof(nn::hac::sRomfsDirEntry);
+	size_t max_file_num = mHdr.sections[nn::hac::romfs::FILE_NODE_TABLE].size.get() / sizeof(nn::hac::sRomfsFileEntry);
+	size_t dir_num = 0;
+	size_t file_num = 0;
+
+	// the directories from the root to the one being visited, and the next sub directory of each to visit
+	struct sOpenDir
+	{
+		uint32_t dir_addr;
+		uint32_t next_child_addr;
+		size_t path_len;
+	};
+	std::vector<sOpenDir> open_dir;
+	std::string path;
+
+	open_dir.push_back({0, get_dir_node(0)->child.get(), 0});
+	while (open_dir.empty() == false)
+	{
+		sOpenDir dir = open_dir.back();
+		path.resize(dir.path_len);
+
+		if (dir.next_child_addr != nn::hac::romfs::kInvalidAddr)
+		{
+			if (++dir_num > max_dir_num)
+			{
+				throw fnd::Exception(kModuleName, "RomFs appears corrupted (directory node loop)");
+			}
+
+			const nn::hac::sRomfsDirEntry* c_node = get_dir_node(dir.next_child_addr);
+			open_dir.back().next_child_addr = c_node->sibling.get();
+
+			path += '/';
+			path.append(c_node->name(), c_node->name_size.get());
+			visitor(path, {true, open_dir.size(), c_node->name(), c_node->name_size.get(), 0, 0});
+
+			open_dir.push_back({dir.next_child_addr, c_node->child.get(), path.length()});
+		}
+		else
+		{
+			// the sub directories have all been visited, so the files are next
+			for (uint32_t file_addr = get_dir_node(dir.dir_addr)->file.get(); file_addr != nn::hac::romfs::kInvalidAddr; )
+			{
+				if (++file_num > max_file_num)
+				{
+					throw fnd::Exception(kModuleName, "RomFs appears corrupted (file node loop)");
+				}
+
+				const nn::hac::sRomfsFileEntry* f_node = get_file_node(file_addr);
+
+				path.resize(dir.path_len);
+				path += '/';
+				path.append(f_node->name(), f_node->name_size.get());
+				visitor(path, {false, open_dir.size(), f_node->name(), f_node->name_size.get(), mHdr.data_offset.get() + f_node->offset.get(), f_node->size.get()});
+
+				file_addr = f_node->sibling.get();
+			}
+
+			open_dir.pop_back();
+		}
 	}
+}
 
-	for (size_t i = 0; i < dir.dir_list.size(); i++)
+bool RomfsProcess::findFile(const std::string& romfs_path, sFile& file)
+{
+	uint32_t parent_offset = 0;
+	uint32_t node_offset = 0;
+	fnd::Vec<byte_t> node;
+
+	// walk the directories of the path, from the root directory (which is always at offset 0)
+	size_t name_begin = 0;
+	for (size_t name_end = romfs_path.find('/'); name_end != std::string::npos; name_begin = name_end + 1, name_end = romfs_path.find('/', name_begin))
 	{
-		displayDir(dir.dir_list[i], tab+1);
+		// empty names from leading or repeated separators are skipped
+		if (name_end == name_begin)
+			continue;
+
+		if (findNode(nn::hac::romfs::DIR_HASHMAP_TABLE, nn::hac::romfs::DIR_NODE_TABLE, parent_offset, romfs_path.substr(name_begin, name_end - name_begin), node_offset, node) == false)
+			return false;
+		parent_offset = node_offset;
 	}
-	for (size_t i = 0; i < dir.file_list.size(); i++)
+
+	std::string file_name = romfs_path.substr(name_begin);
+	if (file_name.empty() || findNode(nn::hac::romfs::FILE_HASHMAP_TABLE, nn::hac::romfs::FILE_NODE_TABLE, parent_offset, file_name, node_offset, node) == false)
+		return false;
+
+	const nn::hac::sRomfsFileEntry* f_node = (const nn::hac::sRomfsFileEntry*)node.data();
+	file.name = file_name;
+	file.offset = mHdr.data_offset.get() + f_node->offset.get();
+	file.size = f_node->size.get();
+	return true;
+}
+
+void RomfsProcess::printTab(size_t tab) const
+{
+	for (size_t i = 0; i < tab; i++)
 	{
-		displayFile(dir.file_list[i], tab+1);
+		std::cout << "  ";
 	}
 }
 
 void RomfsProcess::displayHeader()
 {
 	std::cout << "[RomFS]" << std::endl;
-	std::cout << "  DirNum:     " << std::dec << mDirNum << std::endl;
-	std::cout << "  FileNum:    " << std::dec << mFileNum << std::endl;
+	if (mDirNodeTable != nullptr)
+	{
+		std::cout << "  DirNum:     " << std::dec << mDirNum << std::endl;
+		std::cout << "  FileNum:    " << std::dec << mFileNum << std::endl;
+	}
 	if (mMountName.empty() == false)
 	{
 		std::cout << "  MountPoint:  " << mMountName;
@@ -125,56 +272,222 @@ void RomfsProcess::displayHeader()
 }
 
 void RomfsProcess::displayFs()
-{	
-	displayDir(mRootDir, 1);
+{
+	// printed as it is traversed, so nothing needs to be kept in memory
+	traverseFs([this](const std::string& path, const sFsEntry& entry) {
+		printTab(entry.depth + 1);
+		std::cout.write(entry.name, entry.name_size);
+		if (entry.is_dir == false && _HAS_BIT(mCliOutputMode, OUTPUT_LAYOUT))
+		{
+			std::cout << std::hex << " (offset=0x" << entry.offset << ", size=0x" << entry.size << ")";
+		}
+		std::cout << std::endl;
+	});
 }
 
-void RomfsProcess::extractDir(const std::string& path, const sDirectory& dir)
+bool RomfsProcess::selectForExtract(uint32_t dir_index, const std::string& romfs_path)
 {
+	const sDirEntry& dir = mDirList[dir_index];
+	bool selected = false;
+	std::string path;
+
+	for (uint32_t file_index = dir.file; file_index != kNullIndex; file_index = mFileList[file_index].sibling)
+	{
+		path = romfs_path + "/" + std::string(mFileList[file_index].name, mFileList[file_index].name_size);
+		mFileSelected[file_index] = mExtractFilter->isSelected(path);
+		selected |= mFileSelected[file_index];
+	}
+
+	for (uint32_t child_index = dir.child; child_index != kNullIndex; child_index = mDirList[child_index].sibling)
+	{
+		path = romfs_path + "/" + std::string(mDirList[child_index].name, mDirList[child_index].name_size);
+		selected |= selectForExtract(child_index, path);
+	}
+
+	mDirSelected[dir_index] = selected;
+	return selected;
+}
+
+void RomfsProcess::makeExtractDirectory(const std::string& path)
+{
+	if (mExtractArchive != nullptr)
+		mExtractArchive->addDirectory(path);
+	else
+		fnd::io::makeDirectory(path);
+}
+
+void RomfsProcess::writeExtractFile(const std::string& path, uint64_t offset, uint64_t size)
+{
+	if (_HAS_BIT(mCliOutputMode, OUTPUT_BASIC))
+		std::cout << "extract=[" << path << "]" << std::endl;
+
+	if (mExtractArchive != nullptr)
+	{
+		// the file is read sequentially, but there is no point decompressing the entries after it
+		CompressedArchiveIFile* compressed_file = dynamic_cast<CompressedArchiveIFile*>(&(**mFile));
+		if (compressed_file != nullptr)
+			compressed_file->setReadRangeEnd(offset + size);
+
+		mExtractArchive->addFile(path, **mFile, offset, size, mCache);
+	}
+	else
+		ExtractUtil::extractFile(**mFile, offset, size, path, mCache);
+}
+
+void RomfsProcess::createExtractJobList(const std::string& path, uint32_t dir_index, std::vector<sExtractJob>& job_list)
+{
+	const sDirEntry& dir = mDirList[dir_index];
 	std::string dir_path;
 	std::string file_path;
 
 	// make dir path
 	fnd::io::appendToPath(dir_path, path);
-	if (dir.name.empty() == false)
-		fnd::io::appendToPath(dir_path, dir.name);
+	if (dir.name_size != 0)
+		fnd::io::appendToPath(dir_path, std::string(dir.name, dir.name_size));
 
-	// make directory
-	fnd::io::makeDirectory(dir_path);
+	// make directory (parents are always created before their children)
+	makeExtractDirectory(dir_path);
 
-	// extract files
-	fnd::SimpleFile outFile;
-	for (size_t i = 0; i < dir.file_list.size(); i++)
+	for (uint32_t file_index = dir.file; file_index != kNullIndex; file_index = mFileList[file_index].sibling)
 	{
+		if (isFileSelected(file_index) == false)
+			continue;
+
+		const sFileEntry& file = mFileList[file_index];
+
 		file_path.clear();
 		fnd::io::appendToPath(file_path, dir_path);
-		fnd::io::appendToPath(file_path, dir.file_list[i].name);
+		fnd::io::appendToPath(file_path, std::string(file.name, file.name_size));
 
-		if (_HAS_BIT(mCliOutputMode, OUTPUT_BASIC))
-			std::cout << "extract=[" << file_path << "]" << std::endl;	
-		
-		outFile.open(file_path, outFile.Create);
-		(*mFile)->seek(dir.file_list[i].offset);
-		for (size_t j = 0; j < ((dir.file_list[i].size / kCacheSize) + ((dir.file_list[i].size % kCacheSize) != 0)); j++)
-		{
-			(*mFile)->read(mCache.data(), _MIN(dir.file_list[i].size - (kCacheSize * j),kCacheSize));
-			outFile.write(mCache.data(), _MIN(dir.file_list[i].size - (kCacheSize * j),kCacheSize));
-		}	
-		outFile.close();
+		job_list.push_back({file_path, file.offset, file.size, IReadAtFile::getFileStorageOrder(**mFile, file.offset)});
 	}
 
-	for (size_t i = 0; i < dir.dir_list.size(); i++)
+	for (uint32_t child_index = dir.child; child_index != kNullIndex; child_index = mDirList[child_index].sibling)
 	{
-		extractDir(dir_path, dir.dir_list[i]);
+		if (isDirSelected(child_index))
+			createExtractJobList(dir_path, child_index, job_list);
 	}
 }
 
+fnd::SharedPtr<fnd::IFile> RomfsProcess::createDecompressingReader(const fnd::SharedPtr<fnd::IFile>& file) const
+{
+	CompressedArchiveIFile* reader = new CompressedArchiveIFile(file, mCompressionMetaOffset.var, mBlockCacheSize);
+
+	// every reader decompresses on the same pool, so there are never more than mThreadNum decompressions at once
+	if (mDecompressPool != nullptr)
+		reader->setPrefetch(mDecompressPool, kPrefetchEntryNum);
+
+	return reader;
+}
+
+fnd::SharedPtr<fnd::IFile> RomfsProcess::createWorkerReader() const
+{
+	fnd::SharedPtr<fnd::IFile> file = mFileFactory();
+
+	if (mCompressionMetaOffset.isSet)
+		file = createDecompressingReader(file);
+
+	return file;
+}
+
+void RomfsProcess::extractFsMultiThreaded(const std::vector<sExtractJob>& job_list)
+{
+	// each worker lazily creates its own reader stack and cache, as the readers are not thread safe
+	std::vector<fnd::SharedPtr<fnd::IFile>> worker_file(mThreadNum);
+	std::vector<fnd::Vec<byte_t>> worker_cache(mThreadNum);
+	std::mutex output_lock;
+
+	ThreadPool pool(mThreadNum);
+	for (size_t i = 0; i < job_list.size(); i++)
+	{
+		pool.enqueue([this, i, &job_list, &worker_file, &worker_cache, &output_lock](size_t thread_index) {
+			const sExtractJob& job = job_list[i];
+			fnd::SharedPtr<fnd::IFile>& file = worker_file[thread_index];
+			fnd::Vec<byte_t>& cache = worker_cache[thread_index];
+
+			if (*file == nullptr)
+			{
+				file = createWorkerReader();
+				cache.alloc(kCacheSize);
+			}
+
+			if (_HAS_BIT(mCliOutputMode, OUTPUT_BASIC))
+			{
+				std::lock_guard<std::mutex> lock(output_lock);
+				std::cout << "extract=[" << job.path << "]" << std::endl;
+			}
+
+			ExtractUtil::extractFile(**file, job.offset, job.size, job.path, cache);
+		});
+	}
+	pool.wait();
+}
 
 void RomfsProcess::extractFs()
 {
-	// allocate only when extractDir is invoked
+	// files not selected by the filter are never read, and directories that would be left empty are not created
+	if (mExtractFilter != nullptr)
+	{
+		mDirSelected.assign(mDirList.size(), false);
+		mFileSelected.assign(mFileList.size(), false);
+		selectForExtract(0, "");
+		mDirSelected[0] = true;
+	}
+
+	// the directory tree is created up front, so the files can be extracted in any order (and the workers never race to create a directory)
+	std::vector<sExtractJob> job_list;
+	createExtractJobList(mExtractPath, 0, job_list);
+
+	// the file data is not stored in the same order as the directory tree, so the files are extracted in the order they are stored to read the RomFS in one sweep,
+	// the order is resolved through the reader, as a patched RomFS has its data spread over the base and patch partitions
+	std::stable_sort(job_list.begin(), job_list.end(), [](const sExtractJob& a, const sExtractJob& b) { return a.storage_order < b.storage_order || (a.storage_order == b.storage_order && a.offset < b.offset); });
+
+	// an archive is written in one stream, so it is only written by this thread
+	if (mThreadNum > 1 && mFileFactory != nullptr && mExtractArchive == nullptr)
+	{
+		extractFsMultiThreaded(job_list);
+	}
+	else
+	{
+		mCache.alloc(kCacheSize);
+		for (size_t i = 0; i < job_list.size(); i++)
+		{
+			writeExtractFile(job_list[i].path, job_list[i].offset, job_list[i].size);
+		}
+	}
+}
+
+void RomfsProcess::extractSingleFile()
+{
+	sFile file;
+	if (findFile(mExtractFilePath.var, file) == false)
+	{
+		throw fnd::Exception(kModuleName, "File \"" + mExtractFilePath.var + "\" does not exist in the RomFS");
+	}
+
+	// without an extract path the file is written to the working directory
+	std::string file_path;
+	if (mExtract)
+	{
+		makeExtractDirectory(mExtractPath);
+		fnd::io::appendToPath(file_path, mExtractPath);
+	}
+	fnd::io::appendToPath(file_path, file.name);
+
 	mCache.alloc(kCacheSize);
-	extractDir(mExtractPath, mRootDir);
+	writeExtractFile(file_path, file.offset, file.size);
+}
+
+void RomfsProcess::writeErofsImage()
+{
+	if (_HAS_BIT(mCliOutputMode, OUTPUT_BASIC))
+	{
+		std::cout << "image=[" << mErofsImagePath.var << "]" << std::endl;
+	}
+
+	mCache.alloc(kCacheSize);
+	ErofsWriter image(mErofsImagePath.var);
+	image.writeImage(mDirList, mFileList, **mFile, mCache);
 }
 
 bool RomfsProcess::validateHeaderLayout(const nn::hac::sRomfsHeader* hdr) const
@@ -199,55 +512,79 @@ bool RomfsProcess::validateHeaderLayout(const nn::hac::sRomfsHeader* hdr) const
 	return validLayout;
 }
 
-void RomfsProcess::importDirectory(uint32_t dir_offset, sDirectory& dir)
+void RomfsProcess::importFs()
 {
-	nn::hac::sRomfsDirEntry* d_node = get_dir_node(dir_offset);
+	// every node is at least as large as its header, so a corrupted image that links nodes in a loop is caught once this many have been imported
+	size_t max_dir_num = mHdr.sections[nn::hac::romfs::DIR_NODE_TABLE].size.get() / sizeof(nn::hac::sRomfsDirEntry);
+	size_t max_file_num = mHdr.sections[nn::hac::romfs::FILE_NODE_TABLE].size.get() / sizeof(nn::hac::sRomfsFileEntry);
 
-	/*
-	printf("[DIR-NODE]\n");
-	printf("  parent=%08x\n", d_node->parent.get());
-	printf("  sibling=%08x\n", d_node->sibling.get());
-	printf("  child=%08x\n", d_node->child.get());
-	printf("  file=%08x\n", d_node->file.get());
-	printf("  hash=%08x\n", d_node->hash.get());
-	printf("  name_size=%08x\n", d_node->name_size.get());
-	printf("  name=%s\n", d_node->name);
-	*/
+	mDirList.clear();
+	mFileList.clear();
+	mDirList.reserve(max_dir_num);
+	mFileList.reserve(max_file_num);
 
-	for (uint32_t file_addr = d_node->file.get(); file_addr != nn::hac::romfs::kInvalidAddr; )
-	{
-		nn::hac::sRomfsFileEntry* f_node = get_file_node(file_addr);
+	// the node offset of each indexed directory, only needed while importing
+	std::vector<uint32_t> dir_node_offset;
+	dir_node_offset.reserve(max_dir_num);
 
-		/*
-		printf("[FILE-NODE]\n");
-		printf("  parent=%08x\n", f_node->parent.get());
-		printf("  sibling=%08x\n", f_node->sibling.get());
-		printf("  offset=%08" PRIx64 "\n", f_node->offset.get());
-		printf("  size=%08" PRIx64 "\n", f_node->size.get());
-		printf("  hash=%08x\n", f_node->hash.get());
-		printf("  name_size=%08x\n", f_node->name_size.get());
-		printf("  name=%s\n", f_node->name);
-		*/
+	mDirList.push_back({get_dir_node(0)->name(), 0, kNullIndex, kNullIndex, kNullIndex, kNullIndex});
+	dir_node_offset.push_back(0);
 
-		dir.file_list.addElement({std::string(f_node->name(), f_node->name_size.get()), mHdr.data_offset.get() + f_node->offset.get(), f_node->size.get()});
-
-		file_addr = f_node->sibling.get();
-		mFileNum++;
-	}
-
-	for (uint32_t child_addr = d_node->child.get(); child_addr != nn::hac::romfs::kInvalidAddr; )
+	// directories are indexed breadth first, the list itself is the queue of directories still to be imported
+	for (uint32_t dir_index = 0; dir_index < mDirList.size(); dir_index++)
 	{
-		nn::hac::sRomfsDirEntry* c_node = get_dir_node(child_addr);
+		const nn::hac::sRomfsDirEntry* d_node = get_dir_node(dir_node_offset[dir_index]);
 
-		dir.dir_list.addElement({std::string(c_node->name(), c_node->name_size.get())});
-		importDirectory(child_addr, dir.dir_list.atBack());
+		uint32_t prev_index = kNullIndex;
+		for (uint32_t file_addr = d_node->file.get(); file_addr != nn::hac::romfs::kInvalidAddr; )
+		{
+			if (mFileList.size() >= max_file_num)
+			{
+				throw fnd::Exception(kModuleName, "RomFs appears corrupted (file node loop)");
+			}
+
+			const nn::hac::sRomfsFileEntry* f_node = get_file_node(file_addr);
+			uint32_t file_index = (uint32_t)mFileList.size();
+
+			mFileList.push_back({f_node->name(), f_node->name_size.get(), dir_index, kNullIndex, mHdr.data_offset.get() + f_node->offset.get(), f_node->size.get()});
+			if (prev_index == kNullIndex)
+				mDirList[dir_index].file = file_index;
+			else
+				mFileList[prev_index].sibling = file_index;
+
+			prev_index = file_index;
+			file_addr = f_node->sibling.get();
+		}
 
-		child_addr = c_node->sibling.get();
-		mDirNum++;
+		prev_index = kNullIndex;
+		for (uint32_t child_addr = d_node->child.get(); child_addr != nn::hac::romfs::kInvalidAddr; )
+		{
+			if (mDirList.size() >= max_dir_num)
+			{
+				throw fnd::Exception(kModuleName, "RomFs appears corrupted (directory node loop)");
+			}
+
+			const nn::hac::sRomfsDirEntry* c_node = get_dir_node(child_addr);
+			uint32_t child_index = (uint32_t)mDirList.size();
+
+			mDirList.push_back({c_node->name(), c_node->name_size.get(), dir_index, kNullIndex, kNullIndex, kNullIndex});
+			dir_node_offset.push_back(child_addr);
+			if (prev_index == kNullIndex)
+				mDirList[dir_index].child = child_index;
+			else
+				mDirList[prev_index].sibling = child_index;
+
+			prev_index = child_index;
+			child_addr = c_node->sibling.get();
+		}
 	}
+
+	// the root directory is not counted
+	mDirNum = mDirList.size() - 1;
+	mFileNum = mFileList.size();
 }
 
-void RomfsProcess::resolveRomfs()
+void RomfsProcess::importHeader()
 {
 	if (*mFile == nullptr)
 	{
@@ -309,19 +646,37 @@ void RomfsProcess::resolveRomfs()
 			throw fnd::Exception(kModuleName, "RomFs appears corrupted (bad first compression entry)");
 		}
 
+		// decompression is spread over the worker threads, if there are any
+		if (mThreadNum > 1)
+			mDecompressPool = std::make_shared<ThreadPool>(mThreadNum);
+
 		// wrap mFile in a class to transparantly decompress the image.
-		mFile = new CompressedArchiveIFile(mFile, first_entry_offset);
+		mCompressionMetaOffset = first_entry_offset;
+		mFile = createDecompressingReader(mFile);
 	}
+}
 
-	// read directory nodes
-	mDirNodes.alloc(mHdr.sections[nn::hac::romfs::DIR_NODE_TABLE].size.get());
-	(*mFile)->read(mDirNodes.data(), mHdr.sections[nn::hac::romfs::DIR_NODE_TABLE].offset.get(), mDirNodes.size());
+void RomfsProcess::importNodeTables()
+{
+	// read directory nodes (borrowed from the mapping if the file is memory mapped)
+	mDirNodeTable = MemoryMappedFile::getMappedData(mFile, mHdr.sections[nn::hac::romfs::DIR_NODE_TABLE].offset.get(), mHdr.sections[nn::hac::romfs::DIR_NODE_TABLE].size.get());
+	if (mDirNodeTable == nullptr)
+	{
+		mDirNodes.alloc(mHdr.sections[nn::hac::romfs::DIR_NODE_TABLE].size.get());
+		(*mFile)->read(mDirNodes.data(), mHdr.sections[nn::hac::romfs::DIR_NODE_TABLE].offset.get(), mDirNodes.size());
+		mDirNodeTable = mDirNodes.data();
+	}
 	//printf("[RAW DIR NODES]\n");
 	//fnd::SimpleTextOutput::hxdStyleDump(mDirNodes.data(), mDirNodes.size());
 
-	// read file nodes
-	mFileNodes.alloc(mHdr.sections[nn::hac::romfs::FILE_NODE_TABLE].size.get());
-	(*mFile)->read(mFileNodes.data(), mHdr.sections[nn::hac::romfs::FILE_NODE_TABLE].offset.get(), mFileNodes.size());
+	// read file nodes (borrowed from the mapping if the file is memory mapped)
+	mFileNodeTable = MemoryMappedFile::getMappedData(mFile, mHdr.sections[nn::hac::romfs::FILE_NODE_TABLE].offset.get(), mHdr.sections[nn::hac::romfs::FILE_NODE_TABLE].size.get());
+	if (mFileNodeTable == nullptr)
+	{
+		mFileNodes.alloc(mHdr.sections[nn::hac::romfs::FILE_NODE_TABLE].size.get());
+		(*mFile)->read(mFileNodes.data(), mHdr.sections[nn::hac::romfs::FILE_NODE_TABLE].offset.get(), mFileNodes.size());
+		mFileNodeTable = mFileNodes.data();
+	}
 	//printf("[RAW FILE NODES]\n");
 	//fnd::SimpleTextOutput::hxdStyleDump(mFileNodes.data(), mFileNodes.size());
 	
@@ -333,9 +688,82 @@ void RomfsProcess::resolveRomfs()
 	{
 		throw fnd::Exception(kModuleName, "Invalid root directory node");
 	}
+}
 
-	// import directory into internal structure
+void RomfsProcess::countFs()
+{
 	mDirNum = 0;
 	mFileNum = 0;
-	importDirectory(0, mRootDir);
+	traverseFs([this](const std::string& path, const sFsEntry& entry) {
+		if (entry.is_dir)
+			mDirNum++;
+		else
+			mFileNum++;
+	});
+}
+
+uint32_t RomfsProcess::calcPathHash(uint32_t parent_offset, const std::string& name)
+{
+	uint32_t hash = parent_offset ^ 123456789;
+	for (size_t i = 0; i < name.length(); i++)
+	{
+		hash = (hash >> 5) | (hash << 27);
+		hash ^= (byte_t)name[i];
+	}
+	return hash;
+}
+
+bool RomfsProcess::findNode(nn::hac::romfs::HeaderSectionIndex hash_table, nn::hac::romfs::HeaderSectionIndex node_table, uint32_t parent_offset, const std::string& name, uint32_t& node_offset, fnd::Vec<byte_t>& node)
+{
+	// directory and file nodes begin with the parent offset, and end with the offset of the next node in the hash bucket and the name size
+	size_t node_header_size = (node_table == nn::hac::romfs::DIR_NODE_TABLE) ? sizeof(nn::hac::sRomfsDirEntry) : sizeof(nn::hac::sRomfsFileEntry);
+
+	size_t bucket_num = mHdr.sections[hash_table].size.get() / sizeof(le_uint32_t);
+	if (bucket_num == 0)
+		return false;
+
+	le_uint32_t bucket;
+	readSection(hash_table, (calcPathHash(parent_offset, name) % bucket_num) * sizeof(le_uint32_t), (byte_t*)&bucket, sizeof(le_uint32_t));
+
+	// every node is at least as large as its header, so a corrupted image that links a bucket in a loop is caught once this many have been visited
+	size_t max_node_num = mHdr.sections[node_table].size.get() / node_header_size;
+	size_t node_num = 0;
+
+	node.alloc(node_header_size);
+	for (node_offset = bucket.get(); node_offset != nn::hac::romfs::kInvalidAddr; )
+	{
+		if (node_num >= max_node_num)
+		{
+			throw fnd::Exception(kModuleName, "RomFs appears corrupted (hash bucket loop)");
+		}
+		node_num++;
+
+		readSection(node_table, node_offset, node.data(), node_header_size);
+
+		uint32_t node_parent = ((const le_uint32_t*)node.data())[0].get();
+		uint32_t next_offset = ((const le_uint32_t*)(node.data() + node_header_size))[-2].get();
+		uint32_t name_size = ((const le_uint32_t*)(node.data() + node_header_size))[-1].get();
+
+		if (node_parent == parent_offset && name_size == name.length())
+		{
+			std::string node_name(name_size, '\0');
+			readSection(node_table, node_offset + node_header_size, (byte_t*)&node_name[0], name_size);
+			if (node_name == name)
+				return true;
+		}
+
+		node_offset = next_offset;
+	}
+
+	return false;
+}
+
+void RomfsProcess::readSection(nn::hac::romfs::HeaderSectionIndex section, uint64_t offset, byte_t* out, size_t len)
+{
+	if (offset + len > mHdr.sections[section].size.get())
+	{
+		throw fnd::Exception(kModuleName, "RomFs appears corrupted (hash table or node entry out of bounds)");
+	}
+
+	(*mFile)->read(out, mHdr.sections[section].offset.get() + offset, len);
 }
\ No newline at end of file
@@ -1,80 +1,63 @@
 #pragma once
 #include <string>
+#include <vector>
+#include <memory>
+#include <functional>
 #include <fnd/types.h>
 #include <fnd/IFile.h>
 #include <fnd/SharedPtr.h>
 #include <fnd/Vec.h>
-#include <fnd/List.h>
 #include <nn/hac/define/romfs.h>
 
 #include "common.h"
+#include "ThreadPool.h"
+#include "PathFilter.h"
+#include "TarWriter.h"
 
 class RomfsProcess
 {
 public:
-	struct sDirectory;
-	struct sFile;
+	static const uint32_t kNullIndex = 0xffffffff;
 
-	struct sDirectory
+	// the file system is indexed as two flat lists, entries refer to each other by their index in these lists (or kNullIndex).
+	// names are not copied, they point into the node tables which live as long as the RomfsProcess
+	struct sDirEntry
 	{
-		std::string name;
-		fnd::List<sDirectory> dir_list;
-		fnd::List<sFile> file_list;
-
-		void operator=(const sDirectory& other)
-		{
-			name = other.name;
-			dir_list = other.dir_list;
-			file_list = other.file_list;
-		}
-
-		bool operator==(const sDirectory& other) const
-		{
-			return (name == other.name) \
-				&& (dir_list == other.dir_list) \
-				&& (file_list == other.file_list);
-		}
-
-		bool operator!=(const sDirectory& other) const
-		{
-			return !operator==(other);
-		}
-
-		bool operator==(const std::string& other) const
-		{
-			return (name == other);
-		}
+		const char* name;
+		uint32_t name_size;
+		uint32_t parent;
+		uint32_t child; // first sub directory
+		uint32_t sibling;
+		uint32_t file; // first file
+	};
+
+	struct sFileEntry
+	{
+		const char* name;
+		uint32_t name_size;
+		uint32_t parent;
+		uint32_t sibling;
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	// entry passed to a FsVisitor, the path of the entry is passed alongside it
+	struct sFsEntry
+	{
+		bool is_dir;
+		size_t depth; // 1 for entries in the root directory
+		const char* name;
+		uint32_t name_size;
+		uint64_t offset; // files only
+		uint64_t size; // files only
 	};
+	typedef std::function<void(const std::string& path, const sFsEntry& entry)> FsVisitor;
 
 	struct sFile
 	{
 		std::string name;
 		uint64_t offset;
 		uint64_t size;
-
-		void operator=(const sFile& other)
-		{
-			name = other.name;
-			offset = other.offset;
-			size = other.size;
-		}
-
-		bool operator==(const sFile& other) const
-		{
-			return (name == other.name) \
-				&& (offset == other.offset) \
-				&& (size == other.size);
-		}
-
-		bool operator!=(const sFile& other) const
-		{
-			return !operator==(other);
-		}
-
-		bool operator==(const std::string& other) const
-		{
-			return (name == other);
-		}
 	};
 
 	RomfsProcess();
@@ -83,6 +66,7 @@ public:
 
 	// generic
 	void setInputFile(const fnd::SharedPtr<fnd::IFile>& file);
+	void setInputFileFactory(const IFileFactory& factory);
 	void setCliOutputMode(CliOutputMode type);
 	void setVerifyMode(bool verify);
 
@@ -90,45 +74,102 @@ public:
 	void setMountPointName(const std::string& mount_name);
 	void setExtractPath(const std::string& path);
 	void setListFs(bool list_fs);
-
-	const sDirectory& getRootDir() const;
+	void setThreadNum(size_t thread_num);
+	void setBlockCacheSize(size_t size);
+	// only the file at romfs_path is extracted (to the extract path, or the working directory), it is found with the hash tables so the directory tree is not imported
+	void setExtractFilePath(const std::string& romfs_path);
+	// only the files selected by the filter are extracted (and read), matched against "/dir/file", directories without any selected files are not created
+	void setExtractFilter(const std::shared_ptr<const PathFilter>& filter);
+	// extracted files and directories are written to the archive (named by their extract path) instead of to disk
+	void setExtractArchive(const std::shared_ptr<TarWriter>& archive);
+	// the whole file system is also written as an EROFS image (see ErofsWriter), which can be mounted instead of extracting it
+	void setErofsImagePath(const std::string& path);
+
+	// walks the node tables depth first, visiting each directory before its sub directories and then its files.
+	// paths are "/dir/file", nothing is kept beyond the current path, so this can be used once process() has listed or extracted the file system
+	void traverseFs(const FsVisitor& visitor);
+
+	// index 0 of the directory list is the root directory, only built by process() when extracting the whole file system
+	const std::vector<sDirEntry>& getDirList() const;
+	const std::vector<sFileEntry>& getFileList() const;
+
+	// finds a file by its path in the RomFS ("dir/file" or "/dir/file") using the hash tables, reading only the nodes on the way.
+	// this can be used once process() has been called
+	bool findFile(const std::string& romfs_path, sFile& file);
 private:
 	const std::string kModuleName = "RomfsProcess";
 	static const size_t kCacheSize = 0x10000;
+	static const size_t kPrefetchEntryNum = 4; // per reader, each worker has its own reader so the pool is kept busy without queueing far ahead
 
 	fnd::SharedPtr<fnd::IFile> mFile;
+	IFileFactory mFileFactory;
 	CliOutputMode mCliOutputMode;
 	bool mVerify;
 
 	std::string mExtractPath;
 	bool mExtract;
+	sOptional<std::string> mExtractFilePath;
+	std::shared_ptr<const PathFilter> mExtractFilter;
+	std::shared_ptr<TarWriter> mExtractArchive;
+	sOptional<std::string> mErofsImagePath;
 	std::string mMountName;
 	bool mListFs;
+	size_t mThreadNum;
+	size_t mBlockCacheSize;
+	std::shared_ptr<ThreadPool> mDecompressPool;
 
 	fnd::Vec<byte_t> mCache;
 
+	struct sExtractJob
+	{
+		std::string path;
+		uint64_t offset;
+		uint64_t size;
+		uint64_t storage_order; // where the data is stored (see IReadAtFile::getStorageOrder())
+	};
+
 	size_t mDirNum;
 	size_t mFileNum;
 	nn::hac::sRomfsHeader mHdr;
+	sOptional<size_t> mCompressionMetaOffset;
 	fnd::Vec<byte_t> mDirNodes;
 	fnd::Vec<byte_t> mFileNodes;
-	sDirectory mRootDir;
+	const byte_t* mDirNodeTable; // points into mDirNodes, or into the input file mapping
+	const byte_t* mFileNodeTable; // points into mFileNodes, or into the input file mapping
+	std::vector<sDirEntry> mDirList;
+	std::vector<sFileEntry> mFileList;
+	std::vector<bool> mDirSelected; // empty when every entry is selected
+	std::vector<bool> mFileSelected;
 
-	inline nn::hac::sRomfsDirEntry* get_dir_node(uint32_t offset) { return (nn::hac::sRomfsDirEntry*)(mDirNodes.data() + offset); }
-	inline nn::hac::sRomfsFileEntry* get_file_node(uint32_t offset) { return (nn::hac::sRomfsFileEntry*)(mFileNodes.data() + offset); }
+	inline const nn::hac::sRomfsDirEntry* get_dir_node(uint32_t offset) { return (const nn::hac::sRomfsDirEntry*)(mDirNodeTable + offset); }
+	inline const nn::hac::sRomfsFileEntry* get_file_node(uint32_t offset) { return (const nn::hac::sRomfsFileEntry*)(mFileNodeTable + offset); }
 
 	
 	void printTab(size_t tab) const;
-	void displayFile(const sFile& file, size_t tab) const;
-	void displayDir(const sDirectory& dir, size_t tab) const;
 
 	void displayHeader();
 	void displayFs();
 
-	void extractDir(const std::string& path, const sDirectory& dir);
+	bool selectForExtract(uint32_t dir_index, const std::string& romfs_path);
+	inline bool isDirSelected(uint32_t dir_index) const { return mDirSelected.empty() || mDirSelected[dir_index]; }
+	inline bool isFileSelected(uint32_t file_index) const { return mFileSelected.empty() || mFileSelected[file_index]; }
+	void makeExtractDirectory(const std::string& path);
+	void writeExtractFile(const std::string& path, uint64_t offset, uint64_t size);
+	void createExtractJobList(const std::string& path, uint32_t dir_index, std::vector<sExtractJob>& job_list);
+	fnd::SharedPtr<fnd::IFile> createDecompressingReader(const fnd::SharedPtr<fnd::IFile>& file) const;
+	fnd::SharedPtr<fnd::IFile> createWorkerReader() const;
+	void extractFsMultiThreaded(const std::vector<sExtractJob>& job_list);
 	void extractFs();
+	void extractSingleFile();
 
 	bool validateHeaderLayout(const nn::hac::sRomfsHeader* hdr) const;
-	void importDirectory(uint32_t dir_offset, sDirectory& dir);
-	void resolveRomfs();
+	void importFs();
+	void importHeader();
+	void importNodeTables();
+	void countFs();
+	void writeErofsImage();
+
+	static uint32_t calcPathHash(uint32_t parent_offset, const std::string& name);
+	bool findNode(nn::hac::romfs::HeaderSectionIndex hash_table, nn::hac::romfs::HeaderSectionIndex node_table, uint32_t parent_offset, const std::string& name, uint32_t& node_offset, fnd::Vec<byte_t>& node);
+	void readSection(nn::hac::romfs::HeaderSectionIndex section, uint64_t offset, byte_t* out, size_t len);
 };
\ No newline at end of file
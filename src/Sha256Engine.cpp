@@ -0,0 +1,405 @@
+#include "Sha256Engine.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SHA256_ENGINE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SHA256_ENGINE_TARGET_SHANI
+#define SHA256_ENGINE_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define SHA256_ENGINE_TARGET_SHANI __attribute__((target("sha,sse4.1")))
+#define SHA256_ENGINE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+static const size_t kChunkSize = 64;
+static const size_t kStateWordNum = 8;
+
+static const uint32_t kRoundConstant[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t kInitialState[kStateWordNum] =
+{
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static inline void setBe32(byte_t* data, uint32_t value)
+{
+	data[0] = (byte_t)(value >> 24);
+	data[1] = (byte_t)(value >> 16);
+	data[2] = (byte_t)(value >> 8);
+	data[3] = (byte_t)(value);
+}
+
+// writes the padding for a message of len bytes (whose last len % 64 bytes are in data) into tail, returns the number of chunks in tail
+static size_t makePaddedTail(const byte_t* data, size_t len, byte_t tail[kChunkSize * 2])
+{
+	size_t remaining = len % kChunkSize;
+	size_t tail_size = (remaining + 1 + sizeof(uint64_t) > kChunkSize) ? kChunkSize * 2 : kChunkSize;
+	uint64_t bit_len = (uint64_t)len * 8;
+
+	memset(tail, 0, kChunkSize * 2);
+	memcpy(tail, data + (len - remaining), remaining);
+	tail[remaining] = 0x80;
+	setBe32(tail + tail_size - 8, (uint32_t)(bit_len >> 32));
+	setBe32(tail + tail_size - 4, (uint32_t)(bit_len));
+
+	return tail_size / kChunkSize;
+}
+
+#ifdef SHA256_ENGINE_X86
+static void getCpuId(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+#ifdef _MSC_VER
+	__cpuidex((int*)regs, (int)leaf, (int)subleaf);
+#else
+	regs[0] = regs[1] = regs[2] = regs[3] = 0;
+	if (leaf <= __get_cpuid_max(0, nullptr))
+		__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t getXcr0()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t eax, edx;
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+static Sha256Engine::Implementation detectImplementation()
+{
+	uint32_t leaf1[4], leaf7[4];
+	getCpuId(1, 0, leaf1);
+	getCpuId(7, 0, leaf7);
+
+	bool has_ssse3 = (leaf1[2] & (1 << 9)) != 0;
+	bool has_sse41 = (leaf1[2] & (1 << 19)) != 0;
+	bool has_osxsave = (leaf1[2] & (1 << 27)) != 0;
+	bool has_avx = (leaf1[2] & (1 << 28)) != 0;
+	bool has_avx2 = (leaf7[1] & (1 << 5)) != 0;
+	bool has_sha = (leaf7[1] & (1 << 29)) != 0;
+
+	// the OS must also save the YMM registers for AVX instructions to be usable
+	bool has_ymm_state = has_osxsave && has_avx && (getXcr0() & 0x6) == 0x6;
+
+	if (has_sha && has_ssse3 && has_sse41)
+		return Sha256Engine::IMPL_SHANI;
+	if (has_avx2 && has_ymm_state)
+		return Sha256Engine::IMPL_AVX2;
+	return Sha256Engine::IMPL_PORTABLE;
+}
+
+SHA256_ENGINE_TARGET_SHANI
+static inline void roundsShani(__m128i& state0, __m128i& state1, __m128i msg, size_t round)
+{
+	// 4 rounds, sha256rnds2 does 2 rounds using the low 2 words of msg
+	msg = _mm_add_epi32(msg, _mm_loadu_si128((const __m128i*)&kRoundConstant[round]));
+	state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+	state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+}
+
+SHA256_ENGINE_TARGET_SHANI
+static inline __m128i scheduleShani(__m128i w0, __m128i w1, __m128i w2, __m128i w3)
+{
+	// the next 4 message words, from the previous 16
+	return _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w0, w1), _mm_alignr_epi8(w3, w2, 4)), w3);
+}
+
+SHA256_ENGINE_TARGET_SHANI
+static void compressShani(uint32_t state[kStateWordNum], const byte_t* data, size_t chunk_num)
+{
+	const __m128i swap_mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+	// the sha256rnds2 instruction takes the state as ABEF/CDGH
+	__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1);
+	__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B);
+	__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+	for (; chunk_num > 0; chunk_num--, data += kChunkSize)
+	{
+		__m128i abef_save = state0;
+		__m128i cdgh_save = state1;
+
+		__m128i msg0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 0x00)), swap_mask);
+		__m128i msg1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 0x10)), swap_mask);
+		__m128i msg2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 0x20)), swap_mask);
+		__m128i msg3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 0x30)), swap_mask);
+
+		roundsShani(state0, state1, msg0, 0);
+		roundsShani(state0, state1, msg1, 4);
+		roundsShani(state0, state1, msg2, 8);
+		roundsShani(state0, state1, msg3, 12);
+
+		// unrolled by hand, so the message schedule stays in registers
+		for (size_t round = 16; round < 64; round += 16)
+		{
+			msg0 = scheduleShani(msg0, msg1, msg2, msg3);
+			roundsShani(state0, state1, msg0, round + 0);
+			msg1 = scheduleShani(msg1, msg2, msg3, msg0);
+			roundsShani(state0, state1, msg1, round + 4);
+			msg2 = scheduleShani(msg2, msg3, msg0, msg1);
+			roundsShani(state0, state1, msg2, round + 8);
+			msg3 = scheduleShani(msg3, msg0, msg1, msg2);
+			roundsShani(state0, state1, msg3, round + 12);
+		}
+
+		state0 = _mm_add_epi32(state0, abef_save);
+		state1 = _mm_add_epi32(state1, cdgh_save);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1B);
+	state1 = _mm_shuffle_epi32(state1, 0xB1);
+	_mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(tmp, state1, 0xF0));
+	_mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+SHA256_ENGINE_TARGET_SHANI
+static void hashShani(const byte_t* data, size_t len, byte_t hash[fnd::sha::kSha256HashLen])
+{
+	uint32_t state[kStateWordNum];
+	memcpy(state, kInitialState, sizeof(state));
+
+	compressShani(state, data, len / kChunkSize);
+
+	byte_t tail[kChunkSize * 2];
+	compressShani(state, tail, makePaddedTail(data, len, tail));
+
+	for (size_t i = 0; i < kStateWordNum; i++)
+		setBe32(hash + i * sizeof(uint32_t), state[i]);
+}
+
+// 8 messages are hashed at once, one per 32bit lane
+static const size_t kAvx2LaneNum = 8;
+
+SHA256_ENGINE_TARGET_AVX2
+static inline __m256i rotr32x8(__m256i x, int n)
+{
+	return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+SHA256_ENGINE_TARGET_AVX2
+static inline void transpose32x8(__m256i& r0, __m256i& r1, __m256i& r2, __m256i& r3, __m256i& r4, __m256i& r5, __m256i& r6, __m256i& r7)
+{
+	__m256i t0 = _mm256_unpacklo_epi32(r0, r1);
+	__m256i t1 = _mm256_unpackhi_epi32(r0, r1);
+	__m256i t2 = _mm256_unpacklo_epi32(r2, r3);
+	__m256i t3 = _mm256_unpackhi_epi32(r2, r3);
+	__m256i t4 = _mm256_unpacklo_epi32(r4, r5);
+	__m256i t5 = _mm256_unpackhi_epi32(r4, r5);
+	__m256i t6 = _mm256_unpacklo_epi32(r6, r7);
+	__m256i t7 = _mm256_unpackhi_epi32(r6, r7);
+
+	__m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+	__m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+	__m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+	__m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+	__m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+	__m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+	__m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+	__m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+	r0 = _mm256_permute2x128_si256(u0, u4, 0x20);
+	r1 = _mm256_permute2x128_si256(u1, u5, 0x20);
+	r2 = _mm256_permute2x128_si256(u2, u6, 0x20);
+	r3 = _mm256_permute2x128_si256(u3, u7, 0x20);
+	r4 = _mm256_permute2x128_si256(u0, u4, 0x31);
+	r5 = _mm256_permute2x128_si256(u1, u5, 0x31);
+	r6 = _mm256_permute2x128_si256(u2, u6, 0x31);
+	r7 = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+// loads 8 big endian words (at word_offset) from each lane's chunk, so that w[i] holds word i of every lane
+SHA256_ENGINE_TARGET_AVX2
+static inline void loadMessageWordsAvx2(const byte_t* const lane[kAvx2LaneNum], size_t offset, __m256i w[8])
+{
+	const __m256i swap_mask = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3, 12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+	__m256i r0 = _mm256_loadu_si256((const __m256i*)(lane[0] + offset));
+	__m256i r1 = _mm256_loadu_si256((const __m256i*)(lane[1] + offset));
+	__m256i r2 = _mm256_loadu_si256((const __m256i*)(lane[2] + offset));
+	__m256i r3 = _mm256_loadu_si256((const __m256i*)(lane[3] + offset));
+	__m256i r4 = _mm256_loadu_si256((const __m256i*)(lane[4] + offset));
+	__m256i r5 = _mm256_loadu_si256((const __m256i*)(lane[5] + offset));
+	__m256i r6 = _mm256_loadu_si256((const __m256i*)(lane[6] + offset));
+	__m256i r7 = _mm256_loadu_si256((const __m256i*)(lane[7] + offset));
+	transpose32x8(r0, r1, r2, r3, r4, r5, r6, r7);
+
+	w[0] = _mm256_shuffle_epi8(r0, swap_mask);
+	w[1] = _mm256_shuffle_epi8(r1, swap_mask);
+	w[2] = _mm256_shuffle_epi8(r2, swap_mask);
+	w[3] = _mm256_shuffle_epi8(r3, swap_mask);
+	w[4] = _mm256_shuffle_epi8(r4, swap_mask);
+	w[5] = _mm256_shuffle_epi8(r5, swap_mask);
+	w[6] = _mm256_shuffle_epi8(r6, swap_mask);
+	w[7] = _mm256_shuffle_epi8(r7, swap_mask);
+}
+
+SHA256_ENGINE_TARGET_AVX2
+static inline void roundAvx2(__m256i a, __m256i b, __m256i c, __m256i& d, __m256i e, __m256i f, __m256i g, __m256i& h, __m256i w, size_t round)
+{
+	// rather than shifting every state word along, the caller rotates the arguments each round
+	__m256i sum1 = _mm256_xor_si256(_mm256_xor_si256(rotr32x8(e, 6), rotr32x8(e, 11)), rotr32x8(e, 25));
+	__m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+	__m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, sum1), _mm256_add_epi32(ch, _mm256_add_epi32(w, _mm256_set1_epi32((int)kRoundConstant[round]))));
+	__m256i sum0 = _mm256_xor_si256(_mm256_xor_si256(rotr32x8(a, 2), rotr32x8(a, 13)), rotr32x8(a, 22));
+	__m256i maj = _mm256_xor_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_xor_si256(a, b)));
+
+	d = _mm256_add_epi32(d, t1);
+	h = _mm256_add_epi32(t1, _mm256_add_epi32(sum0, maj));
+}
+
+SHA256_ENGINE_TARGET_AVX2
+static void compressAvx2(__m256i state[kStateWordNum], const byte_t* lane[kAvx2LaneNum], size_t chunk_num)
+{
+	for (; chunk_num > 0; chunk_num--)
+	{
+		// w is a ring of the last 16 message words
+		__m256i w[16];
+		loadMessageWordsAvx2(lane, 0x00, w);
+		loadMessageWordsAvx2(lane, 0x20, w + 8);
+
+		__m256i a = state[0], b = state[1], c = state[2], d = state[3];
+		__m256i e = state[4], f = state[5], g = state[6], h = state[7];
+
+		for (size_t round = 0; round < 64; round += 8)
+		{
+			size_t base = round & 15;
+			if (round >= 16)
+			{
+				for (size_t i = base; i < base + 8; i++)
+				{
+					__m256i w15 = w[(i + 1) & 15];
+					__m256i w2 = w[(i + 14) & 15];
+					__m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotr32x8(w15, 7), rotr32x8(w15, 18)), _mm256_srli_epi32(w15, 3));
+					__m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotr32x8(w2, 17), rotr32x8(w2, 19)), _mm256_srli_epi32(w2, 10));
+					w[i] = _mm256_add_epi32(_mm256_add_epi32(w[i], s0), _mm256_add_epi32(w[(i + 9) & 15], s1));
+				}
+			}
+
+			roundAvx2(a, b, c, d, e, f, g, h, w[base + 0], round + 0);
+			roundAvx2(h, a, b, c, d, e, f, g, w[base + 1], round + 1);
+			roundAvx2(g, h, a, b, c, d, e, f, w[base + 2], round + 2);
+			roundAvx2(f, g, h, a, b, c, d, e, w[base + 3], round + 3);
+			roundAvx2(e, f, g, h, a, b, c, d, w[base + 4], round + 4);
+			roundAvx2(d, e, f, g, h, a, b, c, w[base + 5], round + 5);
+			roundAvx2(c, d, e, f, g, h, a, b, w[base + 6], round + 6);
+			roundAvx2(b, c, d, e, f, g, h, a, w[base + 7], round + 7);
+		}
+
+		state[0] = _mm256_add_epi32(state[0], a);
+		state[1] = _mm256_add_epi32(state[1], b);
+		state[2] = _mm256_add_epi32(state[2], c);
+		state[3] = _mm256_add_epi32(state[3], d);
+		state[4] = _mm256_add_epi32(state[4], e);
+		state[5] = _mm256_add_epi32(state[5], f);
+		state[6] = _mm256_add_epi32(state[6], g);
+		state[7] = _mm256_add_epi32(state[7], h);
+
+		for (size_t i = 0; i < kAvx2LaneNum; i++)
+			lane[i] += kChunkSize;
+	}
+}
+
+SHA256_ENGINE_TARGET_AVX2
+static void hashBlocksAvx2(const byte_t* data, size_t block_size, size_t block_num, byte_t* hash_list)
+{
+	for (size_t i = 0; i < block_num; i += kAvx2LaneNum)
+	{
+		// unused lanes hash a copy of the last block, and their result is discarded
+		size_t lane_num = _MIN(kAvx2LaneNum, block_num - i);
+		const byte_t* lane[kAvx2LaneNum];
+		for (size_t j = 0; j < kAvx2LaneNum; j++)
+			lane[j] = data + (i + _MIN(j, lane_num - 1)) * block_size;
+
+		__m256i state[kStateWordNum];
+		for (size_t j = 0; j < kStateWordNum; j++)
+			state[j] = _mm256_set1_epi32((int)kInitialState[j]);
+
+		compressAvx2(state, lane, block_size / kChunkSize);
+
+		// every block has the same size, so every lane has the same amount of padding
+		byte_t tail[kAvx2LaneNum][kChunkSize * 2];
+		size_t tail_chunk_num = 0;
+		for (size_t j = 0; j < kAvx2LaneNum; j++)
+		{
+			tail_chunk_num = makePaddedTail(data + (i + _MIN(j, lane_num - 1)) * block_size, block_size, tail[j]);
+			lane[j] = tail[j];
+		}
+		compressAvx2(state, lane, tail_chunk_num);
+
+		// state[j] holds word j of every lane
+		uint32_t digest[kStateWordNum][kAvx2LaneNum];
+		for (size_t j = 0; j < kStateWordNum; j++)
+			_mm256_storeu_si256((__m256i*)digest[j], state[j]);
+		for (size_t j = 0; j < lane_num; j++)
+		{
+			for (size_t k = 0; k < kStateWordNum; k++)
+				setBe32(hash_list + (i + j) * fnd::sha::kSha256HashLen + k * sizeof(uint32_t), digest[k][j]);
+		}
+	}
+}
+#endif
+
+void Sha256Engine::hash(const byte_t* data, size_t len, byte_t hash[fnd::sha::kSha256HashLen])
+{
+#ifdef SHA256_ENGINE_X86
+	if (getImplementation() == IMPL_SHANI)
+		hashShani(data, len, hash);
+	else
+#endif
+		// multi-buffer AVX2 has no advantage for a single message
+		fnd::sha::Sha256(data, len, hash);
+}
+
+void Sha256Engine::hashBlocks(const byte_t* data, size_t block_size, size_t block_num, byte_t* hash_list)
+{
+#ifdef SHA256_ENGINE_X86
+	if (getImplementation() == IMPL_AVX2)
+	{
+		hashBlocksAvx2(data, block_size, block_num, hash_list);
+		return;
+	}
+#endif
+	for (size_t i = 0; i < block_num; i++)
+		hash(data + i * block_size, block_size, hash_list + i * fnd::sha::kSha256HashLen);
+}
+
+Sha256Engine::Implementation Sha256Engine::getImplementation()
+{
+#ifdef SHA256_ENGINE_X86
+	static const Implementation impl = detectImplementation();
+	return impl;
+#else
+	return IMPL_PORTABLE;
+#endif
+}
+
+const char* Sha256Engine::getImplementationName()
+{
+	switch (getImplementation())
+	{
+	case (IMPL_SHANI):
+		return "SHA-NI";
+	case (IMPL_AVX2):
+		return "AVX2";
+	default:
+		return "Portable";
+	}
+}
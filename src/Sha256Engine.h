@@ -0,0 +1,24 @@
+#pragma once
+#include <fnd/types.h>
+#include <fnd/sha.h>
+
+// SHA-256 engine for hashing many independent blocks, uses SHA-NI or multi-buffer AVX2 when the CPU supports it (determined at runtime), otherwise fnd::sha
+class Sha256Engine
+{
+public:
+	enum Implementation
+	{
+		IMPL_PORTABLE,
+		IMPL_AVX2,
+		IMPL_SHANI
+	};
+
+	// hash len bytes of data
+	static void hash(const byte_t* data, size_t len, byte_t hash[fnd::sha::kSha256HashLen]);
+
+	// hash block_num blocks of block_size bytes stored back to back in data, the hash of each block is written back to back in hash_list
+	static void hashBlocks(const byte_t* data, size_t block_size, size_t block_num, byte_t* hash_list);
+
+	static Implementation getImplementation();
+	static const char* getImplementationName();
+};
@@ -0,0 +1,172 @@
+#include "StreamIFile.h"
+#include <cstring>
+#include <limits>
+#include <sstream>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <windows.h>
+#include <fnd/StringConv.h>
+#else
+#include <sys/stat.h>
+#endif
+
+StreamIFile::StreamIFile(const std::string& path, size_t reorder_buffer_size) :
+	mStream(nullptr),
+	mOwnStream(false),
+	mEndOfStream(false),
+	mStreamPos(0),
+	mPos(0),
+	mReorderBufferHead(0),
+	mReorderBufferFill(0)
+{
+	if (path == "-")
+	{
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+#endif
+		mStream = stdin;
+	}
+	else
+	{
+#ifdef _WIN32
+		mStream = _wfopen((const wchar_t*)fnd::StringConv::ConvertChar8ToChar16(path).c_str(), L"rb");
+#else
+		mStream = fopen(path.c_str(), "rb");
+#endif
+		mOwnStream = true;
+	}
+
+	if (mStream == nullptr)
+	{
+		throw fnd::Exception(kModuleName, "Failed to open stream");
+	}
+
+	mReorderBuffer.alloc(_MAX(reorder_buffer_size, (size_t)1));
+	mSkipBuffer.alloc(kSkipChunkSize);
+}
+
+StreamIFile::~StreamIFile()
+{
+	if (mOwnStream)
+		fclose(mStream);
+}
+
+size_t StreamIFile::size()
+{
+	return mEndOfStream ? mStreamPos : std::numeric_limits<size_t>::max();
+}
+
+void StreamIFile::seek(size_t offset)
+{
+	// seeking is deferred until the next read, so a seek forwards costs nothing if it is never read from
+	mPos = offset;
+}
+
+void StreamIFile::read(byte_t* out, size_t len)
+{
+	size_t window_start = mStreamPos - mReorderBufferFill;
+	if (mPos < window_start)
+	{
+		std::stringstream error;
+		error << "Cannot read backwards beyond the reorder buffer (offset: 0x" << std::hex << mPos << ", reorder buffer start: 0x" << window_start << ")";
+		throw fnd::Exception(kModuleName, error.str());
+	}
+
+	// serve what has already been read from the reorder buffer
+	if (mPos < mStreamPos)
+	{
+		size_t copy_len = _MIN(len, mStreamPos - mPos);
+		copyFromReorderBuffer(out, mPos, copy_len);
+		out += copy_len;
+		len -= copy_len;
+		mPos += copy_len;
+	}
+
+	// discard the data between the end of the stream and the read position
+	while (mStreamPos < mPos)
+	{
+		readFromStream(mSkipBuffer.data(), _MIN(mPos - mStreamPos, mSkipBuffer.size()));
+	}
+
+	if (len > 0)
+	{
+		readFromStream(out, len);
+		mPos += len;
+	}
+}
+
+void StreamIFile::read(byte_t* out, size_t offset, size_t len)
+{
+	seek(offset);
+	read(out, len);
+}
+
+void StreamIFile::write(const byte_t* out, size_t len)
+{
+	throw fnd::Exception(kModuleName, "write() not supported");
+}
+
+void StreamIFile::write(const byte_t* out, size_t offset, size_t len)
+{
+	throw fnd::Exception(kModuleName, "write() not supported");
+}
+
+bool StreamIFile::isStream(const std::string& path)
+{
+	if (path == "-")
+		return true;
+
+#ifdef _WIN32
+	DWORD attributes = GetFileAttributesW((LPCWSTR)fnd::StringConv::ConvertChar8ToChar16(path).c_str());
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DEVICE);
+#else
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode) || S_ISCHR(st.st_mode));
+#endif
+}
+
+void StreamIFile::readFromStream(byte_t* out, size_t len)
+{
+	size_t read_len = fread(out, 1, len, mStream);
+	retain(out, read_len);
+	mStreamPos += read_len;
+
+	if (read_len != len)
+	{
+		mEndOfStream = true;
+		throw fnd::Exception(kModuleName, ferror(mStream) ? "Failed to read from stream" : "Unexpected end of stream");
+	}
+}
+
+void StreamIFile::retain(const byte_t* data, size_t len)
+{
+	size_t capacity = mReorderBuffer.size();
+
+	// only the tail of a read larger than the reorder buffer can be kept
+	if (len > capacity)
+	{
+		data += len - capacity;
+		len = capacity;
+	}
+
+	size_t first_len = _MIN(len, capacity - mReorderBufferHead);
+	memcpy(mReorderBuffer.data() + mReorderBufferHead, data, first_len);
+	memcpy(mReorderBuffer.data(), data + first_len, len - first_len);
+
+	mReorderBufferHead = (mReorderBufferHead + len) % capacity;
+	mReorderBufferFill = _MIN(mReorderBufferFill + len, capacity);
+}
+
+void StreamIFile::copyFromReorderBuffer(byte_t* out, size_t offset, size_t len) const
+{
+	size_t capacity = mReorderBuffer.size();
+
+	// the byte at mStreamPos-1 is stored just before mReorderBufferHead
+	size_t index = (mReorderBufferHead + capacity - (mStreamPos - offset) % capacity) % capacity;
+
+	size_t first_len = _MIN(len, capacity - index);
+	memcpy(out, mReorderBuffer.data() + index, first_len);
+	memcpy(out + first_len, mReorderBuffer.data(), len - first_len);
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <string>
+#include <cstdio>
+#include <fnd/types.h>
+#include <fnd/IFile.h>
+#include <fnd/Vec.h>
+
+// forward-only reader for stdin or a pipe, reads may only go backwards as far as the reorder buffer reaches
+class StreamIFile : public fnd::IFile
+{
+public:
+	static const size_t kDefaultReorderBufferSize = 0x400000;
+
+	// path "-" reads from stdin
+	StreamIFile(const std::string& path, size_t reorder_buffer_size = kDefaultReorderBufferSize);
+	~StreamIFile();
+
+	// the size of a stream is only known once the end has been reached, until then this is the maximum size_t
+	size_t size();
+	void seek(size_t offset);
+	void read(byte_t* out, size_t len);
+	void read(byte_t* out, size_t offset, size_t len);
+	void write(const byte_t* out, size_t len);
+	void write(const byte_t* out, size_t offset, size_t len);
+
+	// returns true if path is stdin ("-") or something that cannot be seeked (pipe, FIFO, socket, character device)
+	static bool isStream(const std::string& path);
+private:
+	const std::string kModuleName = "StreamIFile";
+	static const size_t kSkipChunkSize = 0x10000;
+
+	FILE* mStream;
+	bool mOwnStream;
+	bool mEndOfStream;
+
+	// offset of the next byte to be read from the stream, and the offset the next read() will start at
+	size_t mStreamPos;
+	size_t mPos;
+
+	// ring buffer holding the last (up to) mReorderBuffer.size() bytes read from the stream
+	fnd::Vec<byte_t> mReorderBuffer;
+	size_t mReorderBufferHead;
+	size_t mReorderBufferFill;
+	fnd::Vec<byte_t> mSkipBuffer;
+
+	void readFromStream(byte_t* out, size_t len);
+	void retain(const byte_t* data, size_t len);
+	void copyFromReorderBuffer(byte_t* out, size_t offset, size_t len) const;
+};
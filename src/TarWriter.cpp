@@ -0,0 +1,268 @@
+#include "TarWriter.h"
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <fnd/StringConv.h>
+#else
+#include <unistd.h>
+#endif
+
+TarWriter::TarWriter(const std::string& path) :
+	mStream(nullptr),
+	mOwnStream(false),
+	mClosed(false),
+	mFileRemaining(0),
+	mFileSize(0)
+{
+	if (path == "-")
+	{
+		// the archive keeps the original stdout, everything else printed to stdout goes to stderr
+		fflush(stdout);
+#ifdef _WIN32
+		int fd = _dup(_fileno(stdout));
+		if (fd != -1)
+		{
+			_setmode(fd, _O_BINARY);
+			_dup2(_fileno(stderr), _fileno(stdout));
+			mStream = _fdopen(fd, "wb");
+		}
+#else
+		int fd = dup(STDOUT_FILENO);
+		if (fd != -1)
+		{
+			dup2(STDERR_FILENO, STDOUT_FILENO);
+			mStream = fdopen(fd, "wb");
+		}
+#endif
+	}
+	else
+	{
+#ifdef _WIN32
+		mStream = _wfopen((const wchar_t*)fnd::StringConv::ConvertChar8ToChar16(path).c_str(), L"wb");
+#else
+		mStream = fopen(path.c_str(), "wb");
+#endif
+	}
+
+	if (mStream == nullptr)
+	{
+		throw fnd::Exception(kModuleName, "Failed to open archive for writing");
+	}
+	mOwnStream = true;
+}
+
+TarWriter::~TarWriter()
+{
+	// an archive that was not closed is left without the end of archive marker, so it reads as truncated
+	if (mOwnStream)
+		fclose(mStream);
+}
+
+void TarWriter::addDirectory(const std::string& path)
+{
+	std::string dir_path = normalisePath(path);
+
+	// the root of the archive has no entry
+	if (dir_path.empty())
+		return;
+
+	writeEntryHeader(dir_path + "/", TYPE_DIRECTORY, 0);
+}
+
+void TarWriter::addFile(const std::string& path, fnd::IFile& in_file, size_t offset, size_t size, fnd::Vec<byte_t>& cache)
+{
+	beginFile(path, size);
+
+	in_file.seek(offset);
+	for (size_t pos = 0; pos < size; pos += cache.size())
+	{
+		size_t chunk_size = _MIN(size - pos, cache.size());
+		in_file.read(cache.data(), chunk_size);
+		write(cache.data(), chunk_size);
+	}
+
+	endFile();
+}
+
+void TarWriter::beginFile(const std::string& path, uint64_t size)
+{
+	if (mFileRemaining != 0)
+	{
+		throw fnd::Exception(kModuleName, "Previous file was not completely written");
+	}
+
+	writeEntryHeader(normalisePath(path), TYPE_FILE, size);
+	mFileSize = size;
+	mFileRemaining = size;
+}
+
+void TarWriter::write(const byte_t* data, size_t len)
+{
+	if (len > mFileRemaining)
+	{
+		throw fnd::Exception(kModuleName, "Write exceeds the size of the file");
+	}
+
+	writeRaw(data, len);
+	mFileRemaining -= len;
+}
+
+void TarWriter::endFile()
+{
+	if (mFileRemaining != 0)
+	{
+		throw fnd::Exception(kModuleName, "File was not completely written");
+	}
+
+	writePadding(mFileSize);
+}
+
+void TarWriter::close()
+{
+	if (mClosed)
+		return;
+
+	// two empty blocks mark the end of the archive
+	static const byte_t kEndOfArchive[kBlockSize * 2] = {0};
+	writeRaw(kEndOfArchive, sizeof(kEndOfArchive));
+
+	if (fflush(mStream) != 0)
+	{
+		throw fnd::Exception(kModuleName, "Failed to write to archive");
+	}
+	mClosed = true;
+}
+
+void TarWriter::writeEntryHeader(const std::string& path, EntryType type, uint64_t size)
+{
+	// a path that is too long for the name field is split at a '/' into the prefix and name fields
+	std::string name = path;
+	std::string prefix;
+	if (path.length() > kNameLen)
+	{
+		size_t split_pos = path.rfind('/', path.length() - 2);
+		while (split_pos != std::string::npos && split_pos > kPrefixLen)
+			split_pos = split_pos > 0 ? path.rfind('/', split_pos - 1) : std::string::npos;
+
+		if (split_pos != std::string::npos && split_pos > 0 && path.length() - split_pos - 1 <= kNameLen)
+		{
+			prefix = path.substr(0, split_pos);
+			name = path.substr(split_pos + 1);
+		}
+	}
+
+	// otherwise the path (or a size too large for the size field) is given by a pax extended header
+	std::string pax_records;
+	if (name.length() > kNameLen)
+		pax_records += createPaxRecord("path", path);
+	if (size > kMaxUstarSize)
+		pax_records += createPaxRecord("size", std::to_string(size));
+
+	if (pax_records.empty() == false)
+	{
+		writeUstarHeader("PaxHeader", "", TYPE_PAX_HEADER, pax_records.length());
+		writeRaw(pax_records.data(), pax_records.length());
+		writePadding(pax_records.length());
+
+		// the ustar header still holds as much of the path as fits
+		if (name.length() > kNameLen)
+		{
+			prefix.clear();
+			name = path.substr(0, kNameLen);
+		}
+	}
+
+	writeUstarHeader(name, prefix, type, size > kMaxUstarSize ? 0 : size);
+}
+
+void TarWriter::writeUstarHeader(const std::string& name, const std::string& prefix, EntryType type, uint64_t size)
+{
+	sUstarHeader hdr;
+	memset(&hdr, 0, sizeof(sUstarHeader));
+
+	memcpy(hdr.name, name.c_str(), _MIN(name.length(), sizeof(hdr.name)));
+	writeOctal(hdr.mode, sizeof(hdr.mode), type == TYPE_DIRECTORY ? 0755 : 0644);
+	writeOctal(hdr.uid, sizeof(hdr.uid), 0);
+	writeOctal(hdr.gid, sizeof(hdr.gid), 0);
+	writeOctal(hdr.size, sizeof(hdr.size), size);
+	writeOctal(hdr.mtime, sizeof(hdr.mtime), 0); // the entries have no meaningful time, so this keeps archives reproducible
+	hdr.type = (char)type;
+	memcpy(hdr.magic, "ustar", 6);
+	memcpy(hdr.version, "00", 2);
+	memcpy(hdr.prefix, prefix.c_str(), _MIN(prefix.length(), sizeof(hdr.prefix)));
+
+	// the checksum is calculated with the checksum field filled with spaces
+	memset(hdr.checksum, ' ', sizeof(hdr.checksum));
+	uint32_t checksum = 0;
+	for (size_t i = 0; i < sizeof(sUstarHeader); i++)
+		checksum += ((const byte_t*)&hdr)[i];
+	writeOctal(hdr.checksum, sizeof(hdr.checksum) - 1, checksum);
+
+	writeRaw(&hdr, sizeof(sUstarHeader));
+}
+
+void TarWriter::writeRaw(const void* data, size_t len)
+{
+	if (fwrite(data, 1, len, mStream) != len)
+	{
+		throw fnd::Exception(kModuleName, "Failed to write to archive");
+	}
+}
+
+void TarWriter::writePadding(uint64_t size)
+{
+	static const byte_t kPadding[kBlockSize] = {0};
+
+	size_t padding_size = (kBlockSize - (size % kBlockSize)) % kBlockSize;
+	writeRaw(kPadding, padding_size);
+}
+
+std::string TarWriter::normalisePath(const std::string& path)
+{
+	std::string out;
+
+	// paths in the archive are relative, separated by '/', without empty or "." components
+	size_t name_begin = 0;
+	while (name_begin <= path.length())
+	{
+		size_t name_end = path.find_first_of("/\\", name_begin);
+		if (name_end == std::string::npos)
+			name_end = path.length();
+
+		std::string name = path.substr(name_begin, name_end - name_begin);
+		if (name.empty() == false && name != ".")
+		{
+			if (out.empty() == false)
+				out += '/';
+			out += name;
+		}
+
+		name_begin = name_end + 1;
+	}
+
+	return out;
+}
+
+void TarWriter::writeOctal(char* field, size_t field_size, uint64_t value)
+{
+	// zero padded octal digits followed by a NUL
+	field[field_size - 1] = '\0';
+	for (size_t i = field_size - 1; i > 0; i--)
+	{
+		field[i - 1] = '0' + (value & 7);
+		value >>= 3;
+	}
+}
+
+std::string TarWriter::createPaxRecord(const std::string& key, const std::string& value)
+{
+	// "<length> <key>=<value>\n", where length counts the whole record including its own digits
+	size_t len = key.length() + value.length() + 3;
+	size_t digits = std::to_string(len).length();
+	if (std::to_string(len + digits).length() != digits)
+		digits++;
+
+	return std::to_string(len + digits) + " " + key + "=" + value + "\n";
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <string>
+#include <cstdio>
+#include <fnd/types.h>
+#include <fnd/IFile.h>
+#include <fnd/Vec.h>
+
+// writes a POSIX tar archive (ustar, with pax extended headers for paths that do not fit and files of 8GiB or more) as a stream, entries are written in the order they are added
+class TarWriter
+{
+public:
+	// path "-" writes to stdout, stdout is then redirected to stderr so nothing else printed ends up in the archive
+	TarWriter(const std::string& path);
+	~TarWriter();
+
+	void addDirectory(const std::string& path);
+
+	// copies size bytes from offset in in_file into the archive through cache
+	void addFile(const std::string& path, fnd::IFile& in_file, size_t offset, size_t size, fnd::Vec<byte_t>& cache);
+
+	// a file can also be added in pieces, beginFile() is followed by exactly size bytes of write() and then endFile()
+	void beginFile(const std::string& path, uint64_t size);
+	void write(const byte_t* data, size_t len);
+	void endFile();
+
+	// writes the end of archive marker, once every entry has been added
+	void close();
+private:
+	const std::string kModuleName = "TarWriter";
+	static const size_t kBlockSize = 0x200;
+	static const size_t kNameLen = 100;
+	static const size_t kPrefixLen = 155;
+	static const uint64_t kMaxUstarSize = 077777777777ULL;
+
+	struct sUstarHeader
+	{
+		char name[kNameLen];
+		char mode[8];
+		char uid[8];
+		char gid[8];
+		char size[12];
+		char mtime[12];
+		char checksum[8];
+		char type;
+		char link_name[100];
+		char magic[6];
+		char version[2];
+		char user_name[32];
+		char group_name[32];
+		char dev_major[8];
+		char dev_minor[8];
+		char prefix[kPrefixLen];
+		char reserved[12];
+	};
+
+	enum EntryType
+	{
+		TYPE_FILE = '0',
+		TYPE_DIRECTORY = '5',
+		TYPE_PAX_HEADER = 'x'
+	};
+
+	FILE* mStream;
+	bool mOwnStream;
+	bool mClosed;
+	uint64_t mFileRemaining;
+	uint64_t mFileSize;
+
+	void writeEntryHeader(const std::string& path, EntryType type, uint64_t size);
+	void writeUstarHeader(const std::string& name, const std::string& prefix, EntryType type, uint64_t size);
+	void writeRaw(const void* data, size_t len);
+	void writePadding(uint64_t size);
+	static std::string normalisePath(const std::string& path);
+	static void writeOctal(char* field, size_t field_size, uint64_t value);
+	static std::string createPaxRecord(const std::string& key, const std::string& value);
+};
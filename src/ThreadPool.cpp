@@ -0,0 +1,110 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(size_t thread_num) :
+	mThreads(),
+	mJobs(),
+	mActiveJobNum(0),
+	mStop(false),
+	mException()
+{
+	if (thread_num == 0)
+	{
+		throw fnd::Exception(kModuleName, "Thread count must be at least 1");
+	}
+
+	for (size_t i = 0; i < thread_num; i++)
+	{
+		mThreads.push_back(std::thread(&ThreadPool::workerMain, this, i));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::unique_lock<std::mutex> lock(mLock);
+		mStop = true;
+	}
+	mJobCondition.notify_all();
+
+	for (size_t i = 0; i < mThreads.size(); i++)
+	{
+		mThreads[i].join();
+	}
+}
+
+size_t ThreadPool::getThreadNum() const
+{
+	return mThreads.size();
+}
+
+void ThreadPool::enqueue(const Job& job)
+{
+	{
+		std::unique_lock<std::mutex> lock(mLock);
+		mJobs.push_back(job);
+	}
+	mJobCondition.notify_one();
+}
+
+void ThreadPool::wait()
+{
+	std::exception_ptr exception;
+	{
+		std::unique_lock<std::mutex> lock(mLock);
+		mDoneCondition.wait(lock, [this]() { return mJobs.empty() && mActiveJobNum == 0; });
+
+		exception = mException;
+		mException = nullptr;
+	}
+
+	if (exception != nullptr)
+	{
+		std::rethrow_exception(exception);
+	}
+}
+
+size_t ThreadPool::getHardwareThreadNum()
+{
+	size_t thread_num = std::thread::hardware_concurrency();
+	return thread_num != 0 ? thread_num : 1;
+}
+
+void ThreadPool::workerMain(size_t thread_index)
+{
+	while (true)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mLock);
+			mJobCondition.wait(lock, [this]() { return mStop || !mJobs.empty(); });
+			if (mJobs.empty())
+				return;
+
+			job = mJobs.front();
+			mJobs.pop_front();
+			mActiveJobNum++;
+		}
+
+		try
+		{
+			job(thread_index);
+		}
+		catch (...)
+		{
+			std::unique_lock<std::mutex> lock(mLock);
+			// keep the first failure, and drop the remaining jobs since the result is already invalid
+			if (mException == nullptr)
+			{
+				mException = std::current_exception();
+				mJobs.clear();
+			}
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(mLock);
+			mActiveJobNum--;
+			if (mJobs.empty() && mActiveJobNum == 0)
+				mDoneCondition.notify_all();
+		}
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <fnd/types.h>
+#include <fnd/Exception.h>
+
+class ThreadPool
+{
+public:
+	// jobs are passed the index of the worker thread they are run on, so callers can keep per-thread state
+	typedef std::function<void(size_t thread_index)> Job;
+
+	ThreadPool(size_t thread_num);
+	~ThreadPool();
+
+	size_t getThreadNum() const;
+
+	void enqueue(const Job& job);
+
+	// blocks until all enqueued jobs have completed, rethrows the first exception raised by a job
+	void wait();
+
+	static size_t getHardwareThreadNum();
+private:
+	const std::string kModuleName = "ThreadPool";
+
+	std::vector<std::thread> mThreads;
+	std::deque<Job> mJobs;
+	size_t mActiveJobNum;
+	bool mStop;
+	std::exception_ptr mException;
+
+	std::mutex mLock;
+	std::condition_variable mJobCondition;
+	std::condition_variable mDoneCondition;
+
+	void workerMain(size_t thread_index);
+};
@@ -2,6 +2,9 @@
 #include "version.h"
 #include "PkiValidator.h"
 #include "KeyConfiguration.h"
+#include "ThreadPool.h"
+#include "StreamIFile.h"
+#include "BatchProcess.h"
 #include <vector>
 #include <string>
 #include <algorithm>
@@ -51,15 +54,27 @@ void UserSettings::showHelp()
 	printf("Built: %s %s\n\n", __TIME__, __DATE__);
 	
 	printf("Usage: %s [options... ] <file>\n", BIN_NAME);
+	printf("  <file> may be \"-\" (stdin), a pipe or a FIFO to stream an XCI/PFS/NSP in one forward pass (requires --type).\n");
+	printf("  <file> may be a directory or @<list file> (one path per line) to process a batch of files with --threads workers.\n");
 	printf("\n  General Options:\n");
 	printf("      -d, --dev       Use devkit keyset.\n");
 	printf("      -k, --keyset    Specify keyset file.\n");
+	printf("      --keycache      Load derived keys from a binary cache next to the keyset file (regenerated when the keyset changes).\n");
 	printf("      -t, --type      Specify input file type. [xci, pfs, romfs, nca, meta, cnmt, nso, nro, ini, kip, nacp, aset, cert, tik]\n");
 	printf("      -y, --verify    Verify file.\n");
+	printf("      --threads       Number of worker threads used for extraction. [1-%u|max] (1 is assumed).\n", (uint32_t)kMaxThreadNum);
+	printf("      --nommap        Read the input file with buffered I/O instead of memory mapping it.\n");
+	printf("      --blockcache    Size of the decompressed RomFS block cache (per reader) in MiB. [0-%u] (%u is assumed).\n", (uint32_t)kMaxBlockCacheSizeMiB, (uint32_t)kDefaultBlockCacheSizeMiB);
+	printf("      --ncacache      Size of the verified NCA PartitionFs (ExeFS) block cache in MiB. [0-%u] (%u is assumed).\n", (uint32_t)kMaxBlockCacheSizeMiB, (uint32_t)kDefaultNcaCacheSizeMiB);
 	printf("\n  Output Options:\n");
 	printf("      --showkeys      Show keys generated.\n");
 	printf("      --showlayout    Show layout metadata.\n");
 	printf("      -v, --verbose   Verbose output.\n");
+	printf("\n  Extract Options:\n");
+	printf("      --include       Only extract files matching a pattern, may be repeated. [glob, or re:<regex>]\n");
+	printf("      --exclude       Do not extract files matching a pattern, may be repeated. [glob, or re:<regex>]\n");
+	printf("                      Globs without a '/' match the file name, \"**\" also matches across directories (e.g. \"*.bfres\", \"/Data/Movie/**\").\n");
+	printf("      --tar           Write extracted files to a tar archive (\"-\" for stdout) instead of to disk, the extract directories become paths in the archive.\n");
 	printf("\n  XCI (GameCard Image)\n");
 	printf("    %s [--listfs] [--update <dir> --logo <dir> --normal <dir> --secure <dir>] <.xci file>\n", BIN_NAME);
 	printf("      --listfs        Print file system in embedded partitions.\n");
@@ -68,20 +83,28 @@ void UserSettings::showHelp()
 	printf("      --normal        Extract \"normal\" partition to directory.\n");
 	printf("      --secure        Extract \"secure\" partition to directory.\n");
 	printf("\n  PFS0/HFS0 (PartitionFs), RomFs, NSP (Ninendo Submission Package)\n");
-	printf("    %s [--listfs] [--fsdir <dir>] <file>\n", BIN_NAME);
+	printf("    %s [--listfs] [--fsdir <dir>] [--extract-file <path>] [--erofs <file>] <file>\n", BIN_NAME);
 	printf("      --listfs        Print file system.\n");
 	printf("      --fsdir         Extract file system to directory.\n");
+	printf("      --extract-file  Extract a single file from a RomFS by path, to the --fsdir directory if specified.\n");
+	printf("      --erofs         Convert a RomFS to an (uncompressed) EROFS image, which can be mounted read-only on Linux.\n");
 	printf("\n  NCA (Nintendo Content Archive)\n");
-	printf("    %s [--listfs] [--bodykey <key> --titlekey <key>] [--part0 <dir> ...] <.nca file>\n", BIN_NAME);
+	printf("    %s [--listfs] [--verify-full] [--bodykey <key> --titlekey <key> --titlekeys <file> --tikdir <dir>] [--part0 <dir> ...] [--extract-file <path>] [--erofs <file>] [--basenca <.nca file>] <.nca file>\n", BIN_NAME);
 	printf("      --listfs        Print file system in embedded partitions.\n");
 	printf("      --titlekey      Specify title key extracted from ticket.\n");
 	printf("      --bodykey       Specify body encryption key.\n");
 	printf("      --tik           Specify ticket to source title key.\n");
+	printf("      --titlekeys     Specify title.keys file to source title keys. (~/.switch/title.keys is used if present)\n");
+	printf("      --tikdir        Specify directory of tickets (.tik) to source title keys.\n");
 	printf("      --cert          Specify certificate chain to verify ticket.\n");
+	printf("      --verify-full   Verify every block of each partition's hash tree, reporting all bad blocks.\n");
 	printf("      --part0         Extract \"partition 0\" to directory.\n");
 	printf("      --part1         Extract \"partition 1\" to directory.\n");
 	printf("      --part2         Extract \"partition 2\" to directory.\n");
 	printf("      --part3         Extract \"partition 3\" to directory.\n");
+	printf("      --extract-file  Extract a single file from the RomFS partition by path, to that partition's directory if specified.\n");
+	printf("      --erofs         Convert the RomFS partition to an (uncompressed) EROFS image.\n");
+	printf("      --basenca       Specify base NCA, to read the patched partitions of an update NCA.\n");
 	printf("\n  NSO (Nintendo Software Object), NRO (Nintendo Relocatable Object)\n");
 	printf("    %s [--listapi --listsym] [--insttype <inst. type>] <file>\n", BIN_NAME);
 	printf("      --listapi       Print SDK API List.\n");
@@ -104,7 +127,7 @@ const std::string UserSettings::getInputPath() const
 	return mInputPath;
 }
 
-const KeyConfiguration& UserSettings::getKeyCfg() const
+std::shared_ptr<const KeyConfiguration> UserSettings::getKeyCfg() const
 {
 	return mKeyCfg;
 }
@@ -124,11 +147,46 @@ CliOutputMode UserSettings::getCliOutputMode() const
 	return mOutputMode;
 }
 
+size_t UserSettings::getThreadNum() const
+{
+	return mThreadNum;
+}
+
+bool UserSettings::isMemoryMapInput() const
+{
+	return mMemoryMapInput;
+}
+
+bool UserSettings::isStreamInput() const
+{
+	return mStreamInput;
+}
+
+bool UserSettings::isBatchInput() const
+{
+	return mBatchInput;
+}
+
+size_t UserSettings::getBlockCacheSize() const
+{
+	return mBlockCacheSize;
+}
+
+size_t UserSettings::getNcaCacheSize() const
+{
+	return mNcaCacheSize;
+}
+
 bool UserSettings::isListFs() const
 {
 	return mListFs;
 }
 
+bool UserSettings::isVerifyNcaHashTree() const
+{
+	return mVerifyNcaHashTree;
+}
+
 bool UserSettings::isListApi() const
 {
 	return mListApi;
@@ -168,6 +226,26 @@ const sOptional<std::string>& UserSettings::getFsPath() const
 	return mFsPath;
 }
 
+const sOptional<std::string>& UserSettings::getExtractFilePath() const
+{
+	return mExtractFilePath;
+}
+
+std::shared_ptr<const PathFilter> UserSettings::getExtractFilter() const
+{
+	return mExtractFilter;
+}
+
+const sOptional<std::string>& UserSettings::getTarPath() const
+{
+	return mTarPath;
+}
+
+const sOptional<std::string>& UserSettings::getErofsPath() const
+{
+	return mErofsPath;
+}
+
 const sOptional<std::string>& UserSettings::getNcaPart0Path() const
 {
 	return mNcaPart0Path;
@@ -188,6 +266,11 @@ const sOptional<std::string>& UserSettings::getNcaPart3Path() const
 	return mNcaPart3Path;
 }
 
+const sOptional<std::string>& UserSettings::getNcaBasePath() const
+{
+	return mNcaBasePath;
+}
+
 const sOptional<std::string>& UserSettings::getKipExtractPath() const
 {
 	return mKipExtractPath;
@@ -268,12 +351,42 @@ void UserSettings::populateCmdArgs(const std::vector<std::string>& arg_list, sCm
 			cmd_args.keyset_path = arg_list[i+1];
 		}
 
+		else if (arg_list[i] == "--keycache")
+		{
+			if (hasParamter) throw fnd::Exception(kModuleName, arg_list[i] + " does not take a parameter.");
+			cmd_args.key_cache = true;
+		}
+
 		else if (arg_list[i] == "-t" || arg_list[i] == "--type")
 		{
 			if (!hasParamter) throw fnd::Exception(kModuleName, arg_list[i] + " requries a parameter.");
 			cmd_args.file_type = arg_list[i+1];
 		}
 
+		else if (arg_list[i] == "--threads")
+		{
+			if (!hasParamter) throw fnd::Exception(kModuleName, arg_list[i] + " requries a parameter.");
+			cmd_args.thread_num = arg_list[i+1];
+		}
+
+		else if (arg_list[i] == "--nommap")
+		{
+			if (hasParamter) throw fnd::Exception(kModuleName, arg_list[i] + " does not take a parameter.");
+			cmd_args.no_mmap = true;
+		}
+
+		else if (arg_list[i] == "--blockcache")
+		{
+			if (!hasParamter) throw fnd::Exception(kModuleName, arg_list[i] + " requries a parameter.");
+			cmd_args.block_cache_size = arg_list[i+1];
+		}
+
+		else if (arg_list[i] == "--ncacache")
+		{
+			if (!hasParamter) throw fnd::Exception(kModuleName, arg_list[i] + " requries a parameter.");
+			cmd_args.nca_cache_size = arg_list[i+1];
+		}
+
 		else if (arg_list[i] == "--listfs")
 		{
 			if (hasParamter) throw fnd::Exception(kModuleName, arg_list[i] + " does not take a parameter.");
@@ -310,6 +423,36 @@ void UserSettings::populateCmdArgs(const std::vector<std::string>& arg_list, sCm
 			cmd_args.fs_path = arg_list[i+1];
 		}
 
+		else if (arg_list[i] == "--include")
+		{
+			if (!hasParamter) throw fnd::Exception(kModuleName, arg_list[i] + " requries a parameter.");
+			cmd_args.include_patterns.push_back(arg_list[i+1]);
+		}
+
+		else if (arg_list[i] == "--exclude")
+		{
+			if (!hasParamter) throw fnd::Exception(kModuleName, arg_list[i] + " requries a parameter.");
+			cmd_args.exclude_patterns.push_back(arg_list[i+1]);
+		}
+
+		else if (arg_list[i] == "--tar")
+		{
+			if (!hasParamter) throw fnd::Exception(kModuleName, arg_list[i] + " requries a parameter.");
+			cmd_args.tar_path = arg_list[i+1];
+		}
+
+		else if (arg_list[i] == "--extract-file")
+		{
+			if (!hasParamter) throw fnd::Exception(kModuleName, arg_list[i] + " requries a parameter.");
+			cmd_args.extract_file_path = arg_list[i+1];
+		}
+
+		else if (arg_list[i] == "--erofs")
+		{
+			if (!hasParamter) throw fnd::Exception(kModuleName, arg_list[i] + " requries a parameter.");
+			cmd_args.erofs_path = arg_list[i+1];
+		}
+
 		else if (arg_list[i] == "--titlekey")
 		{
 			if (!hasParamter) throw fnd::Exception(kModuleName, arg_list[i] + " requries a parameter.");
@@ -328,12 +471,30 @@ void UserSettings::populateCmdArgs(const std::vector<std::string>& arg_list, sCm
 			cmd_args.ticket_path = arg_list[i+1];
 		}
 
+		else if (arg_list[i] == "--titlekeys")
+		{
+			if (!hasParamter) throw fnd::Exception(kModuleName, arg_list[i] + " requries a parameter.");
+			cmd_args.title_keyfile_path = arg_list[i+1];
+		}
+
+		else if (arg_list[i] == "--tikdir")
+		{
+			if (!hasParamter) throw fnd::Exception(kModuleName, arg_list[i] + " requries a parameter.");
+			cmd_args.ticket_dir_path = arg_list[i+1];
+		}
+
 		else if (arg_list[i] == "--cert")
 		{
 			if (!hasParamter) throw fnd::Exception(kModuleName, arg_list[i] + " requries a parameter.");
 			cmd_args.cert_path = arg_list[i+1];
 		}
 
+		else if (arg_list[i] == "--verify-full")
+		{
+			if (hasParamter) throw fnd::Exception(kModuleName, arg_list[i] + " does not take a parameter.");
+			cmd_args.verify_full = true;
+		}
+
 		else if (arg_list[i] == "--part0")
 		{
 			if (!hasParamter) throw fnd::Exception(kModuleName, arg_list[i] + " requries a parameter.");
@@ -358,6 +519,12 @@ void UserSettings::populateCmdArgs(const std::vector<std::string>& arg_list, sCm
 			cmd_args.part3_path = arg_list[i+1];
 		}
 
+		else if (arg_list[i] == "--basenca")
+		{
+			if (!hasParamter) throw fnd::Exception(kModuleName, arg_list[i] + " requries a parameter.");
+			cmd_args.base_nca_path = arg_list[i+1];
+		}
+
 		else if (arg_list[i] == "--listapi")
 		{
 			if (hasParamter) throw fnd::Exception(kModuleName, arg_list[i] + " does not take a parameter.");
@@ -405,29 +572,68 @@ void UserSettings::populateCmdArgs(const std::vector<std::string>& arg_list, sCm
 
 void UserSettings::populateKeyset(sCmdArgs& args)
 {
+	// the key configuration is only modified here, afterwards it is shared read-only with the processors
+	mKeyCfg = std::make_shared<KeyConfiguration>();
+
 	if (args.keyset_path.isSet)
 	{
-		mKeyCfg.importHactoolGenericKeyfile(*args.keyset_path);
+		if (args.key_cache.isSet)
+			mKeyCfg->importHactoolGenericKeyfile(*args.keyset_path, *args.keyset_path + kKeyCacheExtension);
+		else
+			mKeyCfg->importHactoolGenericKeyfile(*args.keyset_path);
  	}
 	else
 	{
 		// open other resource files in $HOME/.switch/prod.keys (or $HOME/.switch/dev.keys if -d/--dev is set).
+		// the default keyset is optional, the keys given on the command line are still imported without it
 		std::string keyset_path;
 		getSwitchPath(keyset_path);
-		if (keyset_path.empty())
-			return;
-		
-		fnd::io::appendToPath(keyset_path, kGeneralKeyfileName[args.devkit_keys.isSet]);
-
-		try
+		if (keyset_path.empty() == false)
 		{
-			mKeyCfg.importHactoolGenericKeyfile(keyset_path);
+			fnd::io::appendToPath(keyset_path, kGeneralKeyfileName[args.devkit_keys.isSet]);
+
+			try
+			{
+				if (args.key_cache.isSet)
+					mKeyCfg->importHactoolGenericKeyfile(keyset_path, keyset_path + kKeyCacheExtension);
+				else
+					mKeyCfg->importHactoolGenericKeyfile(keyset_path);
+			}
+			catch (const fnd::Exception&)
+			{
+				// title keys are decrypted with the common keys from the keyset, so without it the title keys given would be silently dropped
+				if (args.title_keyfile_path.isSet || args.ticket_dir_path.isSet)
+					throw fnd::Exception(kModuleName, "--titlekeys and --tikdir require a keyset to decrypt the title keys, failed to open keyset file: " + keyset_path);
+			}
 		}
-		catch (const fnd::Exception&)
+	}
+
+	if (args.title_keyfile_path.isSet)
+	{
+		mKeyCfg->importHactoolTitleKeyfile(*args.title_keyfile_path);
+	}
+	else
+	{
+		// title keys in $HOME/.switch/title.keys are imported if present, whichever keyset is used
+		std::string title_keyfile_path;
+		getSwitchPath(title_keyfile_path);
+		if (title_keyfile_path.empty() == false)
 		{
-			return;
+			fnd::io::appendToPath(title_keyfile_path, kTitleKeyfileName);
+
+			try
+			{
+				mKeyCfg->importHactoolTitleKeyfile(title_keyfile_path);
+			}
+			catch (const fnd::Exception&)
+			{
+			}
 		}
-		
+	}
+
+	if (args.ticket_dir_path.isSet)
+	{
+		mKeyCfg->importTicketDirectory(*args.ticket_dir_path);
 	}
 
 	
@@ -440,7 +646,7 @@ void UserSettings::populateKeyset(sCmdArgs& args)
 		if (tmp_raw.size() != sizeof(fnd::aes::sAes128Key))
 			throw fnd::Exception(kModuleName, "Key: \"--bodykey\" has incorrect length");
 		memcpy(tmp_key.key, tmp_raw.data(), 16);
-		mKeyCfg.addNcaExternalContentKey(kDummyRightsIdForUserBodyKey, tmp_key);
+		mKeyCfg->addNcaExternalContentKey(kDummyRightsIdForUserBodyKey, tmp_key);
 	}
 
 	if (args.nca_titlekey.isSet)
@@ -451,7 +657,7 @@ void UserSettings::populateKeyset(sCmdArgs& args)
 		if (tmp_raw.size() != sizeof(fnd::aes::sAes128Key))
 			throw fnd::Exception(kModuleName, "Key: \"--titlekey\" has incorrect length");
 		memcpy(tmp_key.key, tmp_raw.data(), 16);
-		mKeyCfg.addNcaExternalContentKey(kDummyRightsIdForUserTitleKey, tmp_key);
+		mKeyCfg->addNcaExternalContentKey(kDummyRightsIdForUserTitleKey, tmp_key);
 	}
 
 	// import certificate chain
@@ -522,10 +728,10 @@ void UserSettings::populateKeyset(sCmdArgs& args)
 			fnd::aes::sAes128Key enc_title_key;
 			memcpy(enc_title_key.key, tik.getBody().getEncTitleKey(), 16);
 			fnd::aes::sAes128Key common_key, external_content_key;
-			if (mKeyCfg.getETicketCommonKey(nn::hac::ContentArchiveUtil::getMasterKeyRevisionFromKeyGeneration(tik.getBody().getCommonKeyId()), common_key) == true)
+			if (mKeyCfg->getETicketCommonKey(nn::hac::ContentArchiveUtil::getMasterKeyRevisionFromKeyGeneration(tik.getBody().getCommonKeyId()), common_key) == true)
 			{
 				nn::hac::AesKeygen::generateKey(external_content_key.key, tik.getBody().getEncTitleKey(), common_key.key);
-				mKeyCfg.addNcaExternalContentKey(tik.getBody().getRightsId(), external_content_key);
+				mKeyCfg->addNcaExternalContentKey(tik.getBody().getRightsId(), external_content_key);
 			}
 			else
 			{
@@ -555,10 +761,27 @@ void UserSettings::populateUserSettings(sCmdArgs& args)
 	mXciLogoPath = args.logo_path;
 
 	mFsPath = args.fs_path;
+	mExtractFilePath = args.extract_file_path;
+	mTarPath = args.tar_path;
+	mErofsPath = args.erofs_path;
+
+	// files are only filtered when there are patterns
+	mExtractFilter = nullptr;
+	if (args.include_patterns.empty() == false || args.exclude_patterns.empty() == false)
+	{
+		std::shared_ptr<PathFilter> filter = std::make_shared<PathFilter>();
+		for (size_t i = 0; i < args.include_patterns.size(); i++)
+			filter->addInclude(args.include_patterns[i]);
+		for (size_t i = 0; i < args.exclude_patterns.size(); i++)
+			filter->addExclude(args.exclude_patterns[i]);
+		mExtractFilter = filter;
+	}
+	mVerifyNcaHashTree = args.verify_full.isSet;
 	mNcaPart0Path = args.part0_path;
 	mNcaPart1Path = args.part1_path;
 	mNcaPart2Path = args.part2_path;
 	mNcaPart3Path = args.part3_path;
+	mNcaBasePath = args.base_nca_path;
 
 	mKipExtractPath = args.kip_extract_path;
 
@@ -574,6 +797,35 @@ void UserSettings::populateUserSettings(sCmdArgs& args)
 	mAssetIconPath = args.asset_icon_path;
 	mAssetNacpPath = args.asset_nacp_path;
 
+	// determine the number of worker threads
+	if (args.thread_num.isSet)
+		mThreadNum = getThreadNumFromString(*args.thread_num);
+	else
+		mThreadNum = 1; // default single threaded
+
+	// regular files are memory mapped unless disabled
+	mMemoryMapInput = args.no_mmap.isSet == false;
+
+	// a directory or a list file (@list.txt) is processed as a batch of files
+	mBatchInput = BatchProcess::isBatchInput(mInputPath);
+	if (mBatchInput && (mXciUpdatePath.isSet || mXciLogoPath.isSet || mXciNormalPath.isSet || mXciSecurePath.isSet || mFsPath.isSet || mExtractFilePath.isSet || mTarPath.isSet || mErofsPath.isSet || mNcaPart0Path.isSet || mNcaPart1Path.isSet || mNcaPart2Path.isSet || mNcaPart3Path.isSet || mKipExtractPath.isSet || mAssetIconPath.isSet || mAssetNacpPath.isSet))
+		throw fnd::Exception(kModuleName, "Extraction options cannot be used with batch input.");
+
+	// stdin, pipes and FIFOs can only be read once, front to back
+	mStreamInput = mBatchInput == false && StreamIFile::isStream(mInputPath);
+
+	// determine the size of the decompressed block cache
+	if (args.block_cache_size.isSet)
+		mBlockCacheSize = getBlockCacheSizeFromString(*args.block_cache_size);
+	else
+		mBlockCacheSize = kDefaultBlockCacheSizeMiB * 0x100000;
+
+	// determine the size of the verified NCA block cache
+	if (args.nca_cache_size.isSet)
+		mNcaCacheSize = getBlockCacheSizeFromString(*args.nca_cache_size);
+	else
+		mNcaCacheSize = kDefaultNcaCacheSizeMiB * 0x100000;
+
 	// determine output mode
 	mOutputMode = _BIT(OUTPUT_BASIC);
 	if (args.verbose_output.isSet)
@@ -594,12 +846,20 @@ void UserSettings::populateUserSettings(sCmdArgs& args)
 	// determine input file type
 	if (args.file_type.isSet)
 		mFileType = getFileTypeFromString(*args.file_type);
+	else if (mStreamInput)
+		throw fnd::Exception(kModuleName, "Input file type must be specified when streaming input.");
+	else if (mBatchInput)
+		mFileType = FILE_INVALID; // determined for each file in the batch
 	else
 		mFileType = determineFileTypeFromFile(mInputPath);
 	
 	// check is the input file could be identified
-	if (mFileType == FILE_INVALID)
+	if (mFileType == FILE_INVALID && (mBatchInput == false || args.file_type.isSet))
 		throw fnd::Exception(kModuleName, "Unknown file type.");
+
+	// only formats that can be processed in a single forward pass can be streamed
+	if (mStreamInput && mFileType != FILE_GAMECARD && mFileType != FILE_PARTITIONFS && mFileType != FILE_NSP)
+		throw fnd::Exception(kModuleName, "Streaming input is only supported for xci, pfs and nsp files.");
 }
 
 FileType UserSettings::getFileTypeFromString(const std::string& type_str)
@@ -646,7 +906,7 @@ FileType UserSettings::getFileTypeFromString(const std::string& type_str)
 	return type;
 }
 
-FileType UserSettings::determineFileTypeFromFile(const std::string& path)
+FileType UserSettings::determineFileTypeFromFile(const std::string& path) const
 {
 	static const size_t kMaxReadSize = 0x5000;
 	FileType file_type = FILE_INVALID;
@@ -737,7 +997,7 @@ bool UserSettings::determineValidNcaFromSample(const fnd::Vec<byte_t>& sample) c
 		return false;
 
 	fnd::aes::sAesXts128Key header_key;
-	mKeyCfg.getContentArchiveHeaderKey(header_key);
+	mKeyCfg->getContentArchiveHeaderKey(header_key);
 	nn::hac::ContentArchiveUtil::decryptContentArchiveHeader(sample.data(), nca_raw, header_key);
 
 	if (nca_header->st_magic.get() != nn::hac::nca::kNca2StructMagic && nca_header->st_magic.get() != nn::hac::nca::kNca3StructMagic)
@@ -888,6 +1148,32 @@ bool UserSettings::getIs64BitInstructionFromString(const std::string & type_str)
 	return flag;
 }
 
+size_t UserSettings::getThreadNumFromString(const std::string& num_str)
+{
+	std::string str = num_str;
+	std::transform(str.begin(), str.end(), str.begin(), ::tolower);
+
+	if (str == "max")
+		return std::min<size_t>(ThreadPool::getHardwareThreadNum(), kMaxThreadNum);
+
+	char* end = nullptr;
+	unsigned long num = strtoul(str.c_str(), &end, 10);
+	if (str.empty() || *end != '\0' || num < 1 || num > kMaxThreadNum)
+		throw fnd::Exception(kModuleName, "Unsupported thread count: " + num_str);
+
+	return num;
+}
+
+size_t UserSettings::getBlockCacheSizeFromString(const std::string& size_str)
+{
+	char* end = nullptr;
+	unsigned long size = strtoul(size_str.c_str(), &end, 10);
+	if (size_str.empty() || *end != '\0' || size > kMaxBlockCacheSizeMiB)
+		throw fnd::Exception(kModuleName, "Unsupported block cache size: " + size_str);
+
+	return size * 0x100000;
+}
+
 void UserSettings::getHomePath(std::string& path) const
 {
 	// open other resource files in $HOME/.switch/prod.keys (or $HOME/.switch/dev.keys if -d/--dev is set).
@@ -924,49 +1210,49 @@ void UserSettings::dumpKeyConfig() const
 		std::cout << "  NCA Keys:" << std::endl;
 		for (size_t i = 0; i < kMasterKeyNum; i++)
 		{
-			if (mKeyCfg.getContentArchiveHeader0SignKey(rsa2048_key, byte_t(i)) == true)
+			if (mKeyCfg->getContentArchiveHeader0SignKey(rsa2048_key, byte_t(i)) == true)
 				dumpRsa2048Key(rsa2048_key, "Header0-SignatureKey-" + kKeyIndex[i], 2);
 		}
 		for (size_t i = 0; i < kMasterKeyNum; i++)
 		{
-			if (mKeyCfg.getAcidSignKey(rsa2048_key, byte_t(i)) == true)
+			if (mKeyCfg->getAcidSignKey(rsa2048_key, byte_t(i)) == true)
 				dumpRsa2048Key(rsa2048_key, "Acid-SignatureKey-" + kKeyIndex[i], 2);
 		}
 		
-		if (mKeyCfg.getContentArchiveHeaderKey(aesxts_key) == true)
+		if (mKeyCfg->getContentArchiveHeaderKey(aesxts_key) == true)
 			dumpAesXtsKey(aesxts_key, "Header-EncryptionKey", 2);
 		
 		for (size_t i = 0; i < kMasterKeyNum; i++)
 		{
-			if (mKeyCfg.getNcaKeyAreaEncryptionKey(byte_t(i), 0, aes_key) == true)
+			if (mKeyCfg->getNcaKeyAreaEncryptionKey(byte_t(i), 0, aes_key) == true)
 				dumpAesKey(aes_key, "KeyAreaEncryptionKey-Application-" + kKeyIndex[i], 2);
-			if (mKeyCfg.getNcaKeyAreaEncryptionKey(byte_t(i), 1, aes_key) == true)
+			if (mKeyCfg->getNcaKeyAreaEncryptionKey(byte_t(i), 1, aes_key) == true)
 				dumpAesKey(aes_key, "KeyAreaEncryptionKey-Ocean-" + kKeyIndex[i], 2);
-			if (mKeyCfg.getNcaKeyAreaEncryptionKey(byte_t(i), 2, aes_key) == true)
+			if (mKeyCfg->getNcaKeyAreaEncryptionKey(byte_t(i), 2, aes_key) == true)
 				dumpAesKey(aes_key, "KeyAreaEncryptionKey-System-" + kKeyIndex[i], 2);
 		}
 
 		for (size_t i = 0; i < kMasterKeyNum; i++)
 		{
-			if (mKeyCfg.getNcaKeyAreaEncryptionKeyHw(byte_t(i), 0, aes_key) == true)
+			if (mKeyCfg->getNcaKeyAreaEncryptionKeyHw(byte_t(i), 0, aes_key) == true)
 				dumpAesKey(aes_key, "KeyAreaEncryptionKeyHw-Application-" + kKeyIndex[i], 2);
-			if (mKeyCfg.getNcaKeyAreaEncryptionKeyHw(byte_t(i), 1, aes_key) == true)
+			if (mKeyCfg->getNcaKeyAreaEncryptionKeyHw(byte_t(i), 1, aes_key) == true)
 				dumpAesKey(aes_key, "KeyAreaEncryptionKeyHw-Ocean-" + kKeyIndex[i], 2);
-			if (mKeyCfg.getNcaKeyAreaEncryptionKeyHw(byte_t(i), 2, aes_key) == true)
+			if (mKeyCfg->getNcaKeyAreaEncryptionKeyHw(byte_t(i), 2, aes_key) == true)
 				dumpAesKey(aes_key, "KeyAreaEncryptionKeyHw-System-" + kKeyIndex[i], 2);
 		}
 		
 		std::cout << "  NRR Keys:" << std::endl;
 		for (size_t i = 0; i < kMasterKeyNum; i++)
 		{
-			if (mKeyCfg.getNrrCertificateSignKey(rsa2048_key, byte_t(i)) == true)
+			if (mKeyCfg->getNrrCertificateSignKey(rsa2048_key, byte_t(i)) == true)
 				dumpRsa2048Key(rsa2048_key, "Certificate-SignatureKey-" + kKeyIndex[i], 2);
 		}
 
 		std::cout << "  XCI Keys:" << std::endl;
-		if (mKeyCfg.getXciHeaderSignKey(rsa2048_key) == true)
+		if (mKeyCfg->getXciHeaderSignKey(rsa2048_key) == true)
 			dumpRsa2048Key(rsa2048_key, "Header-SignatureKey", 2);
-		if (mKeyCfg.getXciHeaderKey(aes_key) == true)
+		if (mKeyCfg->getXciHeaderKey(aes_key) == true)
 			dumpAesKey(aes_key, "ExtendedHeader-EncryptionKey", 2);
 		
 	
@@ -975,27 +1261,27 @@ void UserSettings::dumpKeyConfig() const
 		std::cout << "  Package1 Keys:" << std::endl;
 		for (size_t i = 0; i < kMasterKeyNum; i++)
 		{
-			if (mKeyCfg.getPkg1Key(byte_t(i), aes_key) == true)
+			if (mKeyCfg->getPkg1Key(byte_t(i), aes_key) == true)
 				dumpAesKey(aes_key, "EncryptionKey-" + kKeyIndex[i], 2);
 		}
 
 		std::cout << "  Package2 Keys:" << std::endl;
-		if (mKeyCfg.getPkg2SignKey(rsa2048_key) == true)
+		if (mKeyCfg->getPkg2SignKey(rsa2048_key) == true)
 			dumpRsa2048Key(rsa2048_key, "Signature Key", 2);
 		for (size_t i = 0; i < kMasterKeyNum; i++)
 		{
-			if (mKeyCfg.getPkg2Key(byte_t(i), aes_key) == true)
+			if (mKeyCfg->getPkg2Key(byte_t(i), aes_key) == true)
 				dumpAesKey(aes_key, "EncryptionKey-" + kKeyIndex[i], 2);
 		}
 
 		std::cout << "  ETicket Keys:" << std::endl;
 		for (size_t i = 0; i < kMasterKeyNum; i++)
 		{
-			if (mKeyCfg.getETicketCommonKey(byte_t(i), aes_key) == true)
+			if (mKeyCfg->getETicketCommonKey(byte_t(i), aes_key) == true)
 				dumpAesKey(aes_key, "CommonKey-" + kKeyIndex[i], 2);
 		}
 		
-		if (mKeyCfg.getPkiRootSignKey("Root", rsa4096_key) == true)
+		if (mKeyCfg->getPkiRootSignKey("Root", rsa4096_key) == true)
 			dumpRsa4096Key(rsa4096_key, "NNPKI Root Key", 1);
 }
 
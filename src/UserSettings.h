@@ -9,6 +9,7 @@
 #include <nn/hac/define/meta.h>
 #include "common.h"
 #include "KeyConfiguration.h"
+#include "PathFilter.h"
 
 class UserSettings
 {
@@ -20,13 +21,20 @@ public:
 
 	// generic options
 	const std::string getInputPath() const;
-	const KeyConfiguration& getKeyCfg() const;
+	std::shared_ptr<const KeyConfiguration> getKeyCfg() const;
 	FileType getFileType() const;
 	bool isVerifyFile() const;
 	CliOutputMode getCliOutputMode() const;
+	size_t getThreadNum() const;
+	bool isMemoryMapInput() const;
+	bool isStreamInput() const;
+	bool isBatchInput() const;
+	size_t getBlockCacheSize() const;
+	size_t getNcaCacheSize() const;
 	
 	// specialised toggles
 	bool isListFs() const;
+	bool isVerifyNcaHashTree() const;
 	bool isListApi() const;
 	bool isListSymbols() const;
 	bool getIs64BitInstruction() const;
@@ -37,21 +45,34 @@ public:
 	const sOptional<std::string>& getXciNormalPath() const;
 	const sOptional<std::string>& getXciSecurePath() const;
 	const sOptional<std::string>& getFsPath() const;
+	const sOptional<std::string>& getExtractFilePath() const;
+	std::shared_ptr<const PathFilter> getExtractFilter() const;
+	const sOptional<std::string>& getTarPath() const;
+	const sOptional<std::string>& getErofsPath() const;
 	const sOptional<std::string>& getNcaPart0Path() const;
 	const sOptional<std::string>& getNcaPart1Path() const;
 	const sOptional<std::string>& getNcaPart2Path() const;
 	const sOptional<std::string>& getNcaPart3Path() const;
+	const sOptional<std::string>& getNcaBasePath() const;
 	const sOptional<std::string>& getKipExtractPath() const;
 	const sOptional<std::string>& getAssetIconPath() const;
 	const sOptional<std::string>& getAssetNacpPath() const;
 	const fnd::List<nn::pki::SignedData<nn::pki::CertificateBody>>& getCertificateChain() const;
 
+	// used to identify each file of a batch when a file type was not specified
+	FileType determineFileTypeFromFile(const std::string& path) const;
+
 private:
 	const std::string kModuleName = "UserSettings";
 
 	const std::string kHomeSwitchDirStr = ".switch";
 	const std::string kGeneralKeyfileName[2] = { "prod.keys", "dev.keys" };
 	const std::string kTitleKeyfileName = "title.keys";
+	const std::string kKeyCacheExtension = ".cache";
+	static const size_t kMaxThreadNum = 64;
+	static const size_t kDefaultBlockCacheSizeMiB = 16;
+	static const size_t kMaxBlockCacheSizeMiB = 4096;
+	static const size_t kDefaultNcaCacheSizeMiB = 64;
 	
 	
 	struct sCmdArgs
@@ -60,25 +81,39 @@ private:
 		sOptional<std::string> input_path;
 		sOptional<bool> devkit_keys;
 		sOptional<std::string> keyset_path;
+		sOptional<bool> key_cache;
 		sOptional<std::string> file_type;
 		sOptional<bool> verify_file;
 		sOptional<bool> show_keys;
 		sOptional<bool> show_layout;
 		sOptional<bool> verbose_output;
+		sOptional<std::string> thread_num;
+		sOptional<bool> no_mmap;
+		sOptional<std::string> block_cache_size;
+		sOptional<std::string> nca_cache_size;
 		sOptional<bool> list_fs;
 		sOptional<std::string> update_path;
 		sOptional<std::string> logo_path;
 		sOptional<std::string> normal_path;
 		sOptional<std::string> secure_path;
 		sOptional<std::string> fs_path;
+		sOptional<std::string> extract_file_path;
+		std::vector<std::string> include_patterns;
+		std::vector<std::string> exclude_patterns;
+		sOptional<std::string> tar_path;
+		sOptional<std::string> erofs_path;
 		sOptional<std::string> nca_titlekey;
 		sOptional<std::string> nca_bodykey;
 		sOptional<std::string> ticket_path;
+		sOptional<std::string> title_keyfile_path;
+		sOptional<std::string> ticket_dir_path;
 		sOptional<std::string> cert_path;
+		sOptional<bool> verify_full;
 		sOptional<std::string> part0_path;
 		sOptional<std::string> part1_path;
 		sOptional<std::string> part2_path;
 		sOptional<std::string> part3_path;
+		sOptional<std::string> base_nca_path;
 		sOptional<std::string> kip_extract_path;
 		sOptional<bool> list_api;
 		sOptional<bool> list_sym;
@@ -89,9 +124,15 @@ private:
 	
 	std::string mInputPath;
 	FileType mFileType;
-	KeyConfiguration mKeyCfg;
+	std::shared_ptr<KeyConfiguration> mKeyCfg;
 	bool mVerifyFile;
 	CliOutputMode mOutputMode;
+	size_t mThreadNum;
+	bool mMemoryMapInput;
+	bool mStreamInput;
+	bool mBatchInput;
+	size_t mBlockCacheSize;
+	size_t mNcaCacheSize;
 
 	bool mListFs;
 	sOptional<std::string> mXciUpdatePath;
@@ -99,11 +140,17 @@ private:
 	sOptional<std::string> mXciNormalPath;
 	sOptional<std::string> mXciSecurePath;
 	sOptional<std::string> mFsPath;
+	sOptional<std::string> mExtractFilePath;
+	std::shared_ptr<const PathFilter> mExtractFilter;
+	sOptional<std::string> mTarPath;
+	sOptional<std::string> mErofsPath;
 
+	bool mVerifyNcaHashTree;
 	sOptional<std::string> mNcaPart0Path;
 	sOptional<std::string> mNcaPart1Path;
 	sOptional<std::string> mNcaPart2Path;
 	sOptional<std::string> mNcaPart3Path;
+	sOptional<std::string> mNcaBasePath;
 
 	sOptional<std::string> mKipExtractPath;
 
@@ -120,13 +167,14 @@ private:
 	void populateKeyset(sCmdArgs& args);
 	void populateUserSettings(sCmdArgs& args);
 	FileType getFileTypeFromString(const std::string& type_str);
-	FileType determineFileTypeFromFile(const std::string& path);
 	bool determineValidNcaFromSample(const fnd::Vec<byte_t>& sample) const;
 	bool determineValidCnmtFromSample(const fnd::Vec<byte_t>& sample) const;
 	bool determineValidNacpFromSample(const fnd::Vec<byte_t>& sample) const;
 	bool determineValidEsCertFromSample(const fnd::Vec<byte_t>& sample) const;
 	bool determineValidEsTikFromSample(const fnd::Vec<byte_t>& sample) const;
 	bool getIs64BitInstructionFromString(const std::string& type_str);
+	size_t getThreadNumFromString(const std::string& num_str);
+	size_t getBlockCacheSizeFromString(const std::string& size_str);
 	void getHomePath(std::string& path) const;
 	void getSwitchPath(std::string& path) const;
 
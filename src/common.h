@@ -1,6 +1,9 @@
 #pragma once
 #include <string>
+#include <functional>
 #include <fnd/types.h>
+#include <fnd/IFile.h>
+#include <fnd/SharedPtr.h>
 #include <fnd/aes.h>
 #include <fnd/rsa.h>
 #include <nn/hac/define/nca.h>
@@ -38,6 +41,9 @@ enum CliOutputModeFlag
 
 typedef byte_t CliOutputMode;
 
+// creates a new reader over the same data, independent of any other reader (so it can be used on another thread)
+typedef std::function<fnd::SharedPtr<fnd::IFile>()> IFileFactory;
+
 template <typename T>
 struct sOptional
 {
@@ -1,8 +1,11 @@
 #include <cstdio>
-#include <fnd/SimpleFile.h>
+#include <memory>
 #include <fnd/SharedPtr.h>
 #include <fnd/StringConv.h>
 #include "UserSettings.h"
+#include "MemoryMappedFile.h"
+#include "StreamIFile.h"
+#include "PositionalFile.h"
 #include "GameCardProcess.h"
 #include "PfsProcess.h"
 #include "RomfsProcess.h"
@@ -17,237 +20,355 @@
 #include "PkiCertProcess.h"
 #include "EsTikProcess.h"
 #include "AssetProcess.h"
+#include "BatchProcess.h"
+#include "TarWriter.h"
+#include "BlockCache.h"
 
-#ifdef _WIN32
-int wmain(int argc, wchar_t** argv)
-#else
-int main(int argc, char** argv)
-#endif
+// opens a file for reading, along with a factory that gives worker threads their own reader of it
+static void openFile(const UserSettings& user_set, const std::string& path, fnd::SharedPtr<fnd::IFile>& file, IFileFactory& file_factory)
 {
-	std::vector<std::string> args;
-	for (size_t i = 0; i < (size_t)argc; i++)
+	if (user_set.isMemoryMapInput() && MemoryMappedFile::isSupported(path))
 	{
-#ifdef _WIN32
-		args.push_back(fnd::StringConv::ConvertChar16ToChar8(std::u16string((char16_t*)argv[i])));
-#else
-		args.push_back(argv[i]);
-#endif
+		// views share the one mapping, so each worker thread can be given its own view
+		std::shared_ptr<MemoryMappedFile> mappedFile(new MemoryMappedFile(path));
+		file = new MemoryMappedFile(*mappedFile, 0, mappedFile->size());
+		file_factory = [mappedFile]() -> fnd::SharedPtr<fnd::IFile> { return new MemoryMappedFile(*mappedFile, 0, mappedFile->size()); };
 	}
+	else
+	{
+		// worker threads are each given their own handle to the file
+		file = new PositionalFile(path);
+		file_factory = [path]() -> fnd::SharedPtr<fnd::IFile> { return new PositionalFile(path); };
+	}
+}
 
-	UserSettings user_set;
-	try {
-		user_set.parseCmdArgs(args);
-
-		fnd::SharedPtr<fnd::IFile> inputFile(new fnd::SimpleFile(user_set.getInputPath(), fnd::SimpleFile::Read));
-
-		if (user_set.getFileType() == FILE_GAMECARD)
-		{	
-			GameCardProcess obj;
+// processes a single input file, thread_num is the number of worker threads the file's processor may use
+static void processFile(const UserSettings& user_set, const std::string& input_path, FileType file_type, size_t thread_num, const std::shared_ptr<BlockCache>& ncaBlockCache)
+{
+	fnd::SharedPtr<fnd::IFile> inputFile;
+	IFileFactory inputFileFactory;
 
-			obj.setInputFile(inputFile);
-			
-			obj.setKeyCfg(user_set.getKeyCfg());
-			obj.setCliOutputMode(user_set.getCliOutputMode());
-			obj.setVerifyMode(user_set.isVerifyFile());
-
-			if (user_set.getXciUpdatePath().isSet)
-				obj.setPartitionForExtract(nn::hac::gc::kUpdatePartitionStr, user_set.getXciUpdatePath().var);
-			if (user_set.getXciLogoPath().isSet)
-				obj.setPartitionForExtract(nn::hac::gc::kLogoPartitionStr, user_set.getXciLogoPath().var);
-			if (user_set.getXciNormalPath().isSet)
-				obj.setPartitionForExtract(nn::hac::gc::kNormalPartitionStr, user_set.getXciNormalPath().var);
-			if (user_set.getXciSecurePath().isSet)
-				obj.setPartitionForExtract(nn::hac::gc::kSecurePartitionStr, user_set.getXciSecurePath().var);
-			obj.setListFs(user_set.isListFs());
+	if (user_set.isStreamInput())
+	{
+		// a stream can only be read once, so there is no factory to give worker threads their own reader
+		inputFile = new StreamIFile(input_path);
+	}
+	else
+	{
+		openFile(user_set, input_path, inputFile, inputFileFactory);
+	}
 
-			obj.process();
-		}
-		else if (user_set.getFileType() == FILE_PARTITIONFS || user_set.getFileType() == FILE_NSP)
+	// everything extracted from the file goes into the one archive
+	std::shared_ptr<TarWriter> extractArchive;
+	if (user_set.getTarPath().isSet)
+		extractArchive = std::make_shared<TarWriter>(user_set.getTarPath().var);
+
+	if (file_type == FILE_GAMECARD)
+	{	
+		GameCardProcess obj;
+
+		obj.setInputFile(inputFile);
+		obj.setInputFileFactory(inputFileFactory);
+		obj.setThreadNum(thread_num);
+		obj.setStreamInput(user_set.isStreamInput());
+		
+		obj.setKeyCfg(user_set.getKeyCfg());
+		obj.setCliOutputMode(user_set.getCliOutputMode());
+		obj.setVerifyMode(user_set.isVerifyFile());
+
+		if (user_set.getXciUpdatePath().isSet)
+			obj.setPartitionForExtract(nn::hac::gc::kUpdatePartitionStr, user_set.getXciUpdatePath().var);
+		if (user_set.getXciLogoPath().isSet)
+			obj.setPartitionForExtract(nn::hac::gc::kLogoPartitionStr, user_set.getXciLogoPath().var);
+		if (user_set.getXciNormalPath().isSet)
+			obj.setPartitionForExtract(nn::hac::gc::kNormalPartitionStr, user_set.getXciNormalPath().var);
+		if (user_set.getXciSecurePath().isSet)
+			obj.setPartitionForExtract(nn::hac::gc::kSecurePartitionStr, user_set.getXciSecurePath().var);
+		obj.setExtractFilter(user_set.getExtractFilter());
+		obj.setExtractArchive(extractArchive);
+		obj.setListFs(user_set.isListFs());
+
+		obj.process();
+	}
+	else if (file_type == FILE_PARTITIONFS || file_type == FILE_NSP)
+	{
+		PfsProcess obj;
+
+		obj.setInputFile(inputFile);
+		obj.setInputFileFactory(inputFileFactory);
+		obj.setThreadNum(thread_num);
+		obj.setStreamInput(user_set.isStreamInput());
+		obj.setCliOutputMode(user_set.getCliOutputMode());
+		obj.setVerifyMode(user_set.isVerifyFile());
+
+		if (user_set.getFsPath().isSet)
+			obj.setExtractPath(user_set.getFsPath().var);
+		else if (extractArchive != nullptr)
+			obj.setExtractPath(".");
+		obj.setExtractFilter(user_set.getExtractFilter());
+		obj.setExtractArchive(extractArchive);
+		obj.setListFs(user_set.isListFs());
+		
+		obj.process();
+	}
+	else if (file_type == FILE_ROMFS)
+	{
+		RomfsProcess obj;
+
+		obj.setInputFile(inputFile);
+		obj.setInputFileFactory(inputFileFactory);
+		obj.setThreadNum(thread_num);
+		obj.setBlockCacheSize(user_set.getBlockCacheSize());
+		obj.setCliOutputMode(user_set.getCliOutputMode());
+		obj.setVerifyMode(user_set.isVerifyFile());
+
+		if (user_set.getFsPath().isSet)
+			obj.setExtractPath(user_set.getFsPath().var);
+		else if (extractArchive != nullptr)
+			obj.setExtractPath(".");
+		if (user_set.getExtractFilePath().isSet)
+			obj.setExtractFilePath(user_set.getExtractFilePath().var);
+		if (user_set.getErofsPath().isSet)
+			obj.setErofsImagePath(user_set.getErofsPath().var);
+		obj.setExtractFilter(user_set.getExtractFilter());
+		obj.setExtractArchive(extractArchive);
+		obj.setListFs(user_set.isListFs());
+
+		obj.process();
+	}
+	else if (file_type == FILE_NCA)
+	{
+		NcaProcess obj;
+
+		obj.setInputFile(inputFile);
+		obj.setInputFileFactory(inputFileFactory);
+		obj.setThreadNum(thread_num);
+		obj.setBlockCacheSize(user_set.getBlockCacheSize());
+		obj.setVerifiedBlockCache(ncaBlockCache);
+		obj.setKeyCfg(user_set.getKeyCfg());
+		obj.setCliOutputMode(user_set.getCliOutputMode());
+		obj.setVerifyMode(user_set.isVerifyFile());
+		obj.setFullVerifyMode(user_set.isVerifyNcaHashTree());
+
+		if (user_set.getNcaPart0Path().isSet)
+			obj.setPartition0ExtractPath(user_set.getNcaPart0Path().var);
+		if (user_set.getNcaPart1Path().isSet)
+			obj.setPartition1ExtractPath(user_set.getNcaPart1Path().var);
+		if (user_set.getNcaPart2Path().isSet)
+			obj.setPartition2ExtractPath(user_set.getNcaPart2Path().var);
+		if (user_set.getNcaPart3Path().isSet)
+			obj.setPartition3ExtractPath(user_set.getNcaPart3Path().var);
+		if (user_set.getExtractFilePath().isSet)
+			obj.setRomfsExtractFilePath(user_set.getExtractFilePath().var);
+		if (user_set.getErofsPath().isSet)
+			obj.setRomfsErofsImagePath(user_set.getErofsPath().var);
+		obj.setExtractFilter(user_set.getExtractFilter());
+		obj.setExtractArchive(extractArchive);
+		obj.setListFs(user_set.isListFs());
+
+		if (user_set.getNcaBasePath().isSet)
 		{
-			PfsProcess obj;
-
-			obj.setInputFile(inputFile);
-			obj.setCliOutputMode(user_set.getCliOutputMode());
-			obj.setVerifyMode(user_set.isVerifyFile());
-
-			if (user_set.getFsPath().isSet)
-				obj.setExtractPath(user_set.getFsPath().var);
-			obj.setListFs(user_set.isListFs());
-			
-			obj.process();
+			fnd::SharedPtr<fnd::IFile> baseFile;
+			IFileFactory baseFileFactory;
+			openFile(user_set, user_set.getNcaBasePath().var, baseFile, baseFileFactory);
+			obj.setBaseNcaFile(baseFile);
+			obj.setBaseNcaFileFactory(baseFileFactory);
 		}
-		else if (user_set.getFileType() == FILE_ROMFS)
-		{
-			RomfsProcess obj;
-
-			obj.setInputFile(inputFile);
-			obj.setCliOutputMode(user_set.getCliOutputMode());
-			obj.setVerifyMode(user_set.isVerifyFile());
 
-			if (user_set.getFsPath().isSet)
-				obj.setExtractPath(user_set.getFsPath().var);
-			obj.setListFs(user_set.isListFs());
+		obj.process();
+	}
+	else if (file_type == FILE_META)
+	{
+		MetaProcess obj;
 
-			obj.process();
-		}
-		else if (user_set.getFileType() == FILE_NCA)
-		{
-			NcaProcess obj;
+		obj.setInputFile(inputFile);
+		obj.setKeyCfg(user_set.getKeyCfg());
+		obj.setCliOutputMode(user_set.getCliOutputMode());
+		obj.setVerifyMode(user_set.isVerifyFile());
 
-			obj.setInputFile(inputFile);
-			obj.setKeyCfg(user_set.getKeyCfg());
-			obj.setCliOutputMode(user_set.getCliOutputMode());
-			obj.setVerifyMode(user_set.isVerifyFile());
+		obj.process();
+	}
+	else if (file_type == FILE_CNMT)
+	{
+		CnmtProcess obj;
 
+		obj.setInputFile(inputFile);
+		obj.setCliOutputMode(user_set.getCliOutputMode());
+		obj.setVerifyMode(user_set.isVerifyFile());
 
-			if (user_set.getNcaPart0Path().isSet)
-				obj.setPartition0ExtractPath(user_set.getNcaPart0Path().var);
-			if (user_set.getNcaPart1Path().isSet)
-				obj.setPartition1ExtractPath(user_set.getNcaPart1Path().var);
-			if (user_set.getNcaPart2Path().isSet)
-				obj.setPartition2ExtractPath(user_set.getNcaPart2Path().var);
-			if (user_set.getNcaPart3Path().isSet)
-				obj.setPartition3ExtractPath(user_set.getNcaPart3Path().var);
-			obj.setListFs(user_set.isListFs());
+		obj.process();
+	}
+	else if (file_type == FILE_NSO)
+	{
+		NsoProcess obj;
 
-			obj.process();
-		}
-		else if (user_set.getFileType() == FILE_META)
-		{
-			MetaProcess obj;
+		obj.setInputFile(inputFile);
+		obj.setCliOutputMode(user_set.getCliOutputMode());
+		obj.setVerifyMode(user_set.isVerifyFile());
+		
+		obj.setIs64BitInstruction(user_set.getIs64BitInstruction());
+		obj.setListApi(user_set.isListApi());
+		obj.setListSymbols(user_set.isListSymbols());
 
-			obj.setInputFile(inputFile);
-			obj.setKeyCfg(user_set.getKeyCfg());
-			obj.setCliOutputMode(user_set.getCliOutputMode());
-			obj.setVerifyMode(user_set.isVerifyFile());
+		obj.process();
+	}
+	else if (file_type == FILE_NRO)
+	{
+		NroProcess obj;
+
+		obj.setInputFile(inputFile);
+		obj.setCliOutputMode(user_set.getCliOutputMode());
+		obj.setVerifyMode(user_set.isVerifyFile());
+		
+		obj.setIs64BitInstruction(user_set.getIs64BitInstruction());
+		obj.setListApi(user_set.isListApi());
+		obj.setListSymbols(user_set.isListSymbols());
+
+		if (user_set.getAssetIconPath().isSet)
+			obj.setAssetIconExtractPath(user_set.getAssetIconPath().var);
+		if (user_set.getAssetNacpPath().isSet)
+			obj.setAssetNacpExtractPath(user_set.getAssetNacpPath().var);
+
+		if (user_set.getFsPath().isSet)
+			obj.setAssetRomfsExtractPath(user_set.getFsPath().var);
+		obj.setAssetRomfsExtractFilter(user_set.getExtractFilter());
+		obj.setAssetListFs(user_set.isListFs());
+
+		obj.process();
+	}
+	else if (file_type == FILE_NACP)
+	{
+		NacpProcess obj;
 
-			obj.process();
-		}
-		else if (user_set.getFileType() == FILE_CNMT)
-		{
-			CnmtProcess obj;
+		obj.setInputFile(inputFile);
+		obj.setCliOutputMode(user_set.getCliOutputMode());
+		obj.setVerifyMode(user_set.isVerifyFile());
 
-			obj.setInputFile(inputFile);
-			obj.setCliOutputMode(user_set.getCliOutputMode());
-			obj.setVerifyMode(user_set.isVerifyFile());
+		obj.process();
+	}
+	else if (file_type == FILE_INI)
+	{
+		IniProcess obj;
 
-			obj.process();
-		}
-		else if (user_set.getFileType() == FILE_NSO)
-		{
-			NsoProcess obj;
+		obj.setInputFile(inputFile);
+		obj.setCliOutputMode(user_set.getCliOutputMode());
+		obj.setVerifyMode(user_set.isVerifyFile());
 
-			obj.setInputFile(inputFile);
-			obj.setCliOutputMode(user_set.getCliOutputMode());
-			obj.setVerifyMode(user_set.isVerifyFile());
-			
-			obj.setIs64BitInstruction(user_set.getIs64BitInstruction());
-			obj.setListApi(user_set.isListApi());
-			obj.setListSymbols(user_set.isListSymbols());
+		if (user_set.getKipExtractPath().isSet)
+			obj.setKipExtractPath(user_set.getKipExtractPath().var);
 
-			obj.process();
-		}
-		else if (user_set.getFileType() == FILE_NRO)
-		{
-			NroProcess obj;
+		obj.process();
+	}
+	else if (file_type == FILE_KIP)
+	{
+		KipProcess obj;
 
-			obj.setInputFile(inputFile);
-			obj.setCliOutputMode(user_set.getCliOutputMode());
-			obj.setVerifyMode(user_set.isVerifyFile());
-			
-			obj.setIs64BitInstruction(user_set.getIs64BitInstruction());
-			obj.setListApi(user_set.isListApi());
-			obj.setListSymbols(user_set.isListSymbols());
+		obj.setInputFile(inputFile);
+		obj.setCliOutputMode(user_set.getCliOutputMode());
+		obj.setVerifyMode(user_set.isVerifyFile());
 
-			if (user_set.getAssetIconPath().isSet)
-				obj.setAssetIconExtractPath(user_set.getAssetIconPath().var);
-			if (user_set.getAssetNacpPath().isSet)
-				obj.setAssetNacpExtractPath(user_set.getAssetNacpPath().var);
+		obj.process();
+	}
+	else if (file_type == FILE_PKI_CERT)
+	{
+		PkiCertProcess obj;
 
-			if (user_set.getFsPath().isSet)
-				obj.setAssetRomfsExtractPath(user_set.getFsPath().var);
-			obj.setAssetListFs(user_set.isListFs());
+		obj.setInputFile(inputFile);
+		obj.setKeyCfg(user_set.getKeyCfg());
+		obj.setCliOutputMode(user_set.getCliOutputMode());
+		obj.setVerifyMode(user_set.isVerifyFile());
 
-			obj.process();
-		}
-		else if (user_set.getFileType() == FILE_NACP)
-		{
-			NacpProcess obj;
+		obj.process();
+	}
+	else if (file_type == FILE_ES_TIK)
+	{
+		EsTikProcess obj;
 
-			obj.setInputFile(inputFile);
-			obj.setCliOutputMode(user_set.getCliOutputMode());
-			obj.setVerifyMode(user_set.isVerifyFile());
+		obj.setInputFile(inputFile);
+		obj.setKeyCfg(user_set.getKeyCfg());
+		obj.setCertificateChain(user_set.getCertificateChain());
+		obj.setCliOutputMode(user_set.getCliOutputMode());
+		obj.setVerifyMode(user_set.isVerifyFile());
 
-			obj.process();
-		}
-		else if (user_set.getFileType() == FILE_INI)
-		{
-			IniProcess obj;
+		obj.process();
+	}
+	else if (file_type == FILE_HB_ASSET)
+	{
+		AssetProcess obj;
 
-			obj.setInputFile(inputFile);
-			obj.setCliOutputMode(user_set.getCliOutputMode());
-			obj.setVerifyMode(user_set.isVerifyFile());
+		obj.setInputFile(inputFile);
+		obj.setCliOutputMode(user_set.getCliOutputMode());
+		obj.setVerifyMode(user_set.isVerifyFile());
 
-			if (user_set.getKipExtractPath().isSet)
-				obj.setKipExtractPath(user_set.getKipExtractPath().var);
+		if (user_set.getAssetIconPath().isSet)
+			obj.setIconExtractPath(user_set.getAssetIconPath().var);
+		if (user_set.getAssetNacpPath().isSet)
+			obj.setNacpExtractPath(user_set.getAssetNacpPath().var);
 
-			obj.process();
-		}
-		else if (user_set.getFileType() == FILE_KIP)
-		{
-			KipProcess obj;
+		if (user_set.getFsPath().isSet)
+			obj.setRomfsExtractPath(user_set.getFsPath().var);
+		obj.setRomfsExtractFilter(user_set.getExtractFilter());
+		obj.setListFs(user_set.isListFs());
 
-			obj.setInputFile(inputFile);
-			obj.setCliOutputMode(user_set.getCliOutputMode());
-			obj.setVerifyMode(user_set.isVerifyFile());
+		obj.process();
+	}
+	else
+	{
+		throw fnd::Exception("main", "Unhandled file type");
+	}
 
-			obj.process();
-		}
-		else if (user_set.getFileType() == FILE_PKI_CERT)
-		{
-			PkiCertProcess obj;
+	if (extractArchive != nullptr)
+		extractArchive->close();
+}
 
-			obj.setInputFile(inputFile);
-			obj.setKeyCfg(user_set.getKeyCfg());
-			obj.setCliOutputMode(user_set.getCliOutputMode());
-			obj.setVerifyMode(user_set.isVerifyFile());
+#ifdef _WIN32
+int wmain(int argc, wchar_t** argv)
+#else
+int main(int argc, char** argv)
+#endif
+{
+	std::vector<std::string> args;
+	for (size_t i = 0; i < (size_t)argc; i++)
+	{
+#ifdef _WIN32
+		args.push_back(fnd::StringConv::ConvertChar16ToChar8(std::u16string((char16_t*)argv[i])));
+#else
+		args.push_back(argv[i]);
+#endif
+	}
 
-			obj.process();
-		}
-		else if (user_set.getFileType() == FILE_ES_TIK)
-		{
-			EsTikProcess obj;
+	UserSettings user_set;
+	try {
+		user_set.parseCmdArgs(args);
 
-			obj.setInputFile(inputFile);
-			obj.setKeyCfg(user_set.getKeyCfg());
-			obj.setCertificateChain(user_set.getCertificateChain());
-			obj.setCliOutputMode(user_set.getCliOutputMode());
-			obj.setVerifyMode(user_set.isVerifyFile());
+		// one cache of verified NCA blocks for the whole run, so a partition read more than once is only decrypted and hashed once
+		std::shared_ptr<BlockCache> ncaBlockCache;
+		if (user_set.getNcaCacheSize() > 0)
+			ncaBlockCache = std::make_shared<BlockCache>(user_set.getNcaCacheSize());
 
-			obj.process();
-		}
-		else if (user_set.getFileType() == FILE_HB_ASSET)
+		if (user_set.isBatchInput())
 		{
-			AssetProcess obj;
+			BatchProcess obj;
 
-			obj.setInputFile(inputFile);
+			// the workers are spread over the files, so each file is processed on a single thread
+			obj.setInputPath(user_set.getInputPath());
+			obj.setThreadNum(user_set.getThreadNum());
 			obj.setCliOutputMode(user_set.getCliOutputMode());
-			obj.setVerifyMode(user_set.isVerifyFile());
-
-			if (user_set.getAssetIconPath().isSet)
-				obj.setIconExtractPath(user_set.getAssetIconPath().var);
-			if (user_set.getAssetNacpPath().isSet)
-				obj.setNacpExtractPath(user_set.getAssetNacpPath().var);
+			obj.setFileProcessor([&user_set, &ncaBlockCache](const std::string& path) {
+				FileType file_type = user_set.getFileType();
+				if (file_type == FILE_INVALID)
+					file_type = user_set.determineFileTypeFromFile(path);
+				if (file_type == FILE_INVALID)
+					throw fnd::Exception("main", "Unknown file type.");
 
-			if (user_set.getFsPath().isSet)
-				obj.setRomfsExtractPath(user_set.getFsPath().var);
-			obj.setListFs(user_set.isListFs());
+				processFile(user_set, path, file_type, 1, ncaBlockCache);
+			});
 
 			obj.process();
 		}
 		else
 		{
-			throw fnd::Exception("main", "Unhandled file type");
+			processFile(user_set, user_set.getInputPath(), user_set.getFileType(), user_set.getThreadNum(), ncaBlockCache);
 		}
 	}
 	catch (const fnd::Exception& e) {